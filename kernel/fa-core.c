@@ -10,7 +10,6 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/init.h>
-#include <linux/version.h>
 
 #include "fmc-adc-100m14b4cha.h"
 
@@ -25,6 +24,119 @@ module_param_named(enable_test_data, fa_enable_test_data, int, 0444);
 static int fa_internal_trig_test = 0;
 module_param_named(internal_trig_test, fa_internal_trig_test, int, 0444);
 
+/*
+ * Bitfield writes to the ADC core take the register value from a shadow
+ * copy instead of reading it. 0 disables the shadow, 2 checks the shadow
+ * against the hardware on every bitfield write (debug)
+ */
+static int fa_csr_shadow = FA_CSR_SHADOW_ON;
+module_param_named(csr_shadow, fa_csr_shadow, int, 0444);
+
+/*
+ * ADC core fields written by the hardware or self-clearing. Their bits
+ * are never taken from the shadow
+ */
+static const int fa_csr_volatile_id[] = {
+	ZFA_CTL_FMS_CMD,
+	ZFA_STA_FSM,
+	ZFA_STA_SERDES_PLL,
+	ZFA_STA_SERDES_SYNCED,
+	ZFAT_SW,
+	ZFAT_SHOTS_REM,
+	ZFAT_SAMPLING_HZ,
+	ZFAT_POS,
+	ZFAT_CNT,
+	ZFA_CH1_STA,
+	ZFA_CH2_STA,
+	ZFA_CH3_STA,
+	ZFA_CH4_STA,
+	ZFA_MULT_MAX_SAMP,
+};
+/* Volatile bits of each register, built from zfad_regs[] */
+static uint32_t fa_csr_volatile[FA_CSR_SHADOW_N];
+
+static void fa_csr_volatile_init(void)
+{
+	const struct zfa_field_desc *field;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(fa_csr_volatile_id); ++i) {
+		field = &zfad_regs[fa_csr_volatile_id[i]];
+		fa_csr_volatile[field->offset / 4] |= field->mask;
+	}
+}
+
+static int fa_csr_is_shadowed(struct fa_dev *fa, unsigned int base_off,
+			      const struct zfa_field_desc *field)
+{
+	unsigned int i = field->offset / 4;
+
+	return fa_csr_shadow != FA_CSR_SHADOW_OFF &&
+		base_off == fa->fa_adc_csr_base &&
+		i < FA_CSR_SHADOW_N && fa_csr_volatile[i] != ~0;
+}
+
+/*
+ * fa_csr_rmw_get
+ * @fa: the fmc-adc descriptor
+ * @base_off: base address of the core
+ * @field: field about to be written
+ *
+ * It returns the current value of the register containing @field, so that
+ * fa_writel() can modify the field. For the ADC core the value comes from
+ * the shadow, without reading the hardware; volatile bits are 0.
+ */
+uint32_t fa_csr_rmw_get(struct fa_dev *fa, unsigned int base_off,
+			const struct zfa_field_desc *field)
+{
+	unsigned int i = field->offset / 4;
+	uint32_t cur, hw;
+
+	if (!fa_csr_is_shadowed(fa, base_off, field))
+		return fa_ioread(fa, base_off + field->offset);
+
+	if (!test_bit(i, fa->csr_shadow_valid)) {
+		cur = fa_ioread(fa, base_off + field->offset);
+		fa_csr_shadow_set(fa, base_off, field, cur);
+		return fa->csr_shadow[i];
+	}
+
+	cur = fa->csr_shadow[i];
+	if (fa_csr_shadow == FA_CSR_SHADOW_CHECK) {
+		hw = fa_ioread(fa, base_off + field->offset);
+		if ((hw ^ cur) & ~fa_csr_volatile[i]) {
+			dev_warn(fa->msgdev,
+				 "addr 0x%lx: shadow 0x%x, hardware 0x%x\n",
+				 base_off + field->offset, cur, hw);
+			fa_csr_shadow_set(fa, base_off, field, hw);
+			cur = fa->csr_shadow[i];
+		}
+	}
+
+	return cur;
+}
+
+/*
+ * fa_csr_shadow_set
+ * @fa: the fmc-adc descriptor
+ * @base_off: base address of the core
+ * @field: field just written
+ * @val: value written in the register
+ *
+ * Update the shadow after a write
+ */
+void fa_csr_shadow_set(struct fa_dev *fa, unsigned int base_off,
+		       const struct zfa_field_desc *field, uint32_t val)
+{
+	unsigned int i = field->offset / 4;
+
+	if (!fa_csr_is_shadowed(fa, base_off, field))
+		return;
+
+	fa->csr_shadow[i] = val & ~fa_csr_volatile[i];
+	set_bit(i, fa->csr_shadow_valid);
+}
+
 static const int zfad_hw_range[] = {
 	[FA100M14B4C_RANGE_10V]   = 0x45,
 	[FA100M14B4C_RANGE_1V]    = 0x11,
@@ -32,9 +144,6 @@ static const int zfad_hw_range[] = {
 	[FA100M14B4C_RANGE_OPEN]  = 0x00,
 };
 
-/* fmc-adc specific workqueue */
-struct workqueue_struct *fa_workqueue;
-
 /*
  * zfad_convert_hw_range
  * @usr_val: range value
@@ -182,14 +291,18 @@ int zfad_set_range(struct fa_dev *fa, struct zio_channel *chan,
 }
 
 /*
- * zfad_fsm_command
+ * __zfad_fsm_command
  * @fa: the fmc-adc descriptor
  * @command: the command to apply to FSM
+ * @automatic: the command comes from an automatic start
  *
  * This function checks if the command can be done and performs some
- * preliminary operation beforehand
+ * preliminary operation beforehand. An automatic start that cannot arm
+ * the trigger is retried every FA_RESTART_DELAY_MS and counted as an
+ * overrun, so it is not reported in the kernel log.
  */
-int zfad_fsm_command(struct fa_dev *fa, uint32_t command)
+static int __zfad_fsm_command(struct fa_dev *fa, uint32_t command,
+			      int automatic)
 {
 	struct zio_cset *cset = fa->zdev->cset;
 	uint32_t val;
@@ -200,6 +313,9 @@ int zfad_fsm_command(struct fa_dev *fa, uint32_t command)
 		return -EINVAL;
 	}
 
+	/* Any command overrides a pending automatic start */
+	cancel_delayed_work(&fa->restart_work);
+
 	/*
 	 * When any command occurs we are ready to start a new acquisition, so
 	 * we must abort any previous one. If it is STOP, we abort because we
@@ -250,8 +366,12 @@ int zfad_fsm_command(struct fa_dev *fa, uint32_t command)
 		 * from zfat_arm_trigger() or zfad_input_cset()
 		 */
 		if (!(cset->ti->flags & ZIO_TI_ARMED)) {
-			dev_info(fa->msgdev, "Cannot start acquisition: "
-				 "Trigger refuses to arm\n");
+			if (automatic)
+				dev_dbg(fa->msgdev, "Cannot start acquisition: "
+					"Trigger refuses to arm\n");
+			else
+				dev_info(fa->msgdev, "Cannot start acquisition: "
+					 "Trigger refuses to arm\n");
 			return -EIO;
 		}
 
@@ -268,6 +388,67 @@ int zfad_fsm_command(struct fa_dev *fa, uint32_t command)
 	return 0;
 }
 
+int zfad_fsm_command(struct fa_dev *fa, uint32_t command)
+{
+	return __zfad_fsm_command(fa, command, 0);
+}
+
+/*
+ * fa_restart_work
+ * @work: the restart work of a device
+ *
+ * Try again to start a continuous acquisition, see zfad_fsm_auto_start()
+ */
+static void fa_restart_work(struct work_struct *work)
+{
+	struct fa_dev *fa = container_of(to_delayed_work(work), struct fa_dev,
+					 restart_work);
+	int err;
+
+	/*
+	 * Commands from user space run under the device lock: a STOP
+	 * clears enable_auto_start, so check it again while holding it
+	 */
+	spin_lock(&fa->zdev->lock);
+	if (!fa->enable_auto_start) {
+		spin_unlock(&fa->zdev->lock);
+		return;
+	}
+	err = __zfad_fsm_command(fa, FA100M14B4C_CMD_START, 1);
+	if (err)
+		queue_delayed_work(fa->irq_wq, &fa->restart_work,
+				   msecs_to_jiffies(FA_RESTART_DELAY_MS));
+	spin_unlock(&fa->zdev->lock);
+}
+
+/*
+ * zfad_fsm_auto_start
+ * @fa: the fmc-adc descriptor
+ *
+ * Start the next acquisition of a continuous acquisition (fsm-auto-start).
+ * If the trigger cannot be armed, most likely because the ZIO buffer is
+ * full, the acquisition does not stop: it is restarted as soon as
+ * possible and the gap is counted as an overrun.
+ */
+void zfad_fsm_auto_start(struct fa_dev *fa)
+{
+	dev_dbg(fa->msgdev, "Automatic start\n");
+	/* Like fa_restart_work(): a STOP may have come meanwhile */
+	spin_lock(&fa->zdev->lock);
+	if (!fa->enable_auto_start ||
+	    !__zfad_fsm_command(fa, FA100M14B4C_CMD_START, 1)) {
+		spin_unlock(&fa->zdev->lock);
+		return;
+	}
+
+	fa->n_overrun++;
+	dev_dbg(fa->msgdev, "Automatic start failed, overrun %d\n",
+		fa->n_overrun);
+	queue_delayed_work(fa->irq_wq, &fa->restart_work,
+			   msecs_to_jiffies(FA_RESTART_DELAY_MS));
+	spin_unlock(&fa->zdev->lock);
+}
+
 /* Extract from SDB the base address of the core components */
 /* which are not carrier specific */
 static int __fa_sdb_get_device(struct fa_dev *fa)
@@ -433,6 +614,7 @@ int fa_probe(struct fmc_device *fmc)
 	fmc_set_drvdata(fmc, fa);
 	fa->fmc = fmc;
 	fa->msgdev = &fa->fmc->dev;
+	INIT_DELAYED_WORK(&fa->restart_work, fa_restart_work);
 
 	/* apply carrier-specific hacks and workarounds */
 	fa->carrier_op = NULL;
@@ -492,6 +674,8 @@ int fa_probe(struct fmc_device *fmc)
 	err = fa->carrier_op->reset_core(fa);
 	if (err < 0)
 		goto out;
+	/* The core has been reset: the register shadow is empty */
+	bitmap_zero(fa->csr_shadow_valid, FA_CSR_SHADOW_N);
 
 	/* init all subsystems */
 	for (i = 0, m = mods; i < ARRAY_SIZE(mods); i++, m++) {
@@ -533,8 +717,9 @@ int fa_remove(struct fmc_device *fmc)
 	struct fa_modlist *m;
 	int i = ARRAY_SIZE(mods);
 
+	fa->enable_auto_start = 0;
+	cancel_delayed_work_sync(&fa->restart_work);
 	fa_free_irqs(fa);
-	flush_workqueue(fa_workqueue);
 
 	while (--i >= 0) {
 		m = mods + i;
@@ -571,16 +756,7 @@ static int fa_init(void)
 {
 	int ret;
 
-	#if LINUX_VERSION_CODE < KERNEL_VERSION(3,15,0)
-	fa_workqueue = alloc_workqueue(fa_dev_drv.driver.name,
-					WQ_NON_REENTRANT | WQ_UNBOUND |
-					WQ_MEM_RECLAIM, 1);
-	#else
-	fa_workqueue = alloc_workqueue(fa_dev_drv.driver.name,
-				       WQ_UNBOUND | WQ_MEM_RECLAIM, 1);
-	#endif
-	if (fa_workqueue == NULL)
-		return -ENOMEM;
+	fa_csr_volatile_init();
 
 	/* First trigger and zio driver */
 	ret = fa_trig_init();
@@ -603,8 +779,6 @@ out3:
 out2:
 	fa_trig_exit();
 out1:
-	destroy_workqueue(fa_workqueue);
-
 	return ret;
 }
 
@@ -613,8 +787,6 @@ static void fa_exit(void)
 	fmc_driver_unregister(&fa_dev_drv);
 	fa_zio_unregister();
 	fa_trig_exit();
-	if (fa_workqueue != NULL)
-		destroy_workqueue(fa_workqueue);
 }
 
 module_init(fa_init);
@@ -12,6 +12,11 @@
 #include <linux/bitops.h>
 #include <linux/spinlock.h>
 #include <linux/io.h>
+#include <linux/cpumask.h>
+#include <linux/workqueue.h>
+#include <linux/version.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 
 #include "fmc-adc-100m14b4cha.h"
 #include "fa-spec.h"
@@ -79,6 +84,7 @@ int zfad_dma_start(struct zio_cset *cset)
 	}
 
 	dev_dbg(fa->msgdev, "Start DMA transfer\n");
+	fa->dma_start_time = ktime_get();
 	err = fa->carrier_op->dma_start(cset);
 	if (err)
 		return err;
@@ -106,9 +112,17 @@ void zfad_dma_done(struct zio_cset *cset)
 	struct zio_timestamp ztstamp;
 	int i;
 	uint32_t *trig_timetag;
+	s64 ns;
 
 	fa->carrier_op->dma_done(cset);
 
+	/* Readout bandwidth of this acquisition, trigger time-tags included */
+	ns = ktime_to_ns(ktime_sub(ktime_get(), fa->dma_start_time));
+	if (ns > 0)
+		fa->dma_kbps = div64_u64((u64)fa->n_shots *
+					 zfad_block[0].block->datalen *
+					 NSEC_PER_SEC, ns * 1024);
+
 	/* for each shot, set the timetag of each ctrl block by reading the
 	 * trig-timetag appended after the samples. Set also the acquisition
 	 * start timetag on every blocks
@@ -122,6 +136,13 @@ void zfad_dma_done(struct zio_cset *cset)
 	for (i = 0; i < fa->n_shots; ++i) {
 		block = zfad_block[i].block;
 		ctrl = zio_get_ctrl(block);
+		/* Copy the current control into the block */
+		memcpy(ctrl, interleave->current_ctrl,
+		       zio_control_size(interleave));
+		if (fa->data_big_endian) {
+			ctrl->flags &= ~ZIO_CONTROL_LITTLE_ENDIAN;
+			ctrl->flags |= ZIO_CONTROL_BIG_ENDIAN;
+		}
 		trig_timetag = (uint32_t *)(block->data + block->datalen
 					    - FA_TRIG_TIMETAG_BYTES);
 		/* Timetag marker (metadata) used for debugging */
@@ -283,8 +304,7 @@ end:
 		zfad_dma_error(cset);
 	} else if (fa->enable_auto_start) {
 		/* Automatic start next acquisition */
-		dev_dbg(fa->msgdev, "Automatic start\n");
-		zfad_fsm_command(fa, FA100M14B4C_CMD_START);
+		zfad_fsm_auto_start(fa);
 	}
 
 	/* ack the irq */
@@ -337,6 +357,7 @@ irqreturn_t fa_irq_handler(int irq_core_base, void *dev_id)
 	uint32_t status;
 	unsigned long flags;
 	struct zfad_block *zfad_block;
+	unsigned int cpu;
 
 	/* irq to handle */
 	fa_get_irq_status(fa, irq_core_base, &status);
@@ -364,7 +385,10 @@ irqreturn_t fa_irq_handler(int irq_core_base, void *dev_id)
 		if (cset->flags & ZIO_CSET_HW_BUSY) {
 			/* Job deferred to the workqueue: */
 			/* Start DMA and ack irq on the carrier */
-			queue_work(fa_workqueue, &fa->irq_work);
+			cpu = fa->work_cpu;
+			if (cpu != WORK_CPU_UNBOUND && !cpu_online(cpu))
+				cpu = WORK_CPU_UNBOUND;
+			queue_work_on(cpu, fa->irq_wq, &fa->irq_work);
 			/* register the core firing the IRQ in order to */
 			/* check right IRQ seq.: ACQ_END followed by DMA_END */
 			fa->last_irq_core_src = irq_core_base;
@@ -401,6 +425,22 @@ int fa_setup_irqs(struct fa_dev *fa)
 	 * It cannot provided throught irq_request() call therefore the trick
 	 * is to set it by means of the field irq provided by the fmc device
 	 */
+	/*
+	 * workqueue is required to execute DMA transaction. Each device
+	 * has its own, so that boards do not wait for each other
+	 */
+	#if LINUX_VERSION_CODE < KERNEL_VERSION(3,15,0)
+	fa->irq_wq = alloc_workqueue("%s", WQ_NON_REENTRANT | WQ_HIGHPRI |
+				     WQ_MEM_RECLAIM, 1, dev_name(fa->msgdev));
+	#else
+	fa->irq_wq = alloc_workqueue("%s", WQ_HIGHPRI | WQ_MEM_RECLAIM, 1,
+				     dev_name(fa->msgdev));
+	#endif
+	if (!fa->irq_wq)
+		return -ENOMEM;
+	INIT_WORK(&fa->irq_work, fa_irq_work);
+	fa->work_cpu = WORK_CPU_UNBOUND;
+
 	fmc->irq = fa->fa_irq_adc_base;
 	err = fmc_irq_request(fmc, fa_irq_handler,
 			      "fmc-adc-100m14b",
@@ -408,10 +448,9 @@ int fa_setup_irqs(struct fa_dev *fa)
 	if (err) {
 		dev_err(fa->msgdev, "can't request irq %i (error %i)\n",
 			fa->fmc->irq, err);
+		destroy_workqueue(fa->irq_wq);
 		return err;
 	}
-	/* workqueue is required to execute DMA transaction */
-	INIT_WORK(&fa->irq_work, fa_irq_work);
 
 	/* set IRQ sources to listen */
 	fa->irq_src = FA_IRQ_SRC_ACQ;
@@ -441,6 +480,9 @@ int fa_free_irqs(struct fa_dev *fa)
 	fmc->irq = fa->fa_irq_adc_base;
 	fmc_irq_free(fmc);
 
+	/* Wait for the pending work, nothing can queue it anymore */
+	destroy_workqueue(fa->irq_wq);
+
 	return 0;
 }
 
@@ -194,4 +194,6 @@ struct fa_carrier_op fa_spec_op = {
 	.dma_start = fa_spec_dma_start,
 	.dma_done = fa_spec_dma_done,
 	.dma_error = fa_spec_dma_error,
+	.dma_prepare = fa_spec_dma_prepare,
+	.dma_unprepare = fa_spec_dma_unprepare,
 };
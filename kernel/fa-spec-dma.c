@@ -15,15 +15,36 @@
 #include "fmc-adc-100m14b4cha.h"
 #include "fa-spec.h"
 
+/* Write a DMA item on the device, so that it starts from there */
+static void fa_spec_dma_item_load(struct fa_dev *fa,
+				  struct gncore_dma_item *item)
+{
+	struct fa_spec_data *spec_data = fa->carrier_data;
 
+	fa_writel(fa, spec_data->fa_dma_base,
+		  &fa_spec_regs[ZFA_DMA_ADDR], item->start_addr);
+	fa_writel(fa, spec_data->fa_dma_base,
+		  &fa_spec_regs[ZFA_DMA_ADDR_L], item->dma_addr_l);
+	fa_writel(fa, spec_data->fa_dma_base,
+		  &fa_spec_regs[ZFA_DMA_ADDR_H], item->dma_addr_h);
+	fa_writel(fa, spec_data->fa_dma_base,
+		  &fa_spec_regs[ZFA_DMA_LEN], item->dma_len);
+	fa_writel(fa, spec_data->fa_dma_base,
+		  &fa_spec_regs[ZFA_DMA_NEXT_L], item->next_addr_l);
+	fa_writel(fa, spec_data->fa_dma_base,
+		  &fa_spec_regs[ZFA_DMA_NEXT_H], item->next_addr_h);
+	/* Set that there is a next item */
+	fa_writel(fa, spec_data->fa_dma_base,
+		  &fa_spec_regs[ZFA_DMA_BR_LAST], item->attribute);
+}
 
-static int gncore_dma_fill(struct zio_dma_sg *zsg)
+/* Prepare the DMA item of a page; the chain is in coherent memory */
+static int gncore_dma_fill_item(struct zio_dma_sg *zsg)
 {
 	struct gncore_dma_item *item = (struct gncore_dma_item *)zsg->page_desc;
 	struct scatterlist *sg = zsg->sg;
 	struct zio_channel *chan = zsg->zsgt->chan;
 	struct fa_dev *fa = chan->cset->zdev->priv_d;
-	struct fa_spec_data *spec_data = fa->carrier_data;
 	dma_addr_t tmp;
 
 	/* Prepare DMA item */
@@ -43,25 +64,6 @@ static int gncore_dma_fill(struct zio_dma_sg *zsg)
 		item->attribute = 0x0;	/* last item */
 	}
 
-	/* The first item is written on the device */
-	if (zsg->page_idx == 0) {
-		fa_writel(fa, spec_data->fa_dma_base,
-			  &fa_spec_regs[ZFA_DMA_ADDR], item->start_addr);
-		fa_writel(fa, spec_data->fa_dma_base,
-			  &fa_spec_regs[ZFA_DMA_ADDR_L], item->dma_addr_l);
-		fa_writel(fa, spec_data->fa_dma_base,
-			  &fa_spec_regs[ZFA_DMA_ADDR_H], item->dma_addr_h);
-		fa_writel(fa, spec_data->fa_dma_base,
-			  &fa_spec_regs[ZFA_DMA_LEN], item->dma_len);
-		fa_writel(fa, spec_data->fa_dma_base,
-			  &fa_spec_regs[ZFA_DMA_NEXT_L], item->next_addr_l);
-		fa_writel(fa, spec_data->fa_dma_base,
-			  &fa_spec_regs[ZFA_DMA_NEXT_H], item->next_addr_h);
-		/* Set that there is a next item */
-		fa_writel(fa, spec_data->fa_dma_base,
-			  &fa_spec_regs[ZFA_DMA_BR_LAST], item->attribute);
-	}
-
 	dev_dbg(fa->msgdev, "DMA item %d (block %d)\n"
 		"    addr   0x%x\n"
 		"    addr_l 0x%x\n"
@@ -78,6 +80,62 @@ static int gncore_dma_fill(struct zio_dma_sg *zsg)
 	return 0;
 }
 
+static int gncore_dma_fill(struct zio_dma_sg *zsg)
+{
+	struct zio_channel *chan = zsg->zsgt->chan;
+	struct fa_dev *fa = chan->cset->zdev->priv_d;
+
+	gncore_dma_fill_item(zsg);
+	/* The first item is written on the device */
+	if (zsg->page_idx == 0)
+		fa_spec_dma_item_load(fa, zsg->page_desc);
+	return 0;
+}
+
+/*
+ * fa_spec_dma_prepare
+ * @cset: channel set
+ * @zfad_block: blocks of the next acquisition, with their memory offsets
+ * @n_shots: number of blocks
+ *
+ * Map the blocks of the block pool and build their DMA items in process
+ * context, while the previous acquisition is running. The transfer then
+ * only writes the first item to the device (fa_spec_dma_start). The
+ * offsets must be final: this is for multi-shot acquisitions only
+ */
+struct zio_dma_sgt *fa_spec_dma_prepare(struct zio_cset *cset,
+					struct zfad_block *zfad_block,
+					unsigned int n_shots)
+{
+	struct fa_dev *fa = cset->zdev->priv_d;
+	struct zio_block *blocks[n_shots];
+	struct zio_dma_sgt *zdma;
+	int i, err;
+
+	for (i = 0; i < n_shots; ++i)
+		blocks[i] = zfad_block[i].block;
+	zdma = zio_dma_alloc_sg(cset->interleave, fa->fmc->hwdev, blocks,
+				n_shots, GFP_KERNEL);
+	if (IS_ERR(zdma))
+		return zdma;
+	for (i = 0; i < zdma->n_blocks; ++i)
+		zdma->sg_blocks[i].dev_mem_off = zfad_block[i].dev_mem_off;
+	err = zio_dma_map_sg(zdma, sizeof(struct gncore_dma_item),
+			     gncore_dma_fill_item);
+	if (err) {
+		zio_dma_free_sg(zdma);
+		return ERR_PTR(err);
+	}
+	return zdma;
+}
+
+/* Release a mapping from fa_spec_dma_prepare which was not used */
+void fa_spec_dma_unprepare(struct fa_dev *fa, struct zio_dma_sgt *zdma)
+{
+	zio_dma_unmap_sg(zdma);
+	zio_dma_free_sg(zdma);
+}
+
 int fa_spec_dma_start(struct zio_cset *cset)
 {
 	struct fa_dev *fa = cset->zdev->priv_d;
@@ -87,6 +145,20 @@ int fa_spec_dma_start(struct zio_cset *cset)
 	struct zio_block *blocks[fa->n_shots];
 	int i, err;
 
+	/*
+	 * The block pool mapped the blocks already: just start. It only
+	 * does it for multi-shot acquisitions, whose offsets are fixed
+	 */
+	if (fa->zdma_next && fa->n_shots > 1) {
+		fa->zdma = fa->zdma_next;
+		fa->zdma_next = NULL;
+		fa->n_dma_cache_hit++;
+		fa_spec_dma_item_load(fa, fa->zdma->page_desc_pool);
+		fa_writel(fa, spec_data->fa_dma_base,
+			  &fa_spec_regs[ZFA_DMA_CTL_START], 1);
+		return 0;
+	}
+
 	/*
 	 *  FIXME very inefficient because arm trigger already prepare
 	 * something like zio_block_sg. In the future ZIO can alloc more
@@ -127,6 +199,7 @@ void fa_spec_dma_done(struct zio_cset *cset)
 
 	zio_dma_unmap_sg(fa->zdma);
 	zio_dma_free_sg(fa->zdma);
+	fa->zdma = NULL;
 }
 
 void fa_spec_dma_error(struct zio_cset *cset)
@@ -103,5 +103,9 @@ extern irqreturn_t fa_spec_irq_handler(int irq, void *dev_id);
 extern int fa_spec_dma_start(struct zio_cset *cset);
 extern void fa_spec_dma_done(struct zio_cset *cset);
 extern void fa_spec_dma_error(struct zio_cset *cset);
+extern struct zio_dma_sgt *fa_spec_dma_prepare(struct zio_cset *cset,
+					       struct zfad_block *zfad_block,
+					       unsigned int n_shots);
+extern void fa_spec_dma_unprepare(struct fa_dev *fa, struct zio_dma_sgt *zdma);
 
 #endif /* __FA_SPEC_CORE_H__*/
@@ -10,6 +10,7 @@
 #include <linux/module.h>
 #include <linux/moduleparam.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <linux/delay.h>
 
 #include <svec.h>
@@ -52,6 +53,7 @@ static int fa_svec_init(struct fa_dev *fa)
 
 	/* register carrier data */
 	fa->carrier_data = cdata;
+	fa_svec_dma_mode_init(fa);
 	return 0;
 }
 
@@ -62,6 +64,9 @@ static int fa_svec_reset(struct fa_dev *fa)
 
 static void fa_svec_exit(struct fa_dev *fa)
 {
+	struct fa_svec_data *cdata = fa->carrier_data;
+
+	vfree(cdata->dma_buf);
 	kfree(fa->carrier_data);
 }
 
@@ -1,5 +1,7 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
+#include <linux/vmalloc.h>
+#include <linux/swab.h>
 #include <asm/byteorder.h>
 #include "fmc-adc-100m14b4cha.h"
 #include "fa-svec.h"
@@ -7,13 +9,61 @@
 
 #define VME_NO_ADDR_INCREMENT 1
 
+/*
+ * Multi-shot acquisitions up to this size (in KiB) are read with a single
+ * VME DMA transfer into a driver buffer and then split into the ZIO
+ * blocks. Bigger acquisitions, or 0 here, use one transfer per shot.
+ */
+static unsigned int fa_dma_batch_kb = 65536;
+module_param_named(dma_batch_kb, fa_dma_batch_kb, uint, 0444);
+
 /* FIXME: move to include again */
 #ifndef lower_32_bits
 #define lower_32_bits(n) ((u32)(n))
 #endif /* lower_32_bits */
 
+/*
+ * VME transfer mode for the DMA: 0 single cycle (D32, default), 1 block
+ * transfer (BLT, D32), 2 multiplexed block transfer (MBLT, D64). Block
+ * transfers must be requested: when one fails the device falls back to
+ * single cycle.
+ */
+static int fa_vme_dma_mode = FA_SVEC_DMA_SCT;
+module_param_named(vme_dma_mode, fa_vme_dma_mode, int, 0444);
+
+/* Address modifier and data width of each transfer mode */
+static const struct {
+	enum vme_address_modifier am;
+	enum vme_data_width data_width;
+	unsigned int align; /* bytes of a single data cycle */
+} fa_svec_dma_modes[] = {
+	[FA_SVEC_DMA_SCT] = {VME_A24_USER_DATA_SCT, VME_D32, 4},
+	[FA_SVEC_DMA_BLT] = {VME_A24_USER_BLT, VME_D32, 4},
+	[FA_SVEC_DMA_MBLT] = {VME_A24_USER_MBLT, VME_D64, 8},
+};
+
+/*
+ * fa_svec_dma_mode_init
+ * @fa: the fmc-adc descriptor
+ *
+ * Set the transfer mode of a device from the module parameter
+ */
+void fa_svec_dma_mode_init(struct fa_dev *fa)
+{
+	struct fa_svec_data *svec_data = fa->carrier_data;
+
+	if (fa_vme_dma_mode < FA_SVEC_DMA_SCT ||
+	    fa_vme_dma_mode > FA_SVEC_DMA_MBLT) {
+		dev_warn(fa->msgdev, "invalid vme_dma_mode %d, using SCT\n",
+			 fa_vme_dma_mode);
+		svec_data->dma_mode = FA_SVEC_DMA_SCT;
+		return;
+	}
+	svec_data->dma_mode = fa_vme_dma_mode;
+}
+
 static void build_dma_desc(struct vme_dma *desc, unsigned long vme_addr,
-			void *addr_dest, ssize_t len)
+			void *addr_dest, ssize_t len, int mode)
 {
 	struct vme_dma_attr *vme;
 	struct vme_dma_attr *pci;
@@ -32,9 +82,11 @@ static void build_dma_desc(struct vme_dma *desc, unsigned long vme_addr,
 	desc->ctrl.vme_block_size   = VME_DMA_BSIZE_4096;
 	desc->ctrl.vme_backoff_time = VME_DMA_BACKOFF_0;
 
-	vme->data_width = VME_D32;
-	vme->am         = VME_A24_USER_DATA_SCT;
-	/*vme->am         = VME_A24_USER_MBLT;*/
+	/* Block transfers need whole data cycles */
+	if (len % fa_svec_dma_modes[mode].align)
+		mode = FA_SVEC_DMA_SCT;
+	vme->data_width = fa_svec_dma_modes[mode].data_width;
+	vme->am         = fa_svec_dma_modes[mode].am;
 	vme->addru	= upper_32_bits(vme_addr);
 	vme->addrl	= lower_32_bits(vme_addr);
 
@@ -43,43 +95,114 @@ static void build_dma_desc(struct vme_dma *desc, unsigned long vme_addr,
 
 }
 
-/* Endianess */
-#ifndef LITTLE_ENDIAN
-#define LITTLE_ENDIAN 0
-#endif
+/*
+ * Endianess: VME is big endian. On little endian CPUs (known at compile
+ * time) samples and trig timetag, all seen as 32bits words, are swapped
+ * while copying. @dst and @src can be the same buffer
+ */
+#ifdef __LITTLE_ENDIAN
+static void __endianness(void *dst, const void *src, size_t byte_length)
+{
+	const uint32_t *s = src;
+	uint32_t *d = dst;
+	size_t i, size = byte_length / 4;
 
-#ifndef BIG_ENDIAN
-#define BIG_ENDIAN 1
+	for (i = 0; i < size; ++i)
+		d[i] = swab32(s[i]);
+}
+#else
+static void __endianness(void *dst, const void *src, size_t byte_length)
+{
+	if (dst != src)
+		memcpy(dst, src, byte_length);
+}
 #endif
 
-static int __get_endian(void)
+/*
+ * fa_svec_shot_copy
+ * @fa: the fmc-adc descriptor
+ * @dst: ZIO block data
+ * @src: transferred shot, it can be @dst
+ * @len: size of the shot
+ *
+ * Copy a shot and convert it to the CPU endianness. When the conversion is
+ * left to user space (data-swap-user) only the trigger time-tag, which the
+ * driver reads, is converted.
+ */
+static void fa_svec_shot_copy(struct fa_dev *fa, void *dst, const void *src,
+			      size_t len)
 {
-	int i = 1;
-	char *p = (char *)&i;
+	size_t raw = 0;
+
+	if (fa->data_swap_user) {
+		raw = len - FA_TRIG_TIMETAG_BYTES;
+		if (dst != src)
+			memcpy(dst, src, raw);
+	}
+	__endianness(dst + raw, src + raw, len - raw);
+}
 
-	if (p[0] == 1)
-		return LITTLE_ENDIAN;
-	else
-		return BIG_ENDIAN;
+/* Release the buffer of fa_svec_dma_batch(). Process context only */
+static void fa_svec_dma_buf_free(struct fa_svec_data *svec_data)
+{
+	vfree(svec_data->dma_buf);
+	svec_data->dma_buf = NULL;
+	svec_data->dma_buf_size = 0;
 }
 
-static void __endianness(unsigned int byte_length, void *buffer)
+/*
+ * fa_svec_dma_batch
+ * @fa: the fmc-adc descriptor
+ * @vme_addr: VME address of the DDR data window
+ * @len: size of all the shots
+ *
+ * Read all the shots with a single DMA transfer. Shots are contiguous in
+ * the DDR memory, so the transfer is copied into the ZIO blocks one after
+ * the other.
+ */
+static int fa_svec_dma_batch(struct fa_dev *fa, unsigned long vme_addr,
+			     size_t len)
 {
-	int i, size;
-	uint32_t *ptr;
-
-	/* CPU may be little endian, VME is big endian */
-	if (__get_endian() == LITTLE_ENDIAN) {
-		ptr = buffer;
-		/* swap samples and trig timetag all seen as 32bits words */
-		size = byte_length/4;
-		for (i = 0; i < size; ++i, ++ptr)
-			*ptr = __be32_to_cpu(*ptr);
+	struct fa_svec_data *svec_data = fa->carrier_data;
+	struct zfad_block *fa_dma_block = fa->zdev->cset->interleave->priv_d;
+	struct vme_dma desc;    /* Vme driver DMA structure */
+	void *src;
+	int i;
+
+	/*
+	 * The buffer is kept only for the automatic start of the next
+	 * acquisition (see fa_svec_dma_done), and only as big as the
+	 * current one
+	 */
+	if (svec_data->dma_buf_size != len) {
+		fa_svec_dma_buf_free(svec_data);
+		svec_data->dma_buf = vmalloc(len);
+		if (!svec_data->dma_buf)
+			return -ENOMEM;
+		svec_data->dma_buf_size = len;
 	}
 
+	dev_dbg(fa->msgdev,
+		"configure DMA descriptor for %d shots "
+		"vme addr: 0x%llx destination address: 0x%p len: %zu\n",
+		fa->n_shots, (long long)vme_addr, svec_data->dma_buf, len);
+	build_dma_desc(&desc, vme_addr, svec_data->dma_buf, len,
+		       svec_data->dma_mode);
+	if (vme_do_dma_kernel(&desc))
+		return -1;
+
+	/* Split the transfer into the ZIO blocks */
+	src = svec_data->dma_buf;
+	for (i = 0; i < fa->n_shots; ++i) {
+		fa_svec_shot_copy(fa, fa_dma_block[i].block->data, src,
+				  fa_dma_block[i].block->datalen);
+		src += fa_dma_block[i].block->datalen;
+	}
+
+	return 0;
 }
 
-int fa_svec_dma_start(struct zio_cset *cset)
+static int __fa_svec_dma_start(struct zio_cset *cset)
 {
 	struct fa_dev *fa = cset->zdev->priv_d;
 	struct fa_svec_data *svec_data = fa->carrier_data;
@@ -88,9 +211,15 @@ int fa_svec_dma_start(struct zio_cset *cset)
 	int i;
 	struct vme_dma desc;    /* Vme driver DMA structure */
 	unsigned long vme_addr;
+	size_t len;
 
 	vme_addr = svec_data->vme_base + svec_data->fa_dma_ddr_data;
 
+	/* Tell zfad_dma_done() to flag the payload as big endian */
+#ifdef __LITTLE_ENDIAN
+	fa->data_big_endian = fa->data_swap_user;
+#endif
+
 	/*
 	 * write the data address in the ddr_addr register: this
 	 * address has been computed after ACQ_END by looking to the
@@ -101,6 +230,20 @@ int fa_svec_dma_start(struct zio_cset *cset)
 	fa_writel(fa, svec_data->fa_dma_ddr_addr,
 			&fa_svec_regfield[FA_DMA_DDR_ADDR],
 			fa_dma_block[0].dev_mem_off/4);
+
+	/* All the shots have the same size */
+	len = (size_t)fa->n_shots * fa_dma_block[0].block->datalen;
+	if (fa->n_shots > 1 && len <= (size_t)fa_dma_batch_kb * 1024) {
+		if (!fa_svec_dma_batch(fa, vme_addr, len))
+			return 0;
+		/* Nothing was transferred if the buffer is missing */
+		if (!svec_data->dma_buf)
+			dev_warn(fa->msgdev,
+				 "no memory for a single DMA transfer\n");
+		else
+			return -1;
+	}
+
 	/* Execute DMA shot by shot */
 	for (i = 0; i < fa->n_shots; ++i) {
 		dev_dbg(fa->msgdev,
@@ -110,26 +253,56 @@ int fa_svec_dma_start(struct zio_cset *cset)
 			(int)fa_dma_block[i].block->datalen);
 		build_dma_desc(&desc, vme_addr,
 				fa_dma_block[i].block->data,
-				fa_dma_block[i].block->datalen);
+				fa_dma_block[i].block->datalen,
+				svec_data->dma_mode);
 
 		if (vme_do_dma_kernel(&desc))
 			return -1;
-		__endianness(fa_dma_block[i].block->datalen,
-			     fa_dma_block[i].block->data);
+		fa_svec_shot_copy(fa, fa_dma_block[i].block->data,
+				  fa_dma_block[i].block->data,
+				  fa_dma_block[i].block->datalen);
 	}
 
 	return 0;
 }
 
+int fa_svec_dma_start(struct zio_cset *cset)
+{
+	struct fa_dev *fa = cset->zdev->priv_d;
+	struct fa_svec_data *svec_data = fa->carrier_data;
+	int err;
+
+	err = __fa_svec_dma_start(cset);
+	if (!err || svec_data->dma_mode == FA_SVEC_DMA_SCT)
+		return err;
+
+	/*
+	 * The VME bridge, or the gateware, may not support block
+	 * transfers: use single cycle from now on. The DDR address is
+	 * written again, so the acquisition is read from the beginning
+	 */
+	dev_warn(fa->msgdev, "VME DMA %s failed, falling back to SCT\n",
+		 svec_data->dma_mode == FA_SVEC_DMA_MBLT ? "MBLT" : "BLT");
+	svec_data->dma_mode = FA_SVEC_DMA_SCT;
+	return __fa_svec_dma_start(cset);
+}
+
+/* The DMA runs in the irq work, so these are in process context too */
 void fa_svec_dma_done(struct zio_cset *cset)
 {
-	/* nothing special to do */
+	struct fa_dev *fa = cset->zdev->priv_d;
+
+	/* Without an automatic start, the acquisition is over */
+	if (!fa->enable_auto_start)
+		fa_svec_dma_buf_free(fa->carrier_data);
 }
 
 void fa_svec_dma_error(struct zio_cset *cset)
 {
 	struct fa_dev *fa = cset->zdev->priv_d;
 
+	fa_svec_dma_buf_free(fa->carrier_data);
+
 	dev_err(fa->msgdev,
 		"DMA error. All acquisition lost\n");
 }
@@ -31,6 +31,13 @@ enum fa_spec_regs_id {
 	FA_CAR_FMC1_RES,
 };
 
+/* VME DMA transfer modes */
+enum fa_svec_dma_mode {
+	FA_SVEC_DMA_SCT = 0,
+	FA_SVEC_DMA_BLT,
+	FA_SVEC_DMA_MBLT,
+};
+
 /* specific carrier data */
 struct fa_svec_data {
 	/* DMA attributes */
@@ -38,6 +45,10 @@ struct fa_svec_data {
 	unsigned int	fa_dma_ddr_data; /* offset */
 	unsigned int	fa_dma_ddr_addr; /* offset */
 	unsigned int	n_dma_err; /* statistics */
+	int		dma_mode; /* enum fa_svec_dma_mode */
+	/* buffer for multi-shot transfers, see fa_svec_dma_batch() */
+	void		*dma_buf;
+	size_t		dma_buf_size;
 };
 
 /* svec specific hardware registers */
@@ -46,6 +57,7 @@ extern const struct zfa_field_desc fa_svec_regfield[];
 extern irqreturn_t fa_svec_irq_handler(int irq, void *dev_id);
 
 /* functions exported by fa-svec-dma.c */
+extern void fa_svec_dma_mode_init(struct fa_dev *fa);
 extern int fa_svec_dma_start(struct zio_cset *cset);
 extern void fa_svec_dma_done(struct zio_cset *cset);
 extern void fa_svec_dma_error(struct zio_cset *cset);
@@ -12,6 +12,8 @@
 #include <linux/moduleparam.h>
 #include <linux/time.h>
 #include <linux/delay.h>
+#include <linux/cpumask.h>
+#include <linux/workqueue.h>
 
 #include <asm/byteorder.h>
 
@@ -120,6 +122,26 @@ static struct zio_attribute zfad_cset_ext_zattr[] = {
 	ZIO_PARAM_EXT("sample-frequency", ZIO_RO_PERM, ZFAT_SAMPLING_HZ, 0),
 	ZIO_PARAM_EXT("max-sample-mshot", ZIO_RO_PERM, ZFA_MULT_MAX_SAMP, 0),
 	ZIO_PARAM_EXT("sample-counter", ZIO_RO_PERM, ZFAT_CNT, 0),
+	/* Number of DMA transfers of blocks mapped by the block pool */
+	ZIO_PARAM_EXT("dma-cache-hit", ZIO_RO_PERM,
+		      ZFA_SW_R_NOADDRES_DMA_HIT, 0),
+	/*
+	 * CPU running the acquisition-end work (DMA start/done);
+	 * ZFA_WORK_CPU_ANY (the default) means any CPU
+	 */
+	ZIO_PARAM_EXT("work-cpu", ZIO_RW_PERM,
+		      ZFA_SW_R_NOADDRES_WORK_CPU, ZFA_WORK_CPU_ANY),
+	/* Readout bandwidth of the last acquisition in KiB/s */
+	ZIO_PARAM_EXT("dma-bandwidth", ZIO_RO_PERM,
+		      ZFA_SW_R_NOADDRES_DMA_BW, 0),
+	/*
+	 * SVEC: leave the payload big endian, as it comes from VME. Blocks
+	 * are flagged with ZIO_CONTROL_BIG_ENDIAN
+	 */
+	ZIO_PARAM_EXT("data-swap-user", ZIO_RW_PERM,
+		      ZFA_SW_R_NOADDRES_SWAP_USER, 0),
+	/* Number of gaps in continuous acquisition (fsm-auto-start) */
+	ZIO_PARAM_EXT("overrun", ZIO_RO_PERM, ZFA_SW_R_NOADDRES_OVERRUN, 0),
 };
 
 #if 0 /* FIXME Unused until TLV control will be available */
@@ -186,6 +208,20 @@ static int zfad_conf_set(struct device *dev, struct zio_attribute *zattr,
 	case ZFA_SW_R_NOADDERS_AUTO:
 		fa->enable_auto_start = usr_val;
 		return 0;
+	case ZFA_SW_R_NOADDRES_SWAP_USER:
+		fa->data_swap_user = !!usr_val;
+		return 0;
+	case ZFA_SW_R_NOADDRES_WORK_CPU:
+		if (usr_val == ZFA_WORK_CPU_ANY) {
+			fa->work_cpu = WORK_CPU_UNBOUND;
+			return 0;
+		}
+		if (usr_val >= nr_cpu_ids || !cpu_online(usr_val)) {
+			dev_err(fa->msgdev, "CPU %u is not online\n", usr_val);
+			return -EINVAL;
+		}
+		fa->work_cpu = usr_val;
+		return 0;
 	/* FIXME temporary until TLV control */
 	case ZFA_CH1_OFFSET:
 		i--;
@@ -302,6 +338,8 @@ static int zfad_info_get(struct device *dev, struct zio_attribute *zattr,
 
 	case ZFA_SW_R_NOADDRES_NBIT:
 	case ZFA_SW_R_NOADDERS_AUTO:
+	case ZFA_SW_R_NOADDRES_WORK_CPU:
+	case ZFA_SW_R_NOADDRES_SWAP_USER:
 		/* ZIO automatically return the attribute value */
 		return 0;
 	case ZFA_SW_R_NOADDRES_TEMP:
@@ -312,6 +350,15 @@ static int zfad_info_get(struct device *dev, struct zio_attribute *zattr,
 		*usr_val = fa_read_temp(fa, 0);
 		*usr_val = (*usr_val * 1000 + 8) / 16;
 		return 0;
+	case ZFA_SW_R_NOADDRES_DMA_HIT:
+		*usr_val = fa->n_dma_cache_hit;
+		return 0;
+	case ZFA_SW_R_NOADDRES_DMA_BW:
+		*usr_val = fa->dma_kbps;
+		return 0;
+	case ZFA_SW_R_NOADDRES_OVERRUN:
+		*usr_val = fa->n_overrun;
+		return 0;
 	case ZFA_CHx_SAT:
 	case ZFA_CHx_CTL_TERM:
 	case ZFA_CHx_CTL_RANGE:
@@ -338,24 +385,149 @@ static const struct zio_sysfs_operations zfad_s_op = {
 };
 
 
-static inline int zfat_overflow_detection(struct zio_ti *ti)
+/*
+ * Binary configuration
+ *
+ * The whole setup (struct fa100m14b4c_conf) is written at once to the
+ * "configuration" file of the cset. It is validated as a whole, then
+ * it is applied through the same conf_set functions used by sysfs, but
+ * taking the device lock only once. The values are saved in the ZIO
+ * attributes and in the current controls of the channels, as ZIO does,
+ * so sysfs and the block controls see the new setup.
+ */
+
+/* ZIO attribute ids for each item of struct fa100m14b4c_conf */
+static const unsigned long zfad_conf_trg_id[__FA100M14B4C_CONF_TRG_N] = {
+	[FA100M14B4C_CONF_TRG_EXT] = ZFAT_CFG_HW_SEL,
+	[FA100M14B4C_CONF_TRG_INT_CHAN] = ZFAT_CFG_INT_SEL,
+	[FA100M14B4C_CONF_TRG_INT_THRES] = ZFAT_CFG_THRES,
+	[FA100M14B4C_CONF_TRG_POL] = ZFAT_CFG_HW_POL,
+	[FA100M14B4C_CONF_TRG_DELAY] = ZFAT_DLY,
+	[FA100M14B4C_CONF_TRG_INT_FILT] = ZFAT_CFG_THRES_FILT,
+};
+static const unsigned long zfad_conf_acq_id[__FA100M14B4C_CONF_ACQ_N] = {
+	[FA100M14B4C_CONF_ACQ_NSHOTS] = ZFAT_SHOTS_NB,
+	[FA100M14B4C_CONF_ACQ_POST] = ZFAT_POST,
+	[FA100M14B4C_CONF_ACQ_PRE] = ZFAT_PRE,
+	[FA100M14B4C_CONF_ACQ_DECI] = ZFAT_SR_DECI,
+};
+static const unsigned long
+zfad_conf_chn_id[FA100M14B4C_NCHAN][__FA100M14B4C_CONF_CHN_N] = {
+	{ZFA_CH1_CTL_RANGE, ZFA_CH1_CTL_TERM, ZFA_CH1_OFFSET, ZFA_CH1_SAT},
+	{ZFA_CH2_CTL_RANGE, ZFA_CH2_CTL_TERM, ZFA_CH2_OFFSET, ZFA_CH2_SAT},
+	{ZFA_CH3_CTL_RANGE, ZFA_CH3_CTL_TERM, ZFA_CH3_OFFSET, ZFA_CH3_SAT},
+	{ZFA_CH4_CTL_RANGE, ZFA_CH4_CTL_TERM, ZFA_CH4_OFFSET, ZFA_CH4_SAT},
+};
+static const unsigned long zfad_conf_utc_id[__FA100M14B4C_CONF_UTC_N] = {
+	[FA100M14B4C_CONF_UTC_S] = ZFA_UTC_SECONDS,
+	[FA100M14B4C_CONF_UTC_T] = ZFA_UTC_COARSE,
+};
+
+/* Copy an attribute value in a control, as ZIO does on sysfs writes */
+static void zfad_conf_ctrl(struct zio_ctrl_attr *ctrl,
+			   struct zio_attribute *zattr)
 {
-	struct fa_dev *fa = ti->cset->zdev->priv_d;
-	struct zio_attribute *ti_zattr = ti->zattr_set.std_zattr;
-	uint32_t nshot_t, nsamples;
-	size_t shot_size;
+	if ((zattr->flags & ZIO_ATTR_TYPE) == ZIO_ATTR_TYPE_EXT)
+		ctrl->ext_val[zattr->index] = zattr->value;
+	else if (zattr->index != ZIO_ATTR_INDEX_NONE)
+		ctrl->std_val[zattr->index] = zattr->value;
+}
 
-	if (ti->cset->trig != &zfat_type)
-		nshot_t = 1; /* with any other trigger work in one-shot mode */
-	else
-		nshot_t = ti_zattr[ZIO_ATTR_TRIG_N_SHOTS].value;
+/*
+ * zfad_conf_propagate
+ * @ti: trigger instance for the trigger items, NULL for the cset ones
+ * @cset: channel set
+ * @zattr: attribute just set
+ *
+ * Update the current control of all channels, including the interleaved
+ * one: the next blocks describe the new setup, and the DMA takes the
+ * pre-samples from there
+ */
+static void zfad_conf_propagate(struct zio_ti *ti, struct zio_cset *cset,
+				struct zio_attribute *zattr)
+{
+	struct zio_control *ctrl;
+	int i;
+
+	if (!(zattr->flags & ZIO_ATTR_CONTROL))
+		return;
+	for (i = 0; i <= cset->n_chan; ++i) {
+		ctrl = i < cset->n_chan ? cset->chan[i].current_ctrl :
+			cset->interleave->current_ctrl;
+		zfad_conf_ctrl(ti ? &ctrl->attr_trigger : &ctrl->attr_channel,
+			       zattr);
+	}
+}
+
+/*
+ * zfad_conf_item
+ * @ti: trigger instance for the trigger items, NULL for the cset ones
+ * @cset: channel set
+ * @id: attribute id
+ * @val: value to set, or where to store the current value
+ * @direction: 1 to set, 0 to get
+ */
+static int zfad_conf_item(struct zio_ti *ti, struct zio_cset *cset,
+			  unsigned long id, uint32_t *val, int direction)
+{
+	struct zio_attribute_set *zset;
+	const struct zio_sysfs_operations *s_op;
+	struct zio_attribute *zattr = NULL;
+	struct device *dev;
+	int i, err;
+
+	if (ti) {
+		zset = &ti->zattr_set;
+		s_op = zfat_type.s_op;
+		dev = &ti->head.dev;
+	} else {
+		zset = &cset->zattr_set;
+		s_op = &zfad_s_op;
+		dev = &cset->head.dev;
+	}
+
+	for (i = 0; zset->std_zattr && i < ZIO_MAX_STD_ATTR; ++i) {
+		if (zset->std_zattr[i].attr.attr.mode &&
+		    zset->std_zattr[i].id == id)
+			zattr = &zset->std_zattr[i];
+	}
+	for (i = 0; !zattr && i < zset->n_ext_attr; ++i) {
+		if (zset->ext_zattr[i].id == id)
+			zattr = &zset->ext_zattr[i];
+	}
+	if (!zattr)
+		return -EOPNOTSUPP;
+
+	if (!direction) {
+		*val = zattr->value; /* for values stored by ZIO */
+		return s_op->info_get(dev, zattr, val);
+	}
+	err = s_op->conf_set(dev, zattr, *val);
+	if (err)
+		return err;
+	zattr->value = *val;
+	zfad_conf_propagate(ti, cset, zattr);
+	return 0;
+}
+
+/*
+ * zfad_overflow_check
+ * @fa: the fmc-adc descriptor
+ * @cset: channel set
+ * @nshot_t: number of shots
+ * @nsamples: pre + post samples of each shot
+ *
+ * Check that the acquisition fits in the ADC memory
+ */
+static int zfad_overflow_check(struct fa_dev *fa, struct zio_cset *cset,
+			       uint32_t nshot_t, uint32_t nsamples)
+{
+	size_t shot_size;
 
 	/*
 	 * +2 because of the timetag at the end
 	 */
-	nsamples = ti_zattr[ZIO_ATTR_TRIG_PRE_SAMP].value +
-		   ti_zattr[ZIO_ATTR_TRIG_POST_SAMP].value;
-	shot_size = ((nsamples + 2) * ti->cset->ssize) * FA100M14B4C_NCHAN;
+	shot_size = ((nsamples + 2) * cset->ssize) * FA100M14B4C_NCHAN;
 	if ( (shot_size * nshot_t) > FA100M14B4C_MAX_ACQ_BYTE ) {
 		dev_err(fa->msgdev, "Cannot acquire, dev memory overflow\n");
 		return -ENOMEM;
@@ -373,6 +545,262 @@ static inline int zfat_overflow_detection(struct zio_ti *ti)
 	return 0;
 }
 
+/*
+ * zfad_conf_check
+ * @fa: the fmc-adc descriptor
+ * @cset: channel set
+ * @conf: configuration to validate
+ *
+ * Check all the items before touching the hardware, with the same
+ * rules as zfad_conf_set() and zfat_conf_set(), so that the configuration
+ * is applied completely or not at all. The resulting acquisition must fit
+ * in the ADC memory too. Only a hardware error while applying it (for
+ * example on the SPI bus of the offset DAC) can leave it partially applied.
+ * Call it with the device lock held: it reads the current trigger setup.
+ */
+static int zfad_conf_check(struct fa_dev *fa, struct zio_cset *cset,
+			   struct fa100m14b4c_conf *conf)
+{
+	uint32_t trg_acq = BIT(FA100M14B4C_CONF_ACQ_NSHOTS) |
+			   BIT(FA100M14B4C_CONF_ACQ_POST) |
+			   BIT(FA100M14B4C_CONF_ACQ_PRE);
+	struct zio_attribute *ti_zattr;
+	uint32_t acq[__FA100M14B4C_CONF_ACQ_N];
+	int32_t offset;
+	int i;
+
+	if (conf->version != FA100M14B4C_CONF_VERSION) {
+		dev_err(fa->msgdev, "configuration version %i, expected %i\n",
+			conf->version, FA100M14B4C_CONF_VERSION);
+		return -EINVAL;
+	}
+	if (conf->trg_mask & ~(BIT(__FA100M14B4C_CONF_TRG_N) - 1) ||
+	    conf->acq_mask & ~(BIT(__FA100M14B4C_CONF_ACQ_N) - 1) ||
+	    conf->utc_mask & ~(BIT(__FA100M14B4C_CONF_UTC_N) - 1))
+		return -EINVAL;
+	for (i = 0; i < FA100M14B4C_NCHAN; ++i)
+		if (conf->chn_mask[i] & ~(BIT(__FA100M14B4C_CONF_CHN_N) - 1))
+			return -EINVAL;
+
+	if ((conf->trg_mask || conf->acq_mask & trg_acq) &&
+	    cset->trig != &zfat_type) {
+		dev_err(fa->msgdev, "trigger \"%s\" is not ours\n",
+			cset->trig->head.name);
+		return -EINVAL;
+	}
+	if (conf->trg_mask & BIT(FA100M14B4C_CONF_TRG_INT_CHAN) &&
+	    conf->trg[FA100M14B4C_CONF_TRG_INT_CHAN] >= FA100M14B4C_NCHAN)
+		return -EINVAL;
+	if (conf->acq_mask & BIT(FA100M14B4C_CONF_ACQ_NSHOTS) &&
+	    !conf->acq[FA100M14B4C_CONF_ACQ_NSHOTS]) {
+		dev_err(fa->msgdev, "nshots cannot be 0\n");
+		return -EINVAL;
+	}
+	if (conf->acq_mask & BIT(FA100M14B4C_CONF_ACQ_POST) &&
+	    conf->acq[FA100M14B4C_CONF_ACQ_POST] < 2) {
+		dev_err(fa->msgdev, "minimum post samples 2 (HW limitation)\n");
+		return -EINVAL;
+	}
+	for (i = 0; i < FA100M14B4C_NCHAN; ++i) {
+		if (conf->chn_mask[i] & BIT(FA100M14B4C_CONF_CHN_RANGE) &&
+		    zfad_convert_user_range(
+			    conf->chn[i][FA100M14B4C_CONF_CHN_RANGE]) < 0)
+			return -EINVAL;
+		offset = conf->chn[i][FA100M14B4C_CONF_CHN_OFFSET];
+		if (conf->chn_mask[i] & BIT(FA100M14B4C_CONF_CHN_OFFSET) &&
+		    (offset < -5000 || offset > 5000))
+			return -EINVAL;
+	}
+	if (conf->utc_mask & BIT(FA100M14B4C_CONF_UTC_T) &&
+	    conf->utc[FA100M14B4C_CONF_UTC_T] >= FA100M14B4C_UTC_CLOCK_FREQ) {
+		dev_err(fa->msgdev, "ticks time must be in the range [0, %d]\n",
+			FA100M14B4C_UTC_CLOCK_FREQ);
+		return -EINVAL;
+	}
+
+	/* The new shots, with the current values for the missing items */
+	if (!(conf->acq_mask & trg_acq))
+		return 0;
+	ti_zattr = cset->ti->zattr_set.std_zattr;
+	acq[FA100M14B4C_CONF_ACQ_NSHOTS] =
+		ti_zattr[ZIO_ATTR_TRIG_N_SHOTS].value;
+	acq[FA100M14B4C_CONF_ACQ_POST] =
+		ti_zattr[ZIO_ATTR_TRIG_POST_SAMP].value;
+	acq[FA100M14B4C_CONF_ACQ_PRE] = ti_zattr[ZIO_ATTR_TRIG_PRE_SAMP].value;
+	for (i = 0; i < FA100M14B4C_CONF_ACQ_DECI; ++i)
+		if (conf->acq_mask & BIT(i))
+			acq[i] = conf->acq[i];
+	return zfad_overflow_check(fa, cset, acq[FA100M14B4C_CONF_ACQ_NSHOTS],
+				   acq[FA100M14B4C_CONF_ACQ_PRE] +
+				   acq[FA100M14B4C_CONF_ACQ_POST]);
+}
+
+/*
+ * zfad_conf_all
+ * @cset: channel set
+ * @conf: configuration
+ * @direction: 1 to apply the masked items, 0 to read all of them
+ *
+ * When reading, the masks must be clear: they are set for each item read
+ */
+static int zfad_conf_all(struct zio_cset *cset, struct fa100m14b4c_conf *conf,
+			 int direction)
+{
+	struct zio_ti *ti = cset->trig == &zfat_type ? cset->ti : NULL;
+	uint32_t trg_mask = conf->trg_mask, acq_mask = conf->acq_mask;
+	uint32_t utc_mask = conf->utc_mask, chn_mask;
+	int i, k, err;
+
+	if (!direction) {
+		trg_mask = ti ? BIT(__FA100M14B4C_CONF_TRG_N) - 1 : 0;
+		acq_mask = BIT(__FA100M14B4C_CONF_ACQ_N) - 1;
+		if (!ti)
+			acq_mask = BIT(FA100M14B4C_CONF_ACQ_DECI);
+		utc_mask = BIT(__FA100M14B4C_CONF_UTC_N) - 1;
+	}
+
+	for (i = 0; i < FA100M14B4C_NCHAN; ++i) {
+		chn_mask = direction ? conf->chn_mask[i] :
+			BIT(__FA100M14B4C_CONF_CHN_N) - 1;
+		for (k = 0; k < __FA100M14B4C_CONF_CHN_N; ++k) {
+			if (!(chn_mask & BIT(k)))
+				continue;
+			err = zfad_conf_item(NULL, cset, zfad_conf_chn_id[i][k],
+					     &conf->chn[i][k], direction);
+			if (err == -EOPNOTSUPP && !direction)
+				continue;
+			if (err)
+				return err;
+			conf->chn_mask[i] |= BIT(k);
+		}
+	}
+
+	for (k = 0; k < __FA100M14B4C_CONF_UTC_N; ++k) {
+		if (!(utc_mask & BIT(k)))
+			continue;
+		err = zfad_conf_item(NULL, cset, zfad_conf_utc_id[k],
+				     &conf->utc[k], direction);
+		if (err == -EOPNOTSUPP && !direction)
+			continue;
+		if (err)
+			return err;
+		conf->utc_mask |= BIT(k);
+	}
+
+	for (k = 0; k < __FA100M14B4C_CONF_ACQ_N; ++k) {
+		if (!(acq_mask & BIT(k)))
+			continue;
+		err = zfad_conf_item(k == FA100M14B4C_CONF_ACQ_DECI ? NULL : ti,
+				     cset, zfad_conf_acq_id[k], &conf->acq[k],
+				     direction);
+		if (err == -EOPNOTSUPP && !direction)
+			continue;
+		if (err)
+			return err;
+		conf->acq_mask |= BIT(k);
+	}
+
+	for (k = 0; k < __FA100M14B4C_CONF_TRG_N; ++k) {
+		if (!(trg_mask & BIT(k)))
+			continue;
+		err = zfad_conf_item(ti, cset, zfad_conf_trg_id[k],
+				     &conf->trg[k], direction);
+		if (err == -EOPNOTSUPP && !direction)
+			continue;
+		if (err)
+			return err;
+		conf->trg_mask |= BIT(k);
+	}
+
+	/* ZIO computes nsamples when pre/post are written through sysfs */
+	if (ti && direction) {
+		ti->nsamples =
+			ti->zattr_set.std_zattr[ZIO_ATTR_TRIG_PRE_SAMP].value +
+			ti->zattr_set.std_zattr[ZIO_ATTR_TRIG_POST_SAMP].value;
+	}
+	return 0;
+}
+
+static ssize_t zfad_conf_write(struct file *file, struct kobject *kobj,
+			       struct bin_attribute *bin_attr,
+			       char *buf, loff_t off, size_t count)
+{
+	struct zio_cset *cset = to_zio_cset(container_of(kobj, struct device,
+							 kobj));
+	struct fa_dev *fa = cset->zdev->priv_d;
+	struct fa100m14b4c_conf conf;
+	int err;
+
+	if (off || count != sizeof(conf))
+		return -EINVAL;
+	memcpy(&conf, buf, sizeof(conf));
+	spin_lock(&cset->zdev->lock);
+	err = zfad_conf_check(fa, cset, &conf);
+	if (err) {
+		/* Nothing has been applied */
+		spin_unlock(&cset->zdev->lock);
+		return err;
+	}
+	err = zfad_conf_all(cset, &conf, 1);
+	spin_unlock(&cset->zdev->lock);
+	if (err)
+		dev_err(fa->msgdev, "configuration partially applied (%i)\n",
+			err);
+	return err ? err : count;
+}
+
+static ssize_t zfad_conf_read(struct file *file, struct kobject *kobj,
+			      struct bin_attribute *bin_attr,
+			      char *buf, loff_t off, size_t count)
+{
+	struct zio_cset *cset = to_zio_cset(container_of(kobj, struct device,
+							 kobj));
+	struct fa100m14b4c_conf conf;
+	int err;
+
+	if (off >= sizeof(conf))
+		return 0;
+	if (off + count > sizeof(conf))
+		count = sizeof(conf) - off;
+
+	memset(&conf, 0, sizeof(conf));
+	conf.version = FA100M14B4C_CONF_VERSION;
+	spin_lock(&cset->zdev->lock);
+	err = zfad_conf_all(cset, &conf, 0);
+	spin_unlock(&cset->zdev->lock);
+	if (err)
+		return err;
+	memcpy(buf, (void *)&conf + off, count);
+	return count;
+}
+
+static struct bin_attribute zfad_conf_bin_attr = {
+	.attr = {
+		.name = "configuration",
+		.mode = S_IRUGO | S_IWUSR | S_IWGRP,
+	},
+	.size = sizeof(struct fa100m14b4c_conf),
+	.read = zfad_conf_read,
+	.write = zfad_conf_write,
+};
+
+
+static inline int zfat_overflow_detection(struct zio_ti *ti)
+{
+	struct fa_dev *fa = ti->cset->zdev->priv_d;
+	struct zio_attribute *ti_zattr = ti->zattr_set.std_zattr;
+	uint32_t nshot_t, nsamples;
+
+	if (ti->cset->trig != &zfat_type)
+		nshot_t = 1; /* with any other trigger work in one-shot mode */
+	else
+		nshot_t = ti_zattr[ZIO_ATTR_TRIG_N_SHOTS].value;
+
+	nsamples = ti_zattr[ZIO_ATTR_TRIG_PRE_SAMP].value +
+		   ti_zattr[ZIO_ATTR_TRIG_POST_SAMP].value;
+	return zfad_overflow_check(fa, ti->cset, nshot_t, nsamples);
+}
+
 
 /*
  * zfad_input_cset_software
@@ -614,8 +1042,14 @@ int fa_zio_init(struct fa_dev *fa)
 	if (err) {
 		dev_err(fa->msgdev, "Cannot register ZIO device fmc-adc-100m14b\n");
 		zio_free_device(fa->hwzdev);
+		return err;
 	}
-	return err;
+
+	/* The binary configuration is optional: don't fail without it */
+	if (device_create_bin_file(&fa->zdev->cset->head.dev,
+				   &zfad_conf_bin_attr))
+		dev_warn(fa->msgdev, "Cannot create binary configuration\n");
+	return 0;
 }
 
 /*
@@ -626,6 +1060,7 @@ int fa_zio_init(struct fa_dev *fa)
  */
 void fa_zio_exit(struct fa_dev *fa)
 {
+	device_remove_bin_file(&fa->zdev->cset->head.dev, &zfad_conf_bin_attr);
 	zio_unregister_device(fa->hwzdev);
 	zio_free_device(fa->hwzdev);
 }
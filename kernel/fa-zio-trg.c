@@ -10,14 +10,60 @@
 #include <linux/slab.h>
 #include <linux/irq.h>
 #include <linux/interrupt.h>
+#include <linux/workqueue.h>
 
 #include "fmc-adc-100m14b4cha.h"
 
+/*
+ * Multi-shot acquisitions up to this size (in KiB) take their blocks from
+ * a pool filled in process context, so that arming the trigger does not
+ * allocate memory. 0 disables the pool.
+ */
+static unsigned int fa_block_pool_kb = 16384;
+module_param_named(block_pool_kb, fa_block_pool_kb, uint, 0444);
+
+/*
+ * At most two mappings exist between two runs of the refill work: the one
+ * of the pool and the one taken by the armed acquisition
+ */
+#define ZFAT_POOL_DEAD 4
+
+/*
+ * zfat_pool: blocks allocated in advance for the next acquisition
+ * @lock: protects the pool, it is used also in atomic context
+ * @bi: buffer instance the blocks belong to
+ * @blocks: vector of available blocks
+ * @size: number of shots the pool is built for
+ * @n_blocks: number of available blocks
+ * @block_size: size of each block
+ * @zfad_block: zfad_block vector handed to the next acquisition
+ * @dma: the blocks, mapped for DMA by the carrier (when the pool is full)
+ * @enabled: the trigger is armed, blocks can be added (see zfat_pool_stop)
+ * @dead: DMA mappings to release in process context (see zfat_dma_release)
+ * @n_dead: number of mappings in @dead
+ * @refill: work filling the pool and releasing the dead mappings
+ */
+struct zfat_pool {
+	spinlock_t lock;
+	struct zio_bi *bi;
+	struct zio_block **blocks;
+	unsigned int size;
+	unsigned int n_blocks;
+	unsigned int block_size;
+	struct zfad_block *zfad_block;
+	struct zio_dma_sgt *dma;
+	int enabled;
+	struct zio_dma_sgt *dead[ZFAT_POOL_DEAD];
+	unsigned int n_dead;
+	struct work_struct refill;
+};
+
 struct zfat_instance {
 	struct zio_ti ti;
 	struct fa_dev *fa;
 	unsigned int n_acq_dev;	/* number of acquisitions on device memory */
 	unsigned int n_err;	/* number of errors */
+	struct zfat_pool pool;
 };
 
 #define to_zfat_instance(_ti) container_of(_ti, struct zfat_instance, ti)
@@ -77,6 +123,9 @@ static struct zio_attribute zfat_ext_zattr[] = {
 					ZIO_RO_PERM, ZFA_UTC_TRIG_COARSE, 0),
 	[FA100M14B4C_TATTR_TRG_F] = ZIO_PARAM_EXT("tstamp-trg-lst-b",
 					ZIO_RO_PERM, ZFA_UTC_TRIG_FINE, 0),
+
+	/* Number of blocks ready in the pool */
+	ZIO_PARAM_EXT("block-pool", ZIO_RO_PERM, ZFA_SW_R_NOADDRES_POOL, 0),
 };
 
 
@@ -153,6 +202,11 @@ static int zfat_info_get(struct device *dev, struct zio_attribute *zattr,
 {
 	struct fa_dev *fa = get_zfadc(dev);
 
+	if (zattr->id == ZFA_SW_R_NOADDRES_POOL) {
+		*usr_val = to_zfat_instance(to_zio_ti(dev))->pool.n_blocks;
+		return 0;
+	}
+
 	*usr_val = fa_readl(fa, fa->fa_adc_csr_base, &zfad_regs[zattr->id]);
 	switch (zattr->id) {
 	case ZFAT_POST:
@@ -172,6 +226,409 @@ static const struct zio_sysfs_operations zfat_s_op = {
 };
 
 
+/*
+ * zfat_block_size
+ * @ti: trigger instance
+ *
+ * Calculate the required size to store all channels.  This is
+ * an interleaved acquisition, so nsamples represents the
+ * number of sample on all channels (n_chan * chan_samples)
+ * Trig time stamp are appended after the post samples
+ * (4*32bits word) size should be 32bits word aligned
+ * ti->nsamples is the sum of (pre-samp+ post-samp)*4chan
+ * because it's the interleave channel.
+ */
+static unsigned int zfat_block_size(struct zio_ti *ti)
+{
+	struct zio_channel *interleave = ti->cset->interleave;
+	struct fa_dev *fa = ti->cset->zdev->priv_d;
+	unsigned int size;
+
+	size = (interleave->current_ctrl->ssize * ti->nsamples)
+		+ FA_TRIG_TIMETAG_BYTES;
+	/* check if size is 32 bits word aligned: should be always the case */
+	if (size % 4) {
+		/* should never happen: increase the size accordling */
+		dev_warn(fa->msgdev,
+			"\nzio data block size should 32bit word aligned."
+			"original size:%d was increased by %d bytes\n",
+			size, size%4);
+		size += size % 4;
+	}
+
+	return size;
+}
+
+/*
+ * zfat_dma_release
+ * @zfat: trigger instance
+ * @dma: DMA mapping which is not going to be used
+ *
+ * Unmapping frees coherent memory, which cannot be done in atomic context
+ * (abort, data_done, arm). Put the mapping aside, the refill work releases
+ * it (zfat_pool_release).
+ */
+static void zfat_dma_release(struct zfat_instance *zfat,
+			     struct zio_dma_sgt *dma)
+{
+	struct zfat_pool *pool = &zfat->pool;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	if (!WARN_ON_ONCE(pool->n_dead >= ZFAT_POOL_DEAD))
+		pool->dead[pool->n_dead++] = dma;
+	spin_unlock_irqrestore(&pool->lock, flags);
+	schedule_work(&pool->refill);
+}
+
+/*
+ * zfat_pool_release
+ * @zfat: trigger instance
+ *
+ * Release the mappings put aside by zfat_dma_release. Process context only
+ */
+static void zfat_pool_release(struct zfat_instance *zfat)
+{
+	struct zio_dma_sgt *dead[ZFAT_POOL_DEAD];
+	struct zfat_pool *pool = &zfat->pool;
+	struct fa_dev *fa = zfat->fa;
+	unsigned long flags;
+	unsigned int i, n;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	n = pool->n_dead;
+	memcpy(dead, pool->dead, n * sizeof(*dead));
+	pool->n_dead = 0;
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	for (i = 0; i < n; ++i)
+		fa->carrier_op->dma_unprepare(fa, dead[i]);
+}
+
+/*
+ * zfat_pool_flush
+ * @zfat: trigger instance
+ *
+ * Give back to the buffer all the blocks held by the pool. The DMA
+ * mapping, if any, is released later (zfat_dma_release), so this can be
+ * used in atomic context
+ */
+static void zfat_pool_flush(struct zfat_instance *zfat)
+{
+	struct zfat_pool *pool = &zfat->pool;
+	struct zfad_block *zfad_block;
+	struct zio_dma_sgt *dma;
+	struct zio_block **blocks;
+	struct zio_bi *bi;
+	unsigned long flags;
+	unsigned int i, n;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	bi = pool->bi;
+	blocks = pool->blocks;
+	n = pool->n_blocks;
+	zfad_block = pool->zfad_block;
+	dma = pool->dma;
+	pool->bi = NULL;
+	pool->blocks = NULL;
+	pool->size = 0;
+	pool->n_blocks = 0;
+	pool->block_size = 0;
+	pool->zfad_block = NULL;
+	pool->dma = NULL;
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	if (dma)
+		zfat_dma_release(zfat, dma);
+	for (i = 0; i < n; ++i)
+		zio_buffer_free_block(bi, blocks[i]);
+	kfree(blocks);
+	kfree(zfad_block);
+}
+
+/*
+ * zfat_pool_stop
+ * @zfat: trigger instance
+ *
+ * Empty the pool, and keep it empty until the trigger is armed again.
+ * Blocks are kept only while an acquisition runs, as the blocks of the
+ * acquisition itself are, so they never outlive the buffer instance they
+ * come from. This runs in atomic context (abort), so it cannot wait for
+ * the refill work: if it is running, it finds the pool disabled and
+ * gives its blocks back.
+ */
+static void zfat_pool_stop(struct zfat_instance *zfat)
+{
+	struct zfat_pool *pool = &zfat->pool;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	pool->enabled = 0;
+	spin_unlock_irqrestore(&pool->lock, flags);
+	zfat_pool_flush(zfat);
+}
+
+/*
+ * zfat_pool_map
+ * @zfat: trigger instance
+ * @bi: buffer instance of the blocks
+ *
+ * When the pool is full, let the carrier map its blocks for DMA, so that
+ * the transfer of the next acquisition does not need to. The blocks are
+ * taken out of the pool while the mapping is built without the lock, and
+ * they go back only if the pool did not change meanwhile. Single-shot
+ * acquisitions are not mapped: their memory offset depends on the
+ * trigger position, known only when the DMA starts (zfad_dma_start).
+ */
+static void zfat_pool_map(struct zfat_instance *zfat, struct zio_bi *bi)
+{
+	struct zfat_pool *pool = &zfat->pool;
+	struct fa_dev *fa = zfat->fa;
+	struct zfad_block *zfad_block;
+	struct zio_dma_sgt *dma;
+	unsigned long flags;
+	unsigned int i, n, size;
+
+	if (!fa->carrier_op->dma_prepare)
+		return;
+	spin_lock_irqsave(&pool->lock, flags);
+	n = pool->size;
+	spin_unlock_irqrestore(&pool->lock, flags);
+	if (n < 2)
+		return;
+	zfad_block = kcalloc(n, sizeof(*zfad_block), GFP_KERNEL);
+	if (!zfad_block)
+		return;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	if (!pool->enabled || pool->dma || pool->size != n ||
+	    pool->n_blocks < n) {
+		spin_unlock_irqrestore(&pool->lock, flags);
+		kfree(zfad_block);
+		return;
+	}
+	size = pool->block_size;
+	for (i = 0; i < n; ++i) {
+		/* Same order and offsets as zfat_pool_get/zfat_arm_trigger */
+		zfad_block[i].block = pool->blocks[i];
+		zfad_block[i].dev_mem_off = i * size;
+	}
+	pool->n_blocks = 0;
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	dma = fa->carrier_op->dma_prepare(zfat->ti.cset, zfad_block, n);
+	if (IS_ERR(dma)) {
+		dev_dbg(fa->msgdev, "block pool: cannot map (%ld)\n",
+			PTR_ERR(dma));
+		dma = NULL;
+	}
+
+	spin_lock_irqsave(&pool->lock, flags);
+	if (pool->enabled && pool->bi == bi && pool->size == n &&
+	    pool->block_size == size && !pool->n_blocks) {
+		for (i = 0; i < n; ++i)
+			pool->blocks[i] = zfad_block[i].block;
+		pool->n_blocks = n;
+		pool->dma = dma;
+		n = 0;
+		dma = NULL;
+	}
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	/* The pool was stopped or taken meanwhile */
+	if (dma)
+		fa->carrier_op->dma_unprepare(fa, dma);
+	for (i = 0; i < n; ++i)
+		zio_buffer_free_block(bi, zfad_block[i].block);
+	kfree(zfad_block);
+}
+
+/*
+ * zfat_pool_fill
+ * @zfat: trigger instance
+ *
+ * Fill the pool with the blocks needed by the next acquisition. This runs
+ * in process context, so it can sleep while allocating. If the
+ * acquisition geometry or the buffer changed, the old blocks are released
+ * first. It does nothing if the pool was stopped since the trigger was
+ * armed.
+ */
+static void zfat_pool_fill(struct zfat_instance *zfat)
+{
+	struct zfat_pool *pool = &zfat->pool;
+	struct zio_ti *ti = &zfat->ti;
+	struct zio_cset *cset = ti->cset;
+	struct fa_dev *fa = zfat->fa;
+	struct zfad_block *zfad_block;
+	struct zio_block **blocks;
+	struct zio_block *block;
+	struct zio_bi *bi;
+	unsigned int n_shots, nsamples, size;
+	unsigned long flags;
+	int full, change;
+
+	/* The ZIO locks protect the trigger attributes and the buffer */
+	spin_lock(&cset->zdev->lock);
+	n_shots = ti->zattr_set.std_zattr[ZIO_ATTR_TRIG_N_SHOTS].value;
+	nsamples = ti->nsamples;
+	size = zfat_block_size(ti);
+	spin_unlock(&cset->zdev->lock);
+	spin_lock_irqsave(&cset->lock, flags);
+	bi = cset->interleave->bi;
+	spin_unlock_irqrestore(&cset->lock, flags);
+
+	if (!n_shots || !nsamples ||
+	    (u64)n_shots * size > (u64)fa_block_pool_kb * 1024) {
+		zfat_pool_flush(zfat);
+		return;
+	}
+
+	spin_lock_irqsave(&pool->lock, flags);
+	if (!pool->enabled) {
+		spin_unlock_irqrestore(&pool->lock, flags);
+		return;
+	}
+	change = (pool->bi != bi || pool->size != n_shots ||
+		  pool->block_size != size);
+	spin_unlock_irqrestore(&pool->lock, flags);
+	if (change) {
+		/*
+		 * Blocks of another buffer instance are freed like the others:
+		 * it is still there, because the pool is stopped (and flushed)
+		 * whenever the trigger is not armed
+		 */
+		zfat_pool_flush(zfat);
+		blocks = kcalloc(n_shots, sizeof(*blocks), GFP_KERNEL);
+		zfad_block = kcalloc(n_shots, sizeof(*zfad_block), GFP_KERNEL);
+		if (!blocks || !zfad_block) {
+			kfree(blocks);
+			kfree(zfad_block);
+			return;
+		}
+		spin_lock_irqsave(&pool->lock, flags);
+		if (pool->enabled && !pool->blocks) {
+			pool->bi = bi;
+			pool->blocks = blocks;
+			pool->size = n_shots;
+			pool->block_size = size;
+			pool->zfad_block = zfad_block;
+			blocks = NULL;
+			zfad_block = NULL;
+		}
+		spin_unlock_irqrestore(&pool->lock, flags);
+		if (blocks) { /* stopped meanwhile */
+			kfree(blocks);
+			kfree(zfad_block);
+			return;
+		}
+	}
+
+	do {
+		block = zio_buffer_alloc_block(bi, size, GFP_KERNEL);
+		if (!block) {
+			dev_dbg(fa->msgdev, "block pool: %d/%d blocks\n",
+				pool->n_blocks, pool->size);
+			break;
+		}
+		spin_lock_irqsave(&pool->lock, flags);
+		if (pool->enabled && pool->bi == bi &&
+		    pool->n_blocks < pool->size) {
+			pool->blocks[pool->n_blocks++] = block;
+			block = NULL;
+		}
+		full = (pool->n_blocks >= pool->size);
+		spin_unlock_irqrestore(&pool->lock, flags);
+		/* The pool was filled, stopped or flushed meanwhile */
+		if (block)
+			zio_buffer_free_block(bi, block);
+	} while (!block && !full);
+
+	zfat_pool_map(zfat, bi);
+}
+
+/*
+ * zfat_pool_refill
+ * @work: the pool refill work
+ *
+ * Release the dead DMA mappings and fill the pool
+ */
+static void zfat_pool_refill(struct work_struct *work)
+{
+	struct zfat_instance *zfat = container_of(work, struct zfat_instance,
+						  pool.refill);
+
+	zfat_pool_release(zfat);
+	zfat_pool_fill(zfat);
+	/* Filling may have flushed a mapping */
+	zfat_pool_release(zfat);
+}
+
+/*
+ * zfat_pool_get
+ * @pool: block pool
+ * @bi: buffer instance of the acquisition
+ * @n_shots: number of shots of the acquisition
+ * @size: block size of the acquisition
+ * @n: number of blocks taken from the pool
+ * @dma: the DMA mapping of the blocks, if any (see zfat_pool_map)
+ *
+ * It returns the zfad_block vector with the first @n blocks set, or NULL
+ * if the pool does not fit the acquisition. It never allocates, so it can
+ * be used in atomic context.
+ */
+static struct zfad_block *zfat_pool_get(struct zfat_pool *pool,
+					struct zio_bi *bi, unsigned int n_shots,
+					unsigned int size, unsigned int *n,
+					struct zio_dma_sgt **dma)
+{
+	struct zfad_block *zfad_block = NULL;
+	unsigned long flags;
+	unsigned int i;
+
+	*n = 0;
+	*dma = NULL;
+	spin_lock_irqsave(&pool->lock, flags);
+	if (pool->zfad_block && pool->bi == bi && pool->size == n_shots &&
+	    pool->block_size == size) {
+		zfad_block = pool->zfad_block;
+		pool->zfad_block = NULL;
+		for (i = 0; i < pool->n_blocks; ++i)
+			zfad_block[i].block = pool->blocks[i];
+		*n = i;
+		*dma = pool->dma;
+		pool->n_blocks = 0;
+		pool->dma = NULL;
+	}
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	return zfad_block;
+}
+
+/*
+ * zfat_pool_put
+ * @pool: block pool
+ * @zfad_block: zfad_block vector of a finished acquisition
+ * @n_shots: number of shots of the acquisition
+ *
+ * Give the zfad_block vector back to the pool, or free it if the pool
+ * does not need it anymore
+ */
+static void zfat_pool_put(struct zfat_pool *pool,
+			  struct zfad_block *zfad_block, unsigned int n_shots)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	if (!pool->zfad_block && pool->size == n_shots) {
+		pool->zfad_block = zfad_block;
+		zfad_block = NULL;
+	}
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	kfree(zfad_block);
+}
+
+
 /* create an instance of the FMC-ADC trigger */
 static struct zio_ti *zfat_create(struct zio_trigger_type *trig,
 				 struct zio_cset *cset,
@@ -197,6 +654,8 @@ static struct zio_ti *zfat_create(struct zio_trigger_type *trig,
 
 	zfat->fa = fa;
 	zfat->ti.cset = cset;
+	spin_lock_init(&zfat->pool.lock);
+	INIT_WORK(&zfat->pool.refill, zfat_pool_refill);
 
 	return &zfat->ti;
 }
@@ -217,6 +676,9 @@ static void zfat_destroy(struct zio_ti *ti)
 	/* Other triggers can handle only 1 shot */
 	fa_writel(fa, fa->fa_adc_csr_base, &zfad_regs[ZFAT_SHOTS_NB], 1);
 
+	zfat_pool_stop(zfat);
+	cancel_work_sync(&zfat->pool.refill);
+	zfat_pool_release(zfat);
 	kfree(zfat);
 }
 
@@ -233,11 +695,25 @@ static void zfat_change_status(struct zio_ti *ti, unsigned int status)
 	fa_writel(fa, fa->fa_adc_csr_base, &zfad_regs[ZFAT_CFG_HW_EN], !status);
 }
 
+/*
+ * Release the DMA mapping taken from the pool, if the DMA did not use it.
+ * This runs in atomic context, so the refill work unmaps it
+ */
+static void zfat_dma_unprepare(struct zfat_instance *zfat)
+{
+	struct fa_dev *fa = zfat->fa;
+
+	if (!fa->zdma_next)
+		return;
+	zfat_dma_release(zfat, fa->zdma_next);
+	fa->zdma_next = NULL;
+}
+
 /*
  * zfat_data_done
  * @cset: channels set
  *
- * Transfer is over for all blocks. Store all blocks and free
+ * Transfer is over for all blocks. Store all blocks and give back
  * zfad_blocks vector. Here we are storing only blocks
  * that were filled by a trigger fire. If for some reason the data_done
  * occurs before the natural end of the acquisition, un-filled block
@@ -246,6 +722,7 @@ static void zfat_change_status(struct zio_ti *ti, unsigned int status)
 static int zfat_data_done(struct zio_cset *cset)
 {
 	struct zfad_block *zfad_block = cset->interleave->priv_d;
+	struct zfat_instance *zfat = to_zfat_instance(cset->ti);
 	struct zio_bi *bi = cset->interleave->bi;
 	struct fa_dev *fa = cset->zdev->priv_d;
 	unsigned int i;
@@ -261,7 +738,11 @@ static int zfat_data_done(struct zio_cset *cset)
 		if (likely(i < fa->n_fires)) {/* Store filled blocks */
 			dev_dbg(fa->msgdev, "Store Block %i/%i\n",
 				i + 1, fa->n_shots);
-			zio_buffer_store_block(bi, zfad_block[i].block);
+			if (!zio_buffer_store_block(bi, zfad_block[i].block))
+				continue;
+			/* The buffer is full: the shot is lost */
+			fa->n_overrun++;
+			zio_buffer_free_block(bi, zfad_block[i].block);
 		} else {	/* Free un-filled blocks */
 			dev_dbg(fa->msgdev, "Free un-acquired block %d/%d "
 					"(received %d shots)\n",
@@ -269,10 +750,14 @@ static int zfat_data_done(struct zio_cset *cset)
 			zio_buffer_free_block(bi, zfad_block[i].block);
 		}
 	/* Clear active block */
+	zfat_dma_unprepare(zfat);
+	zfat_pool_put(&zfat->pool, zfad_block, fa->n_shots);
 	fa->n_shots = 0;
 	fa->n_fires = 0;
-	kfree(zfad_block);
 	cset->interleave->priv_d = NULL;
+	/* Only an automatic start re-arms at once and uses the pool */
+	if (!fa->enable_auto_start)
+		zfat_pool_stop(zfat);
 
 	return 0;
 }
@@ -288,12 +773,14 @@ static int zfat_arm_trigger(struct zio_ti *ti)
 {
 	struct zio_channel *interleave = ti->cset->interleave;
 	struct fa_dev *fa = ti->cset->zdev->priv_d;
+	struct zfat_instance *zfat = to_zfat_instance(ti);
 	struct zio_block *block;
 	struct zfad_block *zfad_block;
-	unsigned int size;
+	struct zio_dma_sgt *dma;
+	unsigned int size, n_pool;
+	unsigned long flags;
 	uint32_t dev_mem_off;
 	int i, err = 0;
-	struct zio_attribute *ti_zattr = ti->zattr_set.std_zattr;
 
 	dev_dbg(fa->msgdev, "Arming trigger\n");
 
@@ -309,60 +796,59 @@ static int zfat_arm_trigger(struct zio_ti *ti)
 		return -EINVAL;
 	}
 
+	size = zfat_block_size(ti);
+
 	/*
-	 * Allocate a new block for DMA transfer. Sometimes we are in an
-	 * atomic context and we cannot use in_atomic()
+	 * Take the blocks prepared in the pool, and their DMA mapping if
+	 * the carrier built one. The control is copied into the blocks when
+	 * the DMA is over (zfad_dma_done)
 	 */
-	zfad_block = kmalloc(sizeof(struct zfad_block) * fa->n_shots,
-			     GFP_ATOMIC);
-	if (!zfad_block)
-		return -ENOMEM;
+	zfad_block = zfat_pool_get(&zfat->pool, interleave->bi, fa->n_shots,
+				   size, &n_pool, &dma);
+	if (!zfad_block) {
+		/*
+		 * Allocate a new block for DMA transfer. Sometimes we are in
+		 * an atomic context and we cannot use in_atomic()
+		 */
+		zfad_block = kmalloc(sizeof(struct zfad_block) * fa->n_shots,
+				     GFP_ATOMIC);
+		if (!zfad_block)
+			return -ENOMEM;
+	}
 
 	interleave->priv_d = zfad_block;
+	fa->zdma_next = dma;
 
-	/*
-	 * Calculate the required size to store all channels.  This is
-	 * an interleaved acquisition, so nsamples represents the
-	 * number of sample on all channels (n_chan * chan_samples)
-	 * Trig time stamp are appended after the post samples
-	 * (4*32bits word) size should be 32bits word aligned
-	 * ti->nsamples is the sum of (pre-samp+ post-samp)*4chan
-	 * because it's the interleave channel.
-	 */
-	size = (interleave->current_ctrl->ssize * ti->nsamples)
-		+ FA_TRIG_TIMETAG_BYTES;
-	/* check if size is 32 bits word aligned: should be always the case */
-	if (size % 4) {
-		/* should never happen: increase the size accordling */
-		dev_warn(fa->msgdev,
-			"\nzio data block size should 32bit word aligned."
-			"original size:%d was increased by %d bytes\n",
-			size, size%4);
-		size += size % 4;
-	}
 	dev_mem_off = 0;
-	/* Allocate ZIO blocks */
+	/* Allocate the ZIO blocks the pool could not provide */
 	for (i = 0; i < fa->n_shots; ++i) {
-		dev_dbg(fa->msgdev, "Allocating block %d ...\n", i);
-		block = zio_buffer_alloc_block(interleave->bi, size,
-					       GFP_ATOMIC);
-		if (!block) {
-			dev_err(fa->msgdev,
-				"\narm trigger fail, cannot allocate block\n");
-			err = -ENOMEM;
-			goto out_allocate;
+		if (i >= n_pool) {
+			dev_dbg(fa->msgdev, "Allocating block %d ...\n", i);
+			block = zio_buffer_alloc_block(interleave->bi, size,
+						       GFP_ATOMIC);
+			if (!block) {
+				dev_err(fa->msgdev,
+					"\narm trigger fail, cannot allocate block\n");
+				err = -ENOMEM;
+				goto out_allocate;
+			}
+			/* Add to the vector of prepared blocks */
+			zfad_block[i].block = block;
 		}
-		/* Copy the updated control into the block */
-		memcpy(zio_get_ctrl(block), interleave->current_ctrl,
-		       zio_control_size(interleave));
-		/* Add to the vector of prepared blocks */
-		zfad_block[i].block = block;
 		zfad_block[i].dev_mem_off = dev_mem_off;
 		dev_mem_off += size;
 		dev_dbg(fa->msgdev, "next dev_mem_off 0x%x (+%d)\n",
 			dev_mem_off, size);
 	}
 
+	/* Prepare the blocks for the next acquisition */
+	if (fa_block_pool_kb) {
+		spin_lock_irqsave(&zfat->pool.lock, flags);
+		zfat->pool.enabled = 1;
+		spin_unlock_irqrestore(&zfat->pool.lock, flags);
+		schedule_work(&zfat->pool.refill);
+	}
+
 	err = ti->cset->raw_io(ti->cset);
 	if (err != -EAGAIN && err != 0)
 		goto out_allocate;
@@ -370,10 +856,13 @@ static int zfat_arm_trigger(struct zio_ti *ti)
 	return err;
 
 out_allocate:
+	zfat_dma_unprepare(zfat);
 	while ((--i) >= 0)
 		zio_buffer_free_block(interleave->bi, zfad_block[i].block);
-	kfree(zfad_block);
+	zfat_pool_put(&zfat->pool, zfad_block, fa->n_shots);
 	interleave->priv_d = NULL;
+	/* Not armed: give the blocks back, the buffer may be full */
+	zfat_pool_stop(zfat);
 	return err;
 }
 
@@ -382,7 +871,7 @@ out_allocate:
  * zfat_abort
  * @cset: channel set to abort
  *
- * Abort acquisition empty the list of prepared buffer.
+ * Abort acquisition empty the list of prepared buffer and the block pool.
  */
 static void zfat_abort(struct zio_ti *ti)
 {
@@ -390,14 +879,23 @@ static void zfat_abort(struct zio_ti *ti)
 	struct fa_dev *fa = cset->zdev->priv_d;
 	struct zio_bi *bi = cset->interleave->bi;
 	struct zfad_block *zfad_block = cset->interleave->priv_d;
+	struct zfat_instance *zfat = to_zfat_instance(ti);
 	unsigned int i;
 
 	dev_dbg(fa->msgdev, "Aborting trigger\n");
 
+	/*
+	 * Empty the pool as well: the buffer may change before the next
+	 * acquisition
+	 */
+	zfat_pool_stop(zfat);
+
 	/* Nothing to free */
 	if (!zfad_block)
 		return;
 
+	zfat_dma_unprepare(zfat);
+
 	/* Free all blocks */
 	for (i = 0; i < fa->n_shots; ++i)
 		zio_buffer_free_block(bi, zfad_block[i].block);
@@ -65,9 +65,61 @@ enum fa100m14b4c_dev_ext_attr {
 #define FA100M14B4C_UTC_CLOCK_NS  8
 #define FA100M14B4C_NCHAN 4 /* We have 4 of them,no way out of it */
 
+/*
+ * Binary configuration: the whole acquisition setup, written at once to
+ * the "configuration" binary file of the cset. Each group has a mask of
+ * valid items, indexed by the enumerations below (the same order used
+ * by libfmcadc). Reading the file returns the current setup
+ */
+#define FA100M14B4C_CONF_VERSION 1
+
+enum fa100m14b4c_conf_trg {
+	FA100M14B4C_CONF_TRG_EXT = 0,	/* trigger/external */
+	FA100M14B4C_CONF_TRG_INT_CHAN,	/* trigger/int-channel */
+	FA100M14B4C_CONF_TRG_INT_THRES,	/* trigger/int-threshold */
+	FA100M14B4C_CONF_TRG_POL,	/* trigger/polarity */
+	FA100M14B4C_CONF_TRG_DELAY,	/* trigger/delay */
+	FA100M14B4C_CONF_TRG_INT_FILT,	/* trigger/int-threshold-filter */
+	__FA100M14B4C_CONF_TRG_N,
+};
+enum fa100m14b4c_conf_acq {
+	FA100M14B4C_CONF_ACQ_NSHOTS = 0,	/* trigger/nshots */
+	FA100M14B4C_CONF_ACQ_POST,		/* trigger/post-samples */
+	FA100M14B4C_CONF_ACQ_PRE,		/* trigger/pre-samples */
+	FA100M14B4C_CONF_ACQ_DECI,		/* sample-decimation */
+	__FA100M14B4C_CONF_ACQ_N,
+};
+enum fa100m14b4c_conf_chn {
+	FA100M14B4C_CONF_CHN_RANGE = 0,	/* chN-vref */
+	FA100M14B4C_CONF_CHN_TERM,	/* chN-50ohm-term */
+	FA100M14B4C_CONF_CHN_OFFSET,	/* chN-offset */
+	FA100M14B4C_CONF_CHN_SAT,	/* chN-saturation */
+	__FA100M14B4C_CONF_CHN_N,
+};
+enum fa100m14b4c_conf_utc {
+	FA100M14B4C_CONF_UTC_S = 0,	/* tstamp-base-s */
+	FA100M14B4C_CONF_UTC_T,		/* tstamp-base-t */
+	__FA100M14B4C_CONF_UTC_N,
+};
+
+struct fa100m14b4c_conf {
+	uint32_t version;
+	uint32_t trg_mask;
+	uint32_t trg[__FA100M14B4C_CONF_TRG_N];
+	uint32_t acq_mask;
+	uint32_t acq[__FA100M14B4C_CONF_ACQ_N];
+	uint32_t chn_mask[FA100M14B4C_NCHAN];
+	uint32_t chn[FA100M14B4C_NCHAN][__FA100M14B4C_CONF_CHN_N];
+	uint32_t utc_mask;
+	uint32_t utc[__FA100M14B4C_CONF_UTC_N];
+};
+
 /* ADC DDR memory */
 #define FA100M14B4C_MAX_ACQ_BYTE 0x10000000 /* 256MB */
 
+/* Value of the "work-cpu" attribute: the work runs on any CPU */
+#define ZFA_WORK_CPU_ANY 0xffffffff
+
 enum fa100m14b4c_input_range {
 	FA100M14B4C_RANGE_10V = 0x0,
 	FA100M14B4C_RANGE_1V,
@@ -94,6 +146,8 @@ enum fa100m14b4c_fsm_state {
 #include <linux/dma-mapping.h>
 #include <linux/scatterlist.h>
 #include <linux/workqueue.h>
+#include <linux/bitmap.h>
+#include <linux/ktime.h>
 
 #include <linux/fmc.h>
 #include <linux/fmc-sdb.h>
@@ -232,6 +286,22 @@ enum zfadc_dregs_enum {
 	ZFA_HW_PARAM_COMMON_LAST,
 };
 
+/*
+ * Number of 32bit registers of the ADC core (up to ZFA_MULT_MAX_SAMP)
+ * kept in the register shadow
+ */
+#define FA_CSR_SHADOW_N (0x88 / 4)
+
+/* Retry period of a continuous acquisition which could not restart */
+#define FA_RESTART_DELAY_MS 10
+
+/* Values of the csr_shadow module parameter */
+enum fa_csr_shadow_mode {
+	FA_CSR_SHADOW_OFF = 0,
+	FA_CSR_SHADOW_ON,
+	FA_CSR_SHADOW_CHECK, /* compare the shadow with the hardware */
+};
+
 /* trigger timestamp block size in bytes */
 /* This block is added after the post trigger samples */
 /* in the DDR and contains the trigger timestamp */
@@ -247,6 +317,12 @@ enum fa_sw_param_id {
 
 	ZFA_SW_R_NOADDRES_TEMP,
 	ZFA_SW_R_NOADDERS_AUTO,
+	ZFA_SW_R_NOADDRES_DMA_HIT,
+	ZFA_SW_R_NOADDRES_POOL,
+	ZFA_SW_R_NOADDRES_WORK_CPU,
+	ZFA_SW_R_NOADDRES_DMA_BW,
+	ZFA_SW_R_NOADDRES_SWAP_USER,
+	ZFA_SW_R_NOADDRES_OVERRUN,
 	ZFA_SW_PARAM_COMMON_LAST,
 };
 
@@ -271,6 +347,7 @@ enum fa_irq_adc {
    carrier specific stuff, such as DMA or resets, from
    mezzanine-specific operations). */
 struct fa_dev; /* forward declaration */
+struct zfad_block;
 struct fa_carrier_op {
 	char* (*get_gwname)(void);
 	int (*init) (struct fa_dev *);
@@ -284,6 +361,11 @@ struct fa_carrier_op {
 	int (*dma_start)(struct zio_cset *cset);
 	void (*dma_done)(struct zio_cset *cset);
 	void (*dma_error)(struct zio_cset *cset);
+	/* Optional: map the blocks of the block pool in advance */
+	struct zio_dma_sgt *(*dma_prepare)(struct zio_cset *cset,
+					   struct zfad_block *zfad_block,
+					   unsigned int n_shots);
+	void (*dma_unprepare)(struct fa_dev *fa, struct zio_dma_sgt *zdma);
 };
 
 /* ADC and DAC Calibration, from  EEPROM */
@@ -310,6 +392,9 @@ struct fa_calib {
  * @n_fires: number of trigger fire occurred within an acquisition
  *
  * @n_dma_err: number of errors
+ * @n_dma_cache_hit: number of DMA transfers of blocks mapped in advance
+ * @dma_kbps: readout bandwidth of the last acquisition (KiB/s)
+ * @n_overrun: number of gaps in a continuous acquisition
  *
  */
 struct fa_dev {
@@ -332,6 +417,7 @@ struct fa_dev {
 
 	/* DMA description */
 	struct zio_dma_sgt *zdma;
+	struct zio_dma_sgt *zdma_next; /* blocks mapped by the block pool */
 
 	/* carrier specific functions (init/exit/reset/readout/irq handling) */
 	struct fa_carrier_op *carrier_op;
@@ -339,6 +425,8 @@ struct fa_dev {
 	void *carrier_data;
 	int irq_src; /* list of irq sources to listen */
 	struct work_struct irq_work;
+	struct workqueue_struct *irq_wq; /* per-device, runs irq_work */
+	unsigned int work_cpu; /* CPU running irq_work or WORK_CPU_UNBOUND */
 	/*
 	 * keep last core having fired an IRQ
 	 * Used to check irq sequence: ACQ followed by DMA
@@ -350,8 +438,16 @@ struct fa_dev {
 	unsigned int		n_fires;
 	unsigned int		mshot_max_samples;
 
+	/* shadow copy of the ADC core registers (see fa_csr_rmw_get()) */
+	uint32_t		csr_shadow[FA_CSR_SHADOW_N];
+	DECLARE_BITMAP(csr_shadow_valid, FA_CSR_SHADOW_N);
+
 	/* Statistic informations */
 	unsigned int		n_dma_err;
+	unsigned int		n_dma_cache_hit;
+	ktime_t			dma_start_time;
+	unsigned int		dma_kbps;
+	unsigned int		n_overrun;
 
 	/* Configuration */
 	int			user_offset[4]; /* one per channel */
@@ -366,6 +462,9 @@ struct fa_dev {
 
 	/* flag  */
 	int enable_auto_start;
+	int data_swap_user; /* SVEC: leave the endianness conversion to user */
+	int data_big_endian; /* payload of the last acquisition is big endian */
+	struct delayed_work restart_work; /* see zfad_fsm_auto_start() */
 
 	uint32_t trig_compensation;
 };
@@ -424,6 +523,12 @@ static inline struct fa_dev *get_zfadc(struct device *dev)
 	return NULL;
 }
 
+/* Register shadow, exported by fa-core.c */
+extern uint32_t fa_csr_rmw_get(struct fa_dev *fa, unsigned int base_off,
+			       const struct zfa_field_desc *field);
+extern void fa_csr_shadow_set(struct fa_dev *fa, unsigned int base_off,
+			      const struct zfa_field_desc *field, uint32_t val);
+
 static inline u32 fa_ioread(struct fa_dev *fa, unsigned long addr)
 {
 	return fmc_readl(fa->fmc, addr);
@@ -459,9 +564,12 @@ static inline void fa_writel(struct fa_dev *fa,
 	uint32_t cur, val;
 
 	val = usr_val;
-	/* Read current register value first if it's a bitfield */
+	/*
+	 * Get the current register value first if it's a bitfield; it comes
+	 * from the register shadow when possible
+	 */
 	if (field->is_bitfield) {
-		cur = fa_ioread(fa, base_off+field->offset);
+		cur = fa_csr_rmw_get(fa, base_off, field);
 		/* */
 		cur &= ~field->mask; /* clear bits according to the mask */
 		val = usr_val * (field->mask & -(field->mask));
@@ -473,11 +581,9 @@ static inline void fa_writel(struct fa_dev *fa,
 		val |= cur;
 	}
 	fa_iowrite(fa, val, base_off+field->offset);
+	fa_csr_shadow_set(fa, base_off, field, val);
 }
 
-/* Global variable exported by fa-core.c */
-extern struct workqueue_struct *fa_workqueue;
-
 /* Global variable exported by fa-spec.c */
 extern struct fa_carrier_op fa_spec_op;
 
@@ -489,6 +595,7 @@ extern const struct zfa_field_desc zfad_regs[];
 
 /* Functions exported by fa-core.c */
 extern int zfad_fsm_command(struct fa_dev *fa, uint32_t command);
+extern void zfad_fsm_auto_start(struct fa_dev *fa);
 extern int zfad_apply_user_offset(struct fa_dev *fa, struct zio_channel *chan,
 				  uint32_t usr_val);
 extern void zfad_reset_offset(struct fa_dev *fa);
@@ -10,6 +10,7 @@
  * option, any later version.
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
@@ -43,15 +44,20 @@ struct fmcadc_operations fa_100ms_4ch_14bit_op = {
 	.acq_start =		fmcadc_zio_acq_start,
 	.acq_poll =		fmcadc_zio_acq_poll,
 	.acq_stop =		fmcadc_zio_acq_stop,
+	.get_fd =		fmcadc_zio_get_fd,
 
 	.apply_config =		fmcadc_zio_apply_config,
 	.retrieve_config =	fmcadc_zio_retrieve_config,
+	.invalidate_config =	fmcadc_zio_invalidate_config,
+	.revalidate_config =	fmcadc_zio_revalidate_config,
 
 	.get_param =		fmcadc_zio_get_param,
 	.set_param =		fmcadc_zio_set_param,
+	.get_conf_stats =	fmcadc_zio_get_conf_stats,
 
 	.request_buffer =	fmcadc_zio_request_buffer,
 	.fill_buffer =		fmcadc_zio_fill_buffer,
+	.fill_buffers =		fmcadc_zio_fill_buffers,
 	.tstamp_buffer =	fmcadc_zio_tstamp_buffer,
 	.release_buffer =	fmcadc_zio_release_buffer,
 };
@@ -68,11 +74,85 @@ struct fmcadc_board_type fmcadc_100ms_4ch_14bit = {
 	.fa_op = &fa_100ms_4ch_14bit_op,
 };
 
+/* No hardware: synthetic data, see fmc-adc-sim.c */
+struct fmcadc_operations fa_sim_op = {
+	.open =			fmcadc_sim_open,
+	.close =		fmcadc_sim_close,
+
+	.acq_start =		fmcadc_sim_acq_start,
+	.acq_poll =		fmcadc_sim_acq_poll,
+	.acq_stop =		fmcadc_sim_acq_stop,
+	.get_fd =		fmcadc_sim_get_fd,
+
+	.apply_config =		fmcadc_sim_apply_config,
+	.retrieve_config =	fmcadc_sim_retrieve_config,
+
+	.get_param =		fmcadc_sim_get_param,
+	.set_param =		fmcadc_sim_set_param,
+	.get_conf_stats =	fmcadc_sim_get_conf_stats,
+
+	.request_buffer =	fmcadc_sim_request_buffer,
+	.fill_buffer =		fmcadc_sim_fill_buffer,
+	.fill_buffers =		fmcadc_sim_fill_buffers,
+	.tstamp_buffer =	fmcadc_zio_tstamp_buffer,
+	.release_buffer =	fmcadc_sim_release_buffer,
+};
+struct fmcadc_board_type fmcadc_sim = {
+	.name = "fmc-adc-sim",
+	.devname = "adc-sim",
+	.driver_type = "sim",
+	.capabilities = {
+		FMCADC_ZIO_TRG_MASK,
+		FMCADC_ZIO_ACQ_MASK,
+		FMCADC_ZIO_CHN_MASK,
+		FMCADC_ZIO_BRD_MASK,
+	},
+	.fa_op = &fa_sim_op,
+};
+
+/* Blocks from a file saved by the tools, see replay.c */
+struct fmcadc_operations fa_replay_op = {
+	.open =			fmcadc_replay_open,
+	.close =		fmcadc_sim_close,
+
+	.acq_start =		fmcadc_sim_acq_start,
+	.acq_poll =		fmcadc_sim_acq_poll,
+	.acq_stop =		fmcadc_sim_acq_stop,
+	.get_fd =		fmcadc_sim_get_fd,
+
+	.apply_config =		fmcadc_sim_apply_config,
+	.retrieve_config =	fmcadc_sim_retrieve_config,
+
+	.get_param =		fmcadc_sim_get_param,
+	.set_param =		fmcadc_sim_set_param,
+	.get_conf_stats =	fmcadc_sim_get_conf_stats,
+
+	.request_buffer =	fmcadc_sim_request_buffer,
+	.fill_buffer =		fmcadc_sim_fill_buffer,
+	.fill_buffers =		fmcadc_sim_fill_buffers,
+	.tstamp_buffer =	fmcadc_zio_tstamp_buffer,
+	.release_buffer =	fmcadc_sim_release_buffer,
+};
+struct fmcadc_board_type fmcadc_replay = {
+	.name = "fmc-adc-replay",
+	.devname = "adc-replay",
+	.driver_type = "replay",
+	.capabilities = {
+		FMCADC_ZIO_TRG_MASK,
+		FMCADC_ZIO_ACQ_MASK,
+		FMCADC_ZIO_CHN_MASK,
+		FMCADC_ZIO_BRD_MASK,
+	},
+	.fa_op = &fa_replay_op,
+};
+
 /*
  * The following array is the main entry point into the boards
  */
 static const struct fmcadc_board_type *fmcadc_board_types[] = {
 	&fmcadc_100ms_4ch_14bit,
+	&fmcadc_sim,
+	&fmcadc_replay,
 	/* add new boards here */
 };
 
@@ -96,6 +176,12 @@ struct fmcadc_dev *fmcadc_open(char *name, unsigned int dev_id,
 {
 	const struct fmcadc_board_type *b;
 
+	/* Run any application on the simulator or a recording, for testing */
+	if (getenv("LIB_FMCADC_SIM"))
+		name = fmcadc_sim.name;
+	if (getenv("LIB_FMCADC_REPLAY"))
+		name = fmcadc_replay.name;
+
 	b = find_board(name);
 	if (!b)
 		return NULL;
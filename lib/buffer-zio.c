@@ -10,6 +10,7 @@
  * option, any later version.
  */
 #include <stdint.h>
+#include <endian.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -39,6 +40,8 @@ static int fmcadc_zio_read_ctrl(struct __fmcadc_dev_zio *fa,
 		return 0; /* ok */
 
 	case -1:
+		if (errno == EAGAIN) /* no more blocks (fill_buffers) */
+			return -1;
 		if (fa->flags & FMCADC_FLAG_VERBOSE)
 			fprintf(stderr, "%s: read: %s\n", __func__,
 				strerror(errno));
@@ -70,12 +73,20 @@ static int fmcadc_zio_read_data(struct __fmcadc_dev_zio *fa,
 	else
 		datalen = samplesize * ctrl->nsamples;
 
-	if (fa->flags & FMCADC_FLAG_MMAP) {
+	if (buf->flags & FMCADC_FLAG_MMAP) {
 		unsigned long mapoffset  = ctrl->mem_offset;
 		unsigned long pagemask = fa->pagesize - 1;
 
-		if (buf->mapaddr) /* unmap previous block */
+		if (buf->mapaddr) { /* unmap previous block */
 			munmap(buf->mapaddr, buf->maplen);
+			buf->mapaddr = NULL;
+		}
+
+		/* Most of the times the block is in the persistent mapping */
+		if (fa->mapaddr && mapoffset + datalen <= fa->maplen) {
+			buf->data = fa->mapaddr + mapoffset;
+			return 0;
+		}
 
 		buf->maplen = (mapoffset & pagemask) + datalen;
 		buf->mapaddr = mmap(0, buf->maplen, PROT_READ, MAP_SHARED,
@@ -109,6 +120,72 @@ static int fmcadc_zio_read_data(struct __fmcadc_dev_zio *fa,
 	return -1;
 }
 
+/*
+ * Internal function to convert big endian data to the CPU endianness. The
+ * driver leaves VME data big endian when asked (SVEC "data-swap-user").
+ * Mapped data is read-only: the caller must check ZIO_CONTROL_BIG_ENDIAN
+ */
+static void fmcadc_zio_fix_endianness(struct __fmcadc_dev_zio *fa,
+				      struct fmcadc_buffer *buf)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	struct zio_control *ctrl = buf->metadata;
+	uint32_t *data = buf->data;
+	size_t i, n;
+
+	if (!(ctrl->flags & ZIO_CONTROL_BIG_ENDIAN) ||
+	    buf->flags & FMCADC_FLAG_MMAP)
+		return;
+	/* samples are swapped as 32bits words, like the driver does */
+	n = (size_t)buf->samplesize * buf->nsamples / 4;
+	for (i = 0; i < n; ++i)
+		data[i] = __builtin_bswap32(data[i]);
+	ctrl->flags &= ~ZIO_CONTROL_BIG_ENDIAN;
+	ctrl->flags |= ZIO_CONTROL_LITTLE_ENDIAN;
+#endif
+}
+
+/*
+ * Map once the whole data area of a vmalloc buffer, so that filling a
+ * buffer does not need mmap/munmap. If it fails, or the buffer is
+ * resized later, blocks are mapped one by one
+ */
+void fmcadc_zio_map_data(struct __fmcadc_dev_zio *fa)
+{
+	struct fmcadc_dev *dev = (struct fmcadc_dev *)&fa->gid;
+	unsigned long len;
+	char s[16];
+	int kb;
+
+	if (fmcadc_get_param(dev, "cset0/current_buffer", s, NULL) < 0)
+		return;
+	if (strcmp(s, "vmalloc"))
+		return;
+	fa->flags |= FMCADC_FLAG_MMAP;
+
+	if (fmcadc_get_param(dev, "cset0/chani/buffer/max-buffer-kb",
+			     NULL, &kb) < 0 || kb <= 0)
+		return;
+	len = ((unsigned long)kb * 1024 + fa->pagesize - 1) &
+		~(fa->pagesize - 1);
+	fa->mapaddr = mmap(0, len, PROT_READ, MAP_SHARED, fa->fdd, 0);
+	if (fa->mapaddr == MAP_FAILED) {
+		if (fa->flags & FMCADC_FLAG_VERBOSE)
+			fprintf(stderr, "%s: mmap: %s\n", __func__,
+				strerror(errno));
+		fa->mapaddr = NULL;
+		return;
+	}
+	fa->maplen = len;
+}
+
+void fmcadc_zio_unmap_data(struct __fmcadc_dev_zio *fa)
+{
+	if (fa->mapaddr)
+		munmap(fa->mapaddr, fa->maplen);
+	fa->mapaddr = NULL;
+}
+
 /* externally-called: malloc buffer and metadata, do your best with data */
 struct fmcadc_buffer *fmcadc_zio_request_buffer(struct fmcadc_dev *dev,
 						int nsamples,
@@ -128,6 +205,22 @@ struct fmcadc_buffer *fmcadc_zio_request_buffer(struct fmcadc_dev *dev,
 			fa->flags |= FMCADC_FLAG_MALLOC;
 	}
 
+	/* Our own data: from the pool, where released buffers go */
+	if (!alloc && fa->flags & FMCADC_FLAG_MALLOC) {
+		if (!fa->pool)
+			fa->pool = fmcadc_pool_create(fa->flags &
+						      FMCADC_FLAG_HUGETLB);
+		if (!fa->pool) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		buf = fmcadc_pool_get(fa->pool, nsamples * fa->samplesize);
+		if (!buf)
+			return NULL;
+		flags |= buf->flags;
+		goto out;
+	}
+
 	buf = calloc(1, sizeof(*buf));
 	if (!buf) {
 		errno = ENOMEM;
@@ -140,9 +233,7 @@ struct fmcadc_buffer *fmcadc_zio_request_buffer(struct fmcadc_dev *dev,
 		return NULL;
 	}
 
-	/* Allocate data: custom allocator, or malloc, or mmap */
-	if (!alloc && fa->flags & FMCADC_FLAG_MALLOC)
-		alloc = malloc;
+	/* Allocate data: custom allocator, or mmap */
 	if (alloc) {
 		buf->data = alloc(nsamples * fa->samplesize);
 		if (!buf->data) {
@@ -154,8 +245,10 @@ struct fmcadc_buffer *fmcadc_zio_request_buffer(struct fmcadc_dev *dev,
 	} else {
 		/* mmap is done later */
 		buf->data = NULL;
+		flags |= FMCADC_FLAG_MMAP;
 	}
 
+out:
 	/* Copy other information */
 	buf->samplesize = fa->samplesize;
 	buf->nsamples = nsamples;
@@ -164,12 +257,9 @@ struct fmcadc_buffer *fmcadc_zio_request_buffer(struct fmcadc_dev *dev,
 	return buf;
 }
 
-int fmcadc_zio_fill_buffer(struct fmcadc_dev *dev,
-			   struct fmcadc_buffer *buf,
-			   unsigned int flags,
-			   struct timeval *to)
+/* Internal function to wait for the first block */
+static int fmcadc_zio_wait(struct __fmcadc_dev_zio *fa, struct timeval *to)
 {
-	struct __fmcadc_dev_zio *fa = to_dev_zio(dev);
 	struct pollfd p;
 	int to_ms, ret;
 
@@ -192,16 +282,97 @@ int fmcadc_zio_fill_buffer(struct fmcadc_dev *dev,
 		errno = FMCADC_EDISABLED;
 		return -1;
 	}
+	return 0;
+}
 
+/* Report the error of a shot that fill_buffers could not return */
+static int fmcadc_zio_fill_errno(struct __fmcadc_dev_zio *fa)
+{
+	if (!fa->fill_errno)
+		return 0;
+	errno = fa->fill_errno;
+	fa->fill_errno = 0;
+	return -1;
+}
+
+/*
+ * Internal function to fill a buffer with a block which is already there.
+ * If the data can't be read, the block is lost anyway, but its control
+ * is left in the buffer metadata
+ */
+static int fmcadc_zio_fill_one(struct __fmcadc_dev_zio *fa,
+			       struct fmcadc_buffer *buf, int *lost)
+{
+	int ret;
+
+	*lost = 0;
 	ret = fmcadc_zio_read_ctrl(fa, buf);
 	if (ret < 0)
 		return ret;
 	ret = fmcadc_zio_read_data(fa, buf);
-	if (ret < 0)
+	if (ret < 0) {
+		*lost = 1;
 		return ret;
+	}
+	fmcadc_zio_fix_endianness(fa, buf);
 	return 0;
 }
 
+int fmcadc_zio_fill_buffer(struct fmcadc_dev *dev,
+			   struct fmcadc_buffer *buf,
+			   unsigned int flags,
+			   struct timeval *to)
+{
+	struct __fmcadc_dev_zio *fa = to_dev_zio(dev);
+	int lost;
+
+	if (fmcadc_zio_fill_errno(fa) < 0)
+		return -1;
+	if (fmcadc_zio_wait(fa, to) < 0)
+		return -1;
+	return fmcadc_zio_fill_one(fa, buf, &lost);
+}
+
+/*
+ * Wait for the first block, like fill_buffer, then drain the blocks
+ * already in the ZIO buffer without waiting again: the control device
+ * is non-blocking, so only the reads are needed for each block. A mapped
+ * buffer ends the loop: ZIO reuses its block as soon as the next control
+ * is read, so it can only be the last one filled. A shot whose data
+ * can't be read after its control is lost: if some buffers are filled
+ * already, they are returned and the next call reports the error.
+ */
+int fmcadc_zio_fill_buffers(struct fmcadc_dev *dev,
+			    struct fmcadc_buffer **buf,
+			    unsigned int n,
+			    unsigned int flags,
+			    struct timeval *to)
+{
+	struct __fmcadc_dev_zio *fa = to_dev_zio(dev);
+	unsigned int i;
+	int lost;
+
+	if (!n)
+		return 0;
+	if (fmcadc_zio_fill_errno(fa) < 0)
+		return -1;
+	if (fmcadc_zio_wait(fa, to) < 0)
+		return -1;
+	for (i = 0; i < n; i++) {
+		if (fmcadc_zio_fill_one(fa, buf[i], &lost) < 0) {
+			if (lost && i)
+				fa->fill_errno = errno;
+			break;
+		}
+		if (buf[i]->flags & FMCADC_FLAG_MMAP) {
+			i++;
+			break;
+		}
+	}
+	/* An error after the first shot is reported by the next call */
+	return i ? i : -1;
+}
+
 struct fmcadc_timestamp *fmcadc_zio_tstamp_buffer(struct fmcadc_buffer *buf,
 						  struct fmcadc_timestamp *ts)
 {
@@ -219,6 +390,10 @@ int fmcadc_zio_release_buffer(struct fmcadc_dev *dev,
 {
 	struct __fmcadc_dev_zio *fa = to_dev_zio(dev);
 
+	if (buf->flags & FMCADC_FLAG_POOL) {
+		fmcadc_pool_put(fa->pool, buf);
+		return 0;
+	}
 	free(buf->metadata);
 	if (!free_fn && fa->flags & FMCADC_FLAG_MALLOC)
 		free_fn = free;
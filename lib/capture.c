@@ -0,0 +1,494 @@
+/*
+ * Capture files: many shots in a single file, with an index
+ *
+ * Copyright (C) 2013 CERN (www.cern.ch)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2 as published by the Free Software Foundation or, at your
+ * option, any later version.
+ */
+#define _GNU_SOURCE /* O_DIRECT */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <linux/zio-user.h>
+#include <fmc-adc-100m14b4cha.h>
+
+#include "fmcadc-lib.h"
+#include "fmcadc-lib-int.h"
+
+/*
+ * The file is made of a header, the shots and an index. Each shot is a
+ * zio_control followed by the data, padded so that all shots start at
+ * a multiple of the alignment: FMCADC_CAP_ALIGN, or the block size when
+ * the file is written with O_DIRECT. The index lists time stamp and file
+ * offset of each shot, in acquisition order. Offset and length of the
+ * index are written in the header when the file is closed: if the
+ * writer didn't close it, the reader rebuilds the index by scanning the
+ * shots. All numbers are in the byte order of the writer, like the
+ * zio_control; "version" tells if the reader can use the file.
+ */
+#define FMCADC_CAP_VERSION 1
+#define FMCADC_CAP_ALIGN 64
+#define FMCADC_CAP_NCHAN 4
+
+struct fmcadc_cap_header {
+	char magic[8];		/* FMCADC_CAPTURE_MAGIC */
+	uint32_t version;
+	uint32_t header_size;	/* offset of the first shot */
+	uint32_t ctrl_size;	/* sizeof(struct zio_control) */
+	uint32_t align;
+	uint32_t dev_id;
+	uint32_t nchan;
+	/* configuration of the channels when the file was created */
+	uint32_t range[FMCADC_CAP_NCHAN];
+	uint32_t offset[FMCADC_CAP_NCHAN];
+	uint32_t termination[FMCADC_CAP_NCHAN];
+	uint32_t nshots;	/* written at close */
+	uint32_t reserved;
+	uint64_t index_offset;	/* written at close, 0 before */
+};
+
+struct fmcadc_cap_index {
+	uint64_t t;		/* time stamp, nanoseconds */
+	uint64_t offset;	/* of the zio_control */
+	uint32_t datalen;
+	uint32_t seq;
+};
+
+struct fmcadc_capture {
+	struct fmcadc_cap_header hdr;
+	struct fmcadc_cap_index *index;
+	unsigned int nshots;
+	unsigned int nalloc;	/* writer: allocated index entries */
+	int fd;			/* writer only */
+	uint64_t offset;	/* end of the shots */
+	void *map;		/* reader only */
+	size_t maplen;
+	int index_mapped;	/* reader: the index is in the file */
+};
+
+static uint64_t fmcadc_cap_time(struct zio_control *ctrl)
+{
+	return ctrl->tstamp.secs * 1000000000ULL +
+		ctrl->tstamp.ticks * FA100M14B4C_UTC_CLOCK_NS;
+}
+
+static size_t fmcadc_cap_pad(size_t len, unsigned int align)
+{
+	return (align - len % align) % align;
+}
+
+/*
+ * fmcadc_capture_create_align
+ * @name: the file to create (or truncate)
+ * @dev: the device, to save the channel configuration; may be NULL
+ * @align: alignment of the shots, a power of 2 not less than 64
+ * @oflags: more flags for open(2), like O_DIRECT
+ *
+ * The header is written from an aligned buffer, as O_DIRECT requires
+ */
+struct fmcadc_capture *fmcadc_capture_create_align(char *name,
+						   struct fmcadc_dev *dev,
+						   unsigned int align,
+						   int oflags)
+{
+	struct fmcadc_capture *cap;
+	struct fmcadc_cap_header *hdr;
+	struct fmcadc_conf ch;
+	void *block;
+	int k;
+
+	if (align < FMCADC_CAP_ALIGN || (align & (align - 1))) {
+		errno = EINVAL;
+		return NULL;
+	}
+	cap = calloc(1, sizeof(*cap));
+	if (!cap)
+		return NULL;
+	hdr = &cap->hdr;
+	memcpy(hdr->magic, FMCADC_CAPTURE_MAGIC, sizeof(hdr->magic));
+	hdr->version = FMCADC_CAP_VERSION;
+	hdr->header_size = sizeof(*hdr) + fmcadc_cap_pad(sizeof(*hdr), align);
+	hdr->ctrl_size = sizeof(struct zio_control);
+	hdr->align = align;
+	hdr->nchan = FMCADC_CAP_NCHAN;
+	for (k = 0; dev && k < FMCADC_CAP_NCHAN; ++k) {
+		memset(&ch, 0, sizeof(ch));
+		ch.type = FMCADC_CONF_TYPE_CHN;
+		ch.route_to = k;
+		fmcadc_set_conf_mask(&ch, FMCADC_CONF_CHN_RANGE);
+		fmcadc_set_conf_mask(&ch, FMCADC_CONF_CHN_OFFSET);
+		fmcadc_set_conf_mask(&ch, FMCADC_CONF_CHN_TERMINATION);
+		if (fmcadc_retrieve_config(dev, &ch) < 0)
+			break; /* not fatal: the controls have it all */
+		hdr->range[k] = ch.value[FMCADC_CONF_CHN_RANGE];
+		hdr->offset[k] = ch.value[FMCADC_CONF_CHN_OFFSET];
+		hdr->termination[k] = ch.value[FMCADC_CONF_CHN_TERMINATION];
+	}
+
+	if (posix_memalign(&block, align, hdr->header_size)) {
+		free(cap);
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(block, 0, hdr->header_size);
+	memcpy(block, hdr, sizeof(*hdr));
+
+	cap->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | oflags, 0666);
+	if (cap->fd < 0)
+		goto out_free;
+	if (write(cap->fd, block, hdr->header_size) != hdr->header_size) {
+		if (errno == 0)
+			errno = EIO;
+		close(cap->fd);
+		goto out_free;
+	}
+	free(block);
+	cap->offset = hdr->header_size;
+	return cap;
+
+out_free:
+	free(block);
+	free(cap);
+	return NULL;
+}
+
+/*
+ * fmcadc_capture_create
+ * @name: the file to create (or truncate)
+ * @dev: the device, to save the channel configuration; may be NULL
+ */
+struct fmcadc_capture *fmcadc_capture_create(char *name,
+					     struct fmcadc_dev *dev)
+{
+	return fmcadc_capture_create_align(name, dev, FMCADC_CAP_ALIGN, 0);
+}
+
+/* Record a shot just written at the end of the file */
+static int fmcadc_capture_add(struct fmcadc_capture *cap,
+			      struct zio_control *ctrl, size_t datalen,
+			      size_t len)
+{
+	struct fmcadc_cap_index *index;
+
+	if (cap->nshots == cap->nalloc) {
+		index = realloc(cap->index, (cap->nalloc + 1024) *
+				sizeof(*index));
+		if (!index)
+			return -1;
+		cap->index = index;
+		cap->nalloc += 1024;
+	}
+	if (!cap->nshots)
+		cap->hdr.dev_id = ctrl->addr.dev_id;
+	index = cap->index + cap->nshots++;
+	index->t = fmcadc_cap_time(ctrl);
+	index->offset = cap->offset;
+	index->datalen = datalen;
+	index->seq = ctrl->seq_num;
+	cap->offset += len;
+	return 0;
+}
+
+/* Remove a shot that was written in part: the next one would be lost too */
+static void fmcadc_capture_undo(struct fmcadc_capture *cap, ssize_t ret)
+{
+	if (ret >= 0)
+		errno = EIO; /* short write */
+	if (ftruncate(cap->fd, cap->offset) == 0)
+		lseek(cap->fd, cap->offset, SEEK_SET);
+}
+
+/*
+ * fmcadc_capture_write
+ * @cap: a capture file being written
+ * @buf: a buffer filled by the library
+ *
+ * Append a shot to the file, with a single system call
+ */
+int fmcadc_capture_write(struct fmcadc_capture *cap, struct fmcadc_buffer *buf)
+{
+	static char zero[FMCADC_CAP_ALIGN];
+	struct zio_control *ctrl = buf->metadata;
+	struct iovec iov[3];
+	size_t datalen, len;
+	ssize_t ret;
+
+	if (cap->fd < 0) {
+		errno = EBADF; /* opened for reading */
+		return -1;
+	}
+	if (cap->hdr.align != FMCADC_CAP_ALIGN) {
+		errno = EINVAL; /* use fmcadc_capture_append */
+		return -1;
+	}
+
+	/* we allocated buf->nsamples, the shot can be longer */
+	datalen = (size_t)ctrl->ssize * ctrl->nsamples;
+	if (datalen > (size_t)buf->samplesize * buf->nsamples)
+		datalen = (size_t)buf->samplesize * buf->nsamples;
+	iov[0].iov_base = ctrl;
+	iov[0].iov_len = sizeof(*ctrl);
+	iov[1].iov_base = buf->data;
+	iov[1].iov_len = datalen;
+	iov[2].iov_base = zero;
+	iov[2].iov_len = fmcadc_cap_pad(sizeof(*ctrl) + datalen,
+					FMCADC_CAP_ALIGN);
+	len = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+	ret = writev(cap->fd, iov, 3);
+	if (ret != len) {
+		fmcadc_capture_undo(cap, ret);
+		return -1;
+	}
+	return fmcadc_capture_add(cap, ctrl, datalen, len);
+}
+
+/*
+ * fmcadc_capture_append
+ * @cap: a capture file being written
+ * @shot: a zio_control followed by the data, in an aligned buffer
+ * @datalen: the length of the data
+ *
+ * The length written is rounded up to the alignment of the file: the
+ * buffer must be that long, and its padding is written as it is
+ */
+int fmcadc_capture_append(struct fmcadc_capture *cap, void *shot,
+			  size_t datalen)
+{
+	size_t len = sizeof(struct zio_control) + datalen;
+	ssize_t ret;
+
+	len += fmcadc_cap_pad(len, cap->hdr.align);
+	ret = write(cap->fd, shot, len);
+	if (ret != len) {
+		fmcadc_capture_undo(cap, ret);
+		return -1;
+	}
+	return fmcadc_capture_add(cap, shot, datalen, len);
+}
+
+/* Writer: append the index and complete the header */
+static int fmcadc_capture_finish(struct fmcadc_capture *cap)
+{
+	size_t len = cap->nshots * sizeof(*cap->index);
+	int flags;
+
+	/* The index and header are not aligned */
+	flags = fcntl(cap->fd, F_GETFL);
+	if (flags & O_DIRECT)
+		fcntl(cap->fd, F_SETFL, flags & ~O_DIRECT);
+	if (write(cap->fd, cap->index, len) != len)
+		return -1;
+	cap->hdr.nshots = cap->nshots;
+	cap->hdr.index_offset = cap->offset;
+	if (pwrite(cap->fd, &cap->hdr, sizeof(cap->hdr), 0) != sizeof(cap->hdr))
+		return -1;
+	return 0;
+}
+
+/* Reader: build the index of a file that was not closed */
+static int fmcadc_capture_scan(struct fmcadc_capture *cap)
+{
+	struct zio_control *ctrl;
+	size_t datalen, len;
+
+	cap->offset = cap->hdr.header_size;
+	while (cap->offset + sizeof(*ctrl) <= cap->maplen) {
+		ctrl = cap->map + cap->offset;
+		datalen = (size_t)ctrl->ssize * ctrl->nsamples;
+		len = sizeof(*ctrl) + datalen;
+		if (cap->offset + len > cap->maplen)
+			break; /* the last shot was not completed */
+		len += fmcadc_cap_pad(len, cap->hdr.align);
+		if (fmcadc_capture_add(cap, ctrl, datalen, len) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * fmcadc_capture_open
+ * @name: the file to read
+ *
+ * Map a capture file, for reading
+ */
+struct fmcadc_capture *fmcadc_capture_open(char *name)
+{
+	struct fmcadc_capture *cap;
+	struct fmcadc_cap_header *hdr;
+	struct stat st;
+	int fd;
+
+	cap = calloc(1, sizeof(*cap));
+	if (!cap)
+		return NULL;
+	cap->fd = -1;
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		goto out_free;
+	if (fstat(fd, &st) < 0)
+		goto out_close;
+	if (st.st_size < sizeof(*hdr)) {
+		errno = EINVAL;
+		goto out_close;
+	}
+	cap->maplen = st.st_size;
+	cap->map = mmap(0, cap->maplen, PROT_READ, MAP_SHARED, fd, 0);
+	if (cap->map == MAP_FAILED)
+		goto out_close;
+	close(fd);
+
+	hdr = cap->map;
+	if (memcmp(hdr->magic, FMCADC_CAPTURE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != FMCADC_CAP_VERSION ||
+	    hdr->ctrl_size != sizeof(struct zio_control) ||
+	    hdr->align < FMCADC_CAP_ALIGN || (hdr->align & (hdr->align - 1)) ||
+	    hdr->header_size < sizeof(*hdr)) {
+		errno = EINVAL;
+		goto out_unmap;
+	}
+	cap->hdr = *hdr;
+
+	if (hdr->index_offset && hdr->index_offset <= cap->maplen &&
+	    (cap->maplen - hdr->index_offset) / sizeof(*cap->index) >=
+	    hdr->nshots) {
+		cap->index = cap->map + hdr->index_offset;
+		cap->nshots = hdr->nshots;
+		cap->index_mapped = 1;
+	} else if (fmcadc_capture_scan(cap) < 0) {
+		goto out_unmap;
+	}
+	return cap;
+
+out_unmap:
+	free(cap->index);
+	munmap(cap->map, cap->maplen);
+	free(cap);
+	return NULL;
+out_close:
+	close(fd);
+out_free:
+	free(cap);
+	return NULL;
+}
+
+/*
+ * fmcadc_capture_close
+ * @cap: a capture file, being written or read
+ *
+ * The writer completes the file with the index
+ */
+int fmcadc_capture_close(struct fmcadc_capture *cap)
+{
+	int err = 0;
+
+	if (cap->fd >= 0) {
+		err = fmcadc_capture_finish(cap);
+		if (close(cap->fd) < 0)
+			err = -1;
+	}
+	if (cap->map)
+		munmap(cap->map, cap->maplen);
+	if (!cap->index_mapped)
+		free(cap->index);
+	free(cap);
+	return err;
+}
+
+int fmcadc_capture_info(struct fmcadc_capture *cap,
+			struct fmcadc_capture_info *info)
+{
+	int k;
+
+	memset(info, 0, sizeof(*info));
+	info->nshots = cap->nshots;
+	info->dev_id = cap->hdr.dev_id;
+	for (k = 0; k < FMCADC_CAP_NCHAN; ++k) {
+		info->range[k] = cap->hdr.range[k];
+		info->offset[k] = cap->hdr.offset[k];
+		info->termination[k] = cap->hdr.termination[k];
+	}
+	return 0;
+}
+
+/* The conversion to volts, with the configuration saved in the header */
+int fmcadc_capture_scale(struct fmcadc_capture *cap, struct fmcadc_scale *s)
+{
+	int k;
+
+	for (k = 0; k < FMCADC_CAP_NCHAN; ++k)
+		if (fmcadc_scale_channel(s, k, cap->hdr.range[k],
+					 cap->hdr.offset[k]) < 0)
+			return -1;
+	return 0;
+}
+
+/*
+ * fmcadc_capture_shot
+ * @cap: a capture file being read
+ * @n: the shot, from 0
+ * @shot: where to return the pointers to control and data
+ *
+ * The pointers refer to the file mapping: no data is copied. The index
+ * comes from the file, so each entry is checked against the mapping
+ */
+int fmcadc_capture_shot(struct fmcadc_capture *cap, unsigned int n,
+			struct fmcadc_capture_shot *shot)
+{
+	struct fmcadc_cap_index *index;
+
+	if (!cap->map || n >= cap->nshots) {
+		errno = EINVAL;
+		return -1;
+	}
+	index = cap->index + n;
+	if (index->offset > cap->maplen ||
+	    cap->maplen - index->offset < sizeof(struct zio_control) ||
+	    cap->maplen - index->offset - sizeof(struct zio_control) <
+	    index->datalen) {
+		errno = EINVAL; /* corrupted index */
+		return -1;
+	}
+	shot->ctrl = cap->map + index->offset;
+	shot->data = cap->map + index->offset + sizeof(struct zio_control);
+	shot->datalen = index->datalen;
+	shot->nsamples = index->datalen / (sizeof(int16_t) * FMCADC_CAP_NCHAN);
+	return 0;
+}
+
+/*
+ * fmcadc_capture_find
+ * @cap: a capture file being read
+ * @ts: a time stamp
+ *
+ * Return the first shot at or after the time stamp (the number of shots
+ * if there is none), with a binary search in the index: shots must be
+ * in time order, as they are acquired
+ */
+int fmcadc_capture_find(struct fmcadc_capture *cap,
+			struct fmcadc_timestamp *ts)
+{
+	uint64_t t = ts->secs * 1000000000ULL +
+		ts->ticks * FA100M14B4C_UTC_CLOCK_NS;
+	unsigned int lo = 0, hi = cap->nshots, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (cap->index[mid].t < t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
@@ -16,15 +16,100 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include <fmc-adc-100m14b4cha.h>
+
 #include "fmcadc-lib.h"
 #include "fmcadc-lib-int.h"
 
 #define FMCADC_CONF_GET 0
 #define FMCADC_CONF_SET 1
 
+/*
+ * Sysfs attributes are opened once and then kept open: the fd is reused
+ * with pread/pwrite at offset 0, which makes sysfs run show/store again.
+ * Read and write fds are separate, as some attributes are read-only or
+ * write-only. The list is short (a few tens of entries), so we scan it.
+ * The list, the statistics and the configuration caches are protected
+ * by fa->lock: the engine and the user threads share the device. The fd
+ * is used with the lock held, so that it is not closed meanwhile.
+ */
+struct fmcadc_zio_attr {
+	struct fmcadc_zio_attr *next;
+	int fd[2]; /* FMCADC_CONF_GET, FMCADC_CONF_SET */
+	char name[];
+};
+
+static int __fa_zio_sysfs_fd(struct __fmcadc_dev_zio *fa, char *name,
+			     int direction)
+{
+	struct fmcadc_zio_attr *a;
+	char pathname[128];
+
+	for (a = fa->attrs; a; a = a->next)
+		if (!strcmp(a->name, name))
+			break;
+	if (!a) {
+		a = malloc(sizeof(*a) + strlen(name) + 1);
+		if (!a)
+			return -1;
+		a->fd[FMCADC_CONF_GET] = a->fd[FMCADC_CONF_SET] = -1;
+		strcpy(a->name, name);
+		a->next = fa->attrs;
+		fa->attrs = a;
+	}
+	if (a->fd[direction] >= 0)
+		return a->fd[direction];
+
+	snprintf(pathname, sizeof(pathname), "%s/%s", fa->sysbase, name);
+	a->fd[direction] = open(pathname, direction == FMCADC_CONF_SET ?
+				O_WRONLY : O_RDONLY);
+	if (a->fd[direction] >= 0)
+		fa->conf_stats.n_open++;
+	return a->fd[direction];
+}
+
+/* Close a cached fd that failed: the next access opens the file again */
+static void __fa_zio_sysfs_drop(struct __fmcadc_dev_zio *fa, char *name,
+				int direction)
+{
+	struct fmcadc_zio_attr *a;
+
+	for (a = fa->attrs; a; a = a->next) {
+		if (strcmp(a->name, name))
+			continue;
+		if (a->fd[direction] >= 0)
+			close(a->fd[direction]);
+		a->fd[direction] = -1;
+		return;
+	}
+}
+
+void fmcadc_zio_sysfs_close(struct __fmcadc_dev_zio *fa)
+{
+	struct fmcadc_zio_attr *a;
+
+	while ((a = fa->attrs)) {
+		fa->attrs = a->next;
+		if (a->fd[FMCADC_CONF_GET] >= 0)
+			close(a->fd[FMCADC_CONF_GET]);
+		if (a->fd[FMCADC_CONF_SET] >= 0)
+			close(a->fd[FMCADC_CONF_SET]);
+		free(a);
+	}
+}
+
+static uint64_t __fa_zio_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 /*
  * Internal functions to read and write a string.
  * Trailing newlines are added/removed as needed
@@ -32,18 +117,30 @@
 static int __fa_zio_sysfs_set(struct __fmcadc_dev_zio *fa, char *name,
 			      char *val, int maxlen)
 {
-	char pathname[128];
 	char newval[maxlen + 1];
-	int fd, ret, len;
+	int fd, ret, len, retry = 1;
+	uint64_t t = __fa_zio_ns();
 
-	snprintf(pathname, sizeof(pathname), "%s/%s", fa->sysbase, name);
 	len = sprintf(newval, "%s\n", val);
 
-	fd = open(pathname, O_WRONLY);
-	if (fd < 0)
-		return -1;
-	ret = write(fd, newval, len);
-	close(fd);
+	pthread_mutex_lock(&fa->lock);
+	do {
+		fd = __fa_zio_sysfs_fd(fa, name, FMCADC_CONF_SET);
+		if (fd < 0) {
+			pthread_mutex_unlock(&fa->lock);
+			return -1;
+		}
+		ret = pwrite(fd, newval, len, 0);
+		/* The attribute may have gone and come back (driver reload) */
+		if (ret < 0 && errno == ENODEV)
+			__fa_zio_sysfs_drop(fa, name, FMCADC_CONF_SET);
+		else
+			retry = 0;
+	} while (ret < 0 && retry--);
+
+	fa->conf_stats.n_set++;
+	fa->conf_stats.set_ns += __fa_zio_ns() - t;
+	pthread_mutex_unlock(&fa->lock);
 	if (ret < 0)
 		return -1;
 	if (ret == len)
@@ -55,15 +152,26 @@ static int __fa_zio_sysfs_set(struct __fmcadc_dev_zio *fa, char *name,
 static int __fa_zio_sysfs_get(struct __fmcadc_dev_zio *fa, char *name,
 			      char *val /* no maxlen: reader knows */ )
 {
-	char pathname[128];
-	int fd, ret;
+	int fd, ret, retry = 1;
+	uint64_t t = __fa_zio_ns();
 
-	snprintf(pathname, sizeof(pathname), "%s/%s", fa->sysbase, name);
-	fd = open(pathname, O_RDONLY);
-	if (fd < 0)
-		return -1;
-	ret = read(fd, val, 128 /* well... user knows... */);
-	close(fd);
+	pthread_mutex_lock(&fa->lock);
+	do {
+		fd = __fa_zio_sysfs_fd(fa, name, FMCADC_CONF_GET);
+		if (fd < 0) {
+			pthread_mutex_unlock(&fa->lock);
+			return -1;
+		}
+		ret = pread(fd, val, 128 /* well... user knows... */, 0);
+		if (ret < 0 && errno == ENODEV)
+			__fa_zio_sysfs_drop(fa, name, FMCADC_CONF_GET);
+		else
+			retry = 0;
+	} while (ret < 0 && retry--);
+
+	fa->conf_stats.n_get++;
+	fa->conf_stats.get_ns += __fa_zio_ns() - t;
+	pthread_mutex_unlock(&fa->lock);
 	if (ret < 0)
 		return -1;
 	if (val[ret - 1] == '\n')
@@ -71,6 +179,17 @@ static int __fa_zio_sysfs_get(struct __fmcadc_dev_zio *fa, char *name,
 	return 0;
 }
 
+int fmcadc_zio_get_conf_stats(struct fmcadc_dev *dev,
+			      struct fmcadc_conf_stats *stats)
+{
+	struct __fmcadc_dev_zio *fa = to_dev_zio(dev);
+
+	pthread_mutex_lock(&fa->lock);
+	memcpy(stats, &fa->conf_stats, sizeof(*stats));
+	pthread_mutex_unlock(&fa->lock);
+	return 0;
+}
+
 /*
  * Public functions (through ops and ./route.c).
  * They manage both strings and integers
@@ -354,11 +473,92 @@ static int fmcadc_zio_config_brd(struct __fmcadc_dev_zio *fa,
 	}
 }
 
+/*
+ * Apply a configuration with a single write to the binary file, if the
+ * driver has it. The driver validates all the items before applying
+ * them. Returns 1 if the caller must write the attributes one by one:
+ * the file is missing or some items don't fit the binary structure.
+ */
+static int fmcadc_zio_config_bin(struct __fmcadc_dev_zio *fa,
+				 struct fmcadc_conf *conf)
+{
+	struct fa100m14b4c_conf bin;
+	uint64_t mask = conf->mask;
+	uint64_t t = __fa_zio_ns();
+	int fd, ret;
+
+	if (fa->flags & FMCADC_FLAG_NOBIN)
+		return 1;
+
+	memset(&bin, 0, sizeof(bin));
+	bin.version = FA100M14B4C_CONF_VERSION;
+	switch (conf->type) {
+	case FMCADC_CONF_TYPE_TRG:
+		if (mask >> __FA100M14B4C_CONF_TRG_N)
+			return 1;
+		bin.trg_mask = mask;
+		memcpy(bin.trg, conf->value, sizeof(bin.trg));
+		break;
+	case FMCADC_CONF_TYPE_ACQ:
+		if (mask >> __FA100M14B4C_CONF_ACQ_N)
+			return 1;
+		bin.acq_mask = mask;
+		memcpy(bin.acq, conf->value, sizeof(bin.acq));
+		break;
+	case FMCADC_CONF_TYPE_CHN:
+		if (mask >> __FA100M14B4C_CONF_CHN_N ||
+		    conf->route_to >= FA100M14B4C_NCHAN)
+			return 1;
+		bin.chn_mask[conf->route_to] = mask;
+		memcpy(bin.chn[conf->route_to], conf->value,
+		       sizeof(bin.chn[0]));
+		break;
+	case FMCADC_CONF_TYPE_BRD:
+		if (mask & ~((1LL << FMCADC_CONF_UTC_TIMING_BASE_S) |
+			     (1LL << FMCADC_CONF_UTC_TIMING_BASE_T)))
+			return 1;
+		if (mask & (1LL << FMCADC_CONF_UTC_TIMING_BASE_S)) {
+			bin.utc_mask |= 1 << FA100M14B4C_CONF_UTC_S;
+			bin.utc[FA100M14B4C_CONF_UTC_S] =
+				conf->value[FMCADC_CONF_UTC_TIMING_BASE_S];
+		}
+		if (mask & (1LL << FMCADC_CONF_UTC_TIMING_BASE_T)) {
+			bin.utc_mask |= 1 << FA100M14B4C_CONF_UTC_T;
+			bin.utc[FA100M14B4C_CONF_UTC_T] =
+				conf->value[FMCADC_CONF_UTC_TIMING_BASE_T];
+		}
+		break;
+	default:
+		return 1;
+	}
+
+	pthread_mutex_lock(&fa->lock);
+	fd = __fa_zio_sysfs_fd(fa, "cset0/configuration", FMCADC_CONF_SET);
+	if (fd < 0) {
+		/* Older driver: don't look for the file any more */
+		fa->flags |= FMCADC_FLAG_NOBIN;
+		pthread_mutex_unlock(&fa->lock);
+		return 1;
+	}
+	ret = pwrite(fd, &bin, sizeof(bin), 0);
+	fa->conf_stats.n_set++;
+	fa->conf_stats.set_ns += __fa_zio_ns() - t;
+	pthread_mutex_unlock(&fa->lock);
+	if (ret == sizeof(bin))
+		return 0;
+	if (ret >= 0)
+		errno = EIO; /* short write */
+	if (fa->flags & FMCADC_FLAG_VERBOSE)
+		fprintf(stderr, "lib-fmcadc: Error writing configuration (%s)\n",
+			strerror(errno));
+	return -1;
+}
+
 static int fmcadc_zio_config(struct __fmcadc_dev_zio *fa, unsigned int flags,
 		struct fmcadc_conf *conf, unsigned int direction)
 {
 
-	int err = 0, i;
+	int err = 0, ret, saved_errno, i;
 	uint32_t enabled;
 
 	/* Disabling the trigger before changing configuration */
@@ -372,6 +572,12 @@ static int fmcadc_zio_config(struct __fmcadc_dev_zio *fa, unsigned int flags,
 			/* restore the initial value */
 			enabled = 1;
 		}
+
+		/* All the items at once, if possible */
+		err = fmcadc_zio_config_bin(fa, conf);
+		if (err <= 0)
+			goto out;
+		err = 0;
 	}
 
 	for (i = 0; i < __FMCADC_CONF_LEN; ++i) {
@@ -391,7 +597,8 @@ static int fmcadc_zio_config(struct __fmcadc_dev_zio *fa, unsigned int flags,
 		case FMCADC_CONF_TYPE_CHN:
 			if (conf->route_to > 3) {
 				errno = FMCADC_ENOCHAN;
-				return -1;
+				err = -1;
+				goto out;
 			}
 			err = fmcadc_zio_config_chn(fa, conf->route_to,
 					i, &conf->value[i],
@@ -403,30 +610,164 @@ static int fmcadc_zio_config(struct __fmcadc_dev_zio *fa, unsigned int flags,
 			break;
 		default:
 			errno = FMCADC_ENOCFG;
-			return -1;
+			err = -1;
+			goto out;
 		}
 		if (err)
 			break; /* stop the config process: an error occurs */
 	}
 
-	/* if the trigger was enabled restore it */
-	if (direction && enabled)
-		err = fa_zio_sysfs_set(fa, "cset0/trigger/enable", &enabled);
+out:
+	/* if the trigger was enabled restore it, but report the first error */
+	if (direction && enabled) {
+		saved_errno = errno;
+		ret = fa_zio_sysfs_set(fa, "cset0/trigger/enable", &enabled);
+		if (err)
+			errno = saved_errno;
+		else
+			err = ret;
+	}
 	return err;
 }
 
+/*
+ * The library remembers the items it applied, so that it can skip them
+ * when they are applied again with the same value. Board items are not
+ * cached: writing the time base again is not a no-op.
+ */
+static struct fmcadc_conf *fmcadc_zio_conf_cache(struct __fmcadc_dev_zio *fa,
+						 struct fmcadc_conf *conf)
+{
+	switch (conf->type) {
+	case FMCADC_CONF_TYPE_TRG:
+		return &fa->cache_trg;
+	case FMCADC_CONF_TYPE_ACQ:
+		return &fa->cache_acq;
+	case FMCADC_CONF_TYPE_CHN:
+		if (conf->route_to < ARRAY_SIZE(fa->cache_chn))
+			return &fa->cache_chn[conf->route_to];
+		return NULL;
+	default:
+		return NULL;
+	}
+}
+
 int fmcadc_zio_apply_config(struct fmcadc_dev *dev, unsigned int flags,
 		struct fmcadc_conf *conf)
 {
 	struct __fmcadc_dev_zio *fa = to_dev_zio(dev);
+	struct fmcadc_conf *cache = fmcadc_zio_conf_cache(fa, conf);
+	struct fmcadc_conf diff;
+	uint64_t bit;
+	int i, err;
+
+	if (!cache)
+		return fmcadc_zio_config(fa, flags, conf, FMCADC_CONF_SET);
 
-	return fmcadc_zio_config(fa, flags, conf, FMCADC_CONF_SET);
+	/* Apply only the items that changed */
+	diff = *conf;
+	pthread_mutex_lock(&fa->lock);
+	for (i = 0; i < __FMCADC_CONF_LEN && !(flags & FMCADC_F_FORCE); ++i) {
+		bit = 1LL << i;
+		if (!(diff.mask & cache->mask & bit) ||
+		    diff.value[i] != cache->value[i])
+			continue;
+		diff.mask &= ~bit;
+		fa->conf_stats.n_skip++;
+	}
+	pthread_mutex_unlock(&fa->lock);
+	if (!diff.mask)
+		return 0;
+
+	err = fmcadc_zio_config(fa, flags, &diff, FMCADC_CONF_SET);
+	if (err) {
+		/*
+		 * We don't know what has been applied, and some items change
+		 * others in the driver (the range changes the offset, the
+		 * trigger source the delay): forget them all
+		 */
+		fmcadc_zio_invalidate_config(dev);
+		return err;
+	}
+	pthread_mutex_lock(&fa->lock);
+	for (i = 0; i < __FMCADC_CONF_LEN; ++i)
+		if (diff.mask & (1LL << i))
+			cache->value[i] = diff.value[i];
+	cache->mask |= diff.mask;
+	cache->type = conf->type;
+	cache->route_to = conf->route_to;
+	pthread_mutex_unlock(&fa->lock);
+	return 0;
 }
 
 int fmcadc_zio_retrieve_config(struct fmcadc_dev *dev,
 		struct fmcadc_conf *conf)
 {
 	struct __fmcadc_dev_zio *fa = to_dev_zio(dev);
+	struct fmcadc_conf *cache = fmcadc_zio_conf_cache(fa, conf);
+	int i, err;
+
+	err = fmcadc_zio_config(fa, 0, conf, FMCADC_CONF_GET);
+	if (err || !cache)
+		return err;
+	/* Refresh the cached items we have just read */
+	pthread_mutex_lock(&fa->lock);
+	for (i = 0; i < __FMCADC_CONF_LEN; ++i)
+		if (cache->mask & conf->mask & (1LL << i))
+			cache->value[i] = conf->value[i];
+	pthread_mutex_unlock(&fa->lock);
+	return 0;
+}
+
+int fmcadc_zio_invalidate_config(struct fmcadc_dev *dev)
+{
+	struct __fmcadc_dev_zio *fa = to_dev_zio(dev);
+	int i;
 
-	return fmcadc_zio_config(fa, 0, conf, FMCADC_CONF_GET);
+	pthread_mutex_lock(&fa->lock);
+	fa->cache_trg.mask = 0;
+	fa->cache_acq.mask = 0;
+	for (i = 0; i < ARRAY_SIZE(fa->cache_chn); ++i)
+		fa->cache_chn[i].mask = 0;
+	pthread_mutex_unlock(&fa->lock);
+	return 0;
+}
+
+/*
+ * Read again from the driver the cached items, in case another process
+ * changed them. Returns how many items changed, or -1 on error (and
+ * then the cache is empty)
+ */
+int fmcadc_zio_revalidate_config(struct fmcadc_dev *dev)
+{
+	struct __fmcadc_dev_zio *fa = to_dev_zio(dev);
+	struct fmcadc_conf *caches[] = {
+		&fa->cache_trg, &fa->cache_acq, &fa->cache_chn[0],
+		&fa->cache_chn[1], &fa->cache_chn[2], &fa->cache_chn[3],
+	};
+	struct fmcadc_conf cur;
+	int i, k, n = 0;
+
+	for (k = 0; k < ARRAY_SIZE(caches); ++k) {
+		pthread_mutex_lock(&fa->lock);
+		cur = *caches[k];
+		pthread_mutex_unlock(&fa->lock);
+		if (!cur.mask)
+			continue;
+		if (fmcadc_zio_config(fa, 0, &cur, FMCADC_CONF_GET)) {
+			fmcadc_zio_invalidate_config(dev);
+			return -1;
+		}
+		/* Only the items still cached: apply may have run meanwhile */
+		pthread_mutex_lock(&fa->lock);
+		for (i = 0; i < __FMCADC_CONF_LEN; ++i) {
+			if (!(cur.mask & caches[k]->mask & (1LL << i)))
+				continue;
+			if (cur.value[i] != caches[k]->value[i])
+				n++;
+			caches[k]->value[i] = cur.value[i];
+		}
+		pthread_mutex_unlock(&fa->lock);
+	}
+	return n;
 }
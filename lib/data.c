@@ -0,0 +1,425 @@
+/*
+ * Processing of acquired samples (board-independent)
+ *
+ * Copyright (C) 2013 CERN (www.cern.ch)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2 as published by the Free Software Foundation or, at your
+ * option, any later version.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "fmcadc-lib.h"
+#include "fmcadc-lib-int.h"
+
+#define FMCADC_DATA_NCHAN 4 /* interleaved channels */
+
+/*
+ * Split 8 samples of each channel (32 interleaved samples). The 4
+ * channels are always split; only the selected ones are stored.
+ * The memory operation is the bottleneck, so SSE2 (which every x86-64
+ * has) is enough: there is no need for AVX2 and run-time detection.
+ */
+#if defined(__SSE2__)
+#define FMCADC_DATA_VECTOR 8
+static inline void fmcadc_split_vector(const int16_t *src, __m128i *ch)
+{
+	__m128i v0, v1, v2, v3, t0, t1, t2, t3;
+
+	/* a0 b0 c0 d0 a1 b1 c1 d1, ... a6 b6 c6 d6 a7 b7 c7 d7 */
+	v0 = _mm_loadu_si128((const __m128i *)src + 0);
+	v1 = _mm_loadu_si128((const __m128i *)src + 1);
+	v2 = _mm_loadu_si128((const __m128i *)src + 2);
+	v3 = _mm_loadu_si128((const __m128i *)src + 3);
+	/* a0 a2 b0 b2 c0 c2 d0 d2, a1 a3 b1 b3 c1 c3 d1 d3, ... */
+	t0 = _mm_unpacklo_epi16(v0, v1);
+	t1 = _mm_unpackhi_epi16(v0, v1);
+	t2 = _mm_unpacklo_epi16(v2, v3);
+	t3 = _mm_unpackhi_epi16(v2, v3);
+	/* a0 a1 a2 a3 b0 b1 b2 b3, c0 c1 c2 c3 d0 d1 d2 d3, ... */
+	v0 = _mm_unpacklo_epi16(t0, t1);
+	v1 = _mm_unpackhi_epi16(t0, t1);
+	v2 = _mm_unpacklo_epi16(t2, t3);
+	v3 = _mm_unpackhi_epi16(t2, t3);
+	/* a0 .. a7, b0 .. b7, c0 .. c7, d0 .. d7 */
+	ch[0] = _mm_unpacklo_epi64(v0, v2);
+	ch[1] = _mm_unpackhi_epi64(v0, v2);
+	ch[2] = _mm_unpacklo_epi64(v1, v3);
+	ch[3] = _mm_unpackhi_epi64(v1, v3);
+}
+
+static void fmcadc_deinterleave_vector(int16_t **dst, const int16_t *src,
+				       unsigned int i, unsigned int chmask)
+{
+	__m128i ch[FMCADC_DATA_NCHAN];
+	int k;
+
+	fmcadc_split_vector(src, ch);
+	for (k = 0; k < FMCADC_DATA_NCHAN; ++k)
+		if (chmask & (1 << k))
+			_mm_storeu_si128((__m128i *)(dst[k] + i), ch[k]);
+}
+
+/* Convert 8 samples to float: sign-extend to 32 bits, then scale */
+static inline void fmcadc_float_vector(float *dst, __m128i v,
+				       __m128 scale, __m128 offset)
+{
+	__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+	__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+
+	_mm_storeu_ps(dst, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(lo), scale),
+				      offset));
+	_mm_storeu_ps(dst + 4, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(hi),
+						     scale), offset));
+}
+
+static void fmcadc_deinterleave_float_vector(float **dst, const int16_t *src,
+					     unsigned int i,
+					     unsigned int chmask,
+					     const struct fmcadc_scale *s)
+{
+	__m128i ch[FMCADC_DATA_NCHAN];
+	int k;
+
+	fmcadc_split_vector(src, ch);
+	for (k = 0; k < FMCADC_DATA_NCHAN; ++k)
+		if (chmask & (1 << k))
+			fmcadc_float_vector(dst[k] + i, ch[k],
+					    _mm_set1_ps(s->scale[k]),
+					    _mm_set1_ps(s->offset[k]));
+}
+
+/* Two interleaved frames: the 4 channels match the 4 float lanes */
+static void fmcadc_convert_float_vector(float *dst, const int16_t *src,
+					const struct fmcadc_scale *s)
+{
+	fmcadc_float_vector(dst, _mm_loadu_si128((const __m128i *)src),
+			    _mm_loadu_ps(s->scale), _mm_loadu_ps(s->offset));
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FMCADC_DATA_VECTOR 8
+static void fmcadc_deinterleave_vector(int16_t **dst, const int16_t *src,
+				       unsigned int i, unsigned int chmask)
+{
+	int16x8x4_t v = vld4q_s16(src); /* the load splits the channels */
+
+	if (chmask & 0x1)
+		vst1q_s16(dst[0] + i, v.val[0]);
+	if (chmask & 0x2)
+		vst1q_s16(dst[1] + i, v.val[1]);
+	if (chmask & 0x4)
+		vst1q_s16(dst[2] + i, v.val[2]);
+	if (chmask & 0x8)
+		vst1q_s16(dst[3] + i, v.val[3]);
+}
+
+/* Convert 8 samples to float: widen to 32 bits, then scale */
+static inline void fmcadc_float_vector(float *dst, int16x8_t v,
+				       float32x4_t scale, float32x4_t offset)
+{
+	float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)));
+	float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v)));
+
+	vst1q_f32(dst, vmlaq_f32(offset, lo, scale));
+	vst1q_f32(dst + 4, vmlaq_f32(offset, hi, scale));
+}
+
+static void fmcadc_deinterleave_float_vector(float **dst, const int16_t *src,
+					     unsigned int i,
+					     unsigned int chmask,
+					     const struct fmcadc_scale *s)
+{
+	int16x8x4_t v = vld4q_s16(src);
+	int k;
+
+	for (k = 0; k < FMCADC_DATA_NCHAN; ++k)
+		if (chmask & (1 << k))
+			fmcadc_float_vector(dst[k] + i, v.val[k],
+					    vdupq_n_f32(s->scale[k]),
+					    vdupq_n_f32(s->offset[k]));
+}
+
+/* Two interleaved frames: the 4 channels match the 4 float lanes */
+static void fmcadc_convert_float_vector(float *dst, const int16_t *src,
+					const struct fmcadc_scale *s)
+{
+	fmcadc_float_vector(dst, vld1q_s16(src), vld1q_f32(s->scale),
+			    vld1q_f32(s->offset));
+}
+#else
+#define FMCADC_DATA_VECTOR 0 /* scalar code only */
+#endif
+
+/*
+ * fmcadc_deinterleave
+ * @dst: one destination array for each channel
+ * @src: interleaved samples (4 channels)
+ * @nsamples: number of samples of each channel
+ * @chmask: channels to store (bit 0 is channel 0); others are ignored
+ *
+ * The destination arrays must not overlap the source, with one
+ * exception: dst[0] may be src itself, as channel 0 is never written
+ * beyond what has been already read (fmcadc_deinterleave_inplace
+ * relies on it)
+ */
+int fmcadc_deinterleave(int16_t **dst, const int16_t *src,
+			unsigned int nsamples, unsigned int chmask)
+{
+	unsigned int i = 0, j;
+	int k;
+
+	if (chmask & ~((1 << FMCADC_DATA_NCHAN) - 1)) {
+		errno = FMCADC_ENOCHAN;
+		return -1;
+	}
+#if FMCADC_DATA_VECTOR
+	for (; i + FMCADC_DATA_VECTOR <= nsamples; i += FMCADC_DATA_VECTOR)
+		fmcadc_deinterleave_vector(dst, src + i * FMCADC_DATA_NCHAN,
+					   i, chmask);
+#endif
+	/* Channel 0 last, as it may overwrite the source */
+	for (k = FMCADC_DATA_NCHAN - 1; k >= 0; --k) {
+		if (!(chmask & (1 << k)))
+			continue;
+		for (j = i; j < nsamples; ++j)
+			dst[k][j] = src[j * FMCADC_DATA_NCHAN + k];
+	}
+	return 0;
+}
+
+/*
+ * fmcadc_deinterleave_inplace
+ * @data: interleaved samples (4 channels), replaced by planar samples
+ * @nsamples: number of samples of each channel
+ *
+ * On return channel N starts at data + N * nsamples. Channels 1 to 3
+ * go through a temporary buffer.
+ */
+int fmcadc_deinterleave_inplace(int16_t *data, unsigned int nsamples)
+{
+	int16_t *dst[FMCADC_DATA_NCHAN], *tmp;
+	size_t size = nsamples * sizeof(*data);
+	int k;
+
+	tmp = malloc(size * (FMCADC_DATA_NCHAN - 1));
+	if (!tmp && nsamples) {
+		errno = ENOMEM;
+		return -1;
+	}
+	dst[0] = data;
+	for (k = 1; k < FMCADC_DATA_NCHAN; ++k)
+		dst[k] = tmp + (k - 1) * nsamples;
+	fmcadc_deinterleave(dst, data, nsamples, 0xf);
+	memcpy(data + nsamples, tmp, size * (FMCADC_DATA_NCHAN - 1));
+	free(tmp);
+	return 0;
+}
+
+/*
+ * Full scale of the input ranges, as used by chN-vref (the values are
+ * the hardware ones of the fmc-adc-100m14b4cha). An open input has no
+ * meaningful scale: we use the 1V one.
+ */
+static struct fmcadc_range {
+	uint32_t vref;
+	float volts;
+} fmcadc_ranges[] = {
+	{0x23, 0.1},
+	{0x11, 1.0},
+	{0x45, 10.0},
+	{0x00, 1.0},
+};
+
+/* Conversion of channel k, from range and offset (also for capture.c) */
+int fmcadc_scale_channel(struct fmcadc_scale *s, unsigned int k,
+			 uint32_t range, uint32_t offset)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(fmcadc_ranges); ++i)
+		if (fmcadc_ranges[i].vref == range)
+			break;
+	if (i == ARRAY_SIZE(fmcadc_ranges)) {
+		errno = EINVAL;
+		return -1;
+	}
+	/* Samples are signed: half the range is 1 << 15 */
+	s->scale[k] = fmcadc_ranges[i].volts / 2 / (1 << 15);
+	s->offset[k] = (int32_t)offset / 1000.0; /* mV */
+	return 0;
+}
+
+/*
+ * fmcadc_get_scale
+ * @dev: the device
+ * @s: where to store the conversion for each channel
+ *
+ * Read once range and user offset of each channel, to be used by the
+ * conversion functions below. It must be called again when range or
+ * offset change.
+ */
+int fmcadc_get_scale(struct fmcadc_dev *dev, struct fmcadc_scale *s)
+{
+	struct fmcadc_conf ch;
+	int k;
+
+	for (k = 0; k < FMCADC_DATA_NCHAN; ++k) {
+		memset(&ch, 0, sizeof(ch));
+		ch.type = FMCADC_CONF_TYPE_CHN;
+		ch.route_to = k;
+		fmcadc_set_conf_mask(&ch, FMCADC_CONF_CHN_RANGE);
+		fmcadc_set_conf_mask(&ch, FMCADC_CONF_CHN_OFFSET);
+		if (fmcadc_retrieve_config(dev, &ch) < 0)
+			return -1;
+		if (fmcadc_scale_channel(s, k, ch.value[FMCADC_CONF_CHN_RANGE],
+					 ch.value[FMCADC_CONF_CHN_OFFSET]) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * fmcadc_convert_float, fmcadc_convert_double
+ * @dst: destination, interleaved like the source
+ * @src: interleaved samples (4 channels)
+ * @nsamples: number of samples of each channel
+ * @s: conversion, from fmcadc_get_scale
+ *
+ * Convert raw samples to volts, keeping them interleaved.
+ */
+int fmcadc_convert_float(float *dst, const int16_t *src,
+			 unsigned int nsamples, const struct fmcadc_scale *s)
+{
+	unsigned int i = 0, n = nsamples * FMCADC_DATA_NCHAN;
+
+#if FMCADC_DATA_VECTOR
+	for (; i + FMCADC_DATA_VECTOR <= n; i += FMCADC_DATA_VECTOR)
+		fmcadc_convert_float_vector(dst + i, src + i, s);
+#endif
+	for (; i < n; ++i)
+		dst[i] = src[i] * s->scale[i % FMCADC_DATA_NCHAN] +
+			s->offset[i % FMCADC_DATA_NCHAN];
+	return 0;
+}
+
+int fmcadc_convert_double(double *dst, const int16_t *src,
+			  unsigned int nsamples, const struct fmcadc_scale *s)
+{
+	unsigned int i, n = nsamples * FMCADC_DATA_NCHAN;
+	double scale[FMCADC_DATA_NCHAN], offset[FMCADC_DATA_NCHAN];
+	int k;
+
+	/*
+	 * Plain C: with double precision a vector holds 2 samples only,
+	 * and the compiler does as well as we would do by hand
+	 */
+	for (k = 0; k < FMCADC_DATA_NCHAN; ++k) {
+		scale[k] = s->scale[k];
+		offset[k] = s->offset[k];
+	}
+	for (i = 0; i < n; i += FMCADC_DATA_NCHAN)
+		for (k = 0; k < FMCADC_DATA_NCHAN; ++k)
+			dst[i + k] = src[i + k] * scale[k] + offset[k];
+	return 0;
+}
+
+/*
+ * fmcadc_deinterleave_float, fmcadc_deinterleave_double
+ * @dst: one destination array for each channel
+ * @src: interleaved samples (4 channels)
+ * @nsamples: number of samples of each channel
+ * @chmask: channels to store (bit 0 is channel 0); others are ignored
+ * @s: conversion, from fmcadc_get_scale
+ *
+ * Like fmcadc_deinterleave, converting samples to volts on the way.
+ */
+int fmcadc_deinterleave_float(float **dst, const int16_t *src,
+			      unsigned int nsamples, unsigned int chmask,
+			      const struct fmcadc_scale *s)
+{
+	unsigned int i = 0, j;
+	int k;
+
+	if (chmask & ~((1 << FMCADC_DATA_NCHAN) - 1)) {
+		errno = FMCADC_ENOCHAN;
+		return -1;
+	}
+#if FMCADC_DATA_VECTOR
+	for (; i + FMCADC_DATA_VECTOR <= nsamples; i += FMCADC_DATA_VECTOR)
+		fmcadc_deinterleave_float_vector(dst,
+						 src + i * FMCADC_DATA_NCHAN,
+						 i, chmask, s);
+#endif
+	for (k = 0; k < FMCADC_DATA_NCHAN; ++k) {
+		if (!(chmask & (1 << k)))
+			continue;
+		for (j = i; j < nsamples; ++j)
+			dst[k][j] = src[j * FMCADC_DATA_NCHAN + k] *
+				s->scale[k] + s->offset[k];
+	}
+	return 0;
+}
+
+int fmcadc_deinterleave_double(double **dst, const int16_t *src,
+			       unsigned int nsamples, unsigned int chmask,
+			       const struct fmcadc_scale *s)
+{
+	unsigned int j;
+	double scale, offset;
+	int k;
+
+	if (chmask & ~((1 << FMCADC_DATA_NCHAN) - 1)) {
+		errno = FMCADC_ENOCHAN;
+		return -1;
+	}
+	for (k = 0; k < FMCADC_DATA_NCHAN; ++k) {
+		if (!(chmask & (1 << k)))
+			continue;
+		scale = s->scale[k];
+		offset = s->offset[k];
+		for (j = 0; j < nsamples; ++j)
+			dst[k][j] = src[j * FMCADC_DATA_NCHAN + k] * scale +
+				offset;
+	}
+	return 0;
+}
+
+/*
+ * fmcadc_deinterleave_float_shots
+ * @dst: one destination array for each channel, for all the shots
+ * @src: interleaved samples of each shot
+ * @nshots: number of shots
+ * @nsamples: number of samples of each channel in each shot
+ * @chmask: channels to store (bit 0 is channel 0); others are ignored
+ * @s: conversion, from fmcadc_get_scale
+ *
+ * Convert a multi-shot acquisition: the shots of each channel are
+ * stored one after the other in the channel array.
+ */
+int fmcadc_deinterleave_float_shots(float **dst, const int16_t **src,
+				    unsigned int nshots, unsigned int nsamples,
+				    unsigned int chmask,
+				    const struct fmcadc_scale *s)
+{
+	float *d[FMCADC_DATA_NCHAN];
+	unsigned int i;
+	int k;
+
+	for (i = 0; i < nshots; ++i) {
+		for (k = 0; k < FMCADC_DATA_NCHAN; ++k)
+			d[k] = chmask & (1 << k) ? dst[k] + i * nsamples : NULL;
+		if (fmcadc_deinterleave_float(d, src[i], nsamples, chmask, s))
+			return -1;
+	}
+	return 0;
+}
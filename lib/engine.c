@@ -0,0 +1,588 @@
+/*
+ * Acquisition engine: a thread fills buffers, the application uses them
+ *
+ * Copyright (C) 2013 CERN (www.cern.ch)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2 as published by the Free Software Foundation or, at your
+ * option, any later version.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <linux/zio-user.h>
+
+#include "fmcadc-lib.h"
+#include "fmcadc-lib-int.h"
+
+/*
+ * Buffers go around two single-producer single-consumer rings: the
+ * producer thread takes free buffers from "free", fills them and puts
+ * them in "full"; the application takes them from "full" and gives them
+ * back to "free". Each ring index is written by one side only, so no
+ * lock is needed. A side that finds its ring empty sleeps on a futex,
+ * and the other side makes the system call only if someone sleeps.
+ * The consumer says it sleeps before checking the ring for the last
+ * time, and the producer checks it after publishing an entry: one of
+ * the two always sees the other.
+ *
+ * With a callback, a second thread is the consumer: it calls the
+ * callback for each filled buffer and then gives the buffer back.
+ */
+#define FMCADC_ENGINE_POLL_US 100000 /* to check for stop while filling */
+
+struct fmcadc_ring {
+	unsigned int head;	/* written by the producer */
+	unsigned int event;	/* the futex: changes at each wake up */
+	unsigned int waiting;	/* the consumer sleeps */
+	unsigned int tail __attribute__((aligned(64))); /* by the consumer */
+	unsigned int size;	/* a power of 2 */
+	unsigned int *slot;
+};
+
+struct fmcadc_engine {
+	struct fmcadc_dev *dev;
+	struct fmcadc_buffer **buf;
+	void (*free_fn)(void *); /* to release the buffers */
+	uint64_t *t_ready;	/* when each buffer was filled */
+	unsigned int nbuf;
+	struct fmcadc_ring free, full;
+	/* Free buffers taken by the thread, kept for the next start */
+	unsigned int *own, nown;
+	pthread_t thread;
+	int started;		/* the thread must be joined */
+	/* With a callback, the application doesn't call get */
+	int (*cb)(struct fmcadc_buffer *buf, struct fmcadc_timestamp *ts,
+		  void *arg);
+	void *cb_arg;
+	pthread_t cb_thread;
+	int cb_started;		/* the callback thread must be joined */
+	int running;		/* the thread fills buffers */
+	int stop;
+	int error;		/* errno of the producer */
+	unsigned int nruns, flags;
+	uint64_t t_start, t_last;
+	struct fmcadc_engine_stats stats; /* each field has a single writer */
+};
+
+/* Counters are read by the other thread: no torn values */
+#define fmcadc_engine_add(x, n) \
+	__atomic_store_n(&(x), (x) + (n), __ATOMIC_RELAXED)
+
+static uint64_t fmcadc_engine_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int fmcadc_futex(unsigned int *addr, int op, unsigned int val,
+			struct timespec *to)
+{
+	return syscall(SYS_futex, addr, op, val, to, NULL, 0);
+}
+
+static int fmcadc_ring_init(struct fmcadc_ring *r, unsigned int n)
+{
+	for (r->size = 1; r->size < n; r->size <<= 1)
+		;
+	r->head = r->tail = r->waiting = r->event = 0;
+	r->slot = calloc(r->size, sizeof(*r->slot));
+	return r->slot ? 0 : -1;
+}
+
+/* Producer side: the ring can't be full, it is as big as all buffers */
+static void fmcadc_ring_push(struct fmcadc_ring *r, unsigned int i)
+{
+	unsigned int head = r->head;
+
+	r->slot[head & (r->size - 1)] = i;
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&r->waiting, __ATOMIC_SEQ_CST)) {
+		__atomic_add_fetch(&r->event, 1, __ATOMIC_SEQ_CST);
+		fmcadc_futex(&r->event, FUTEX_WAKE_PRIVATE, 1, NULL);
+	}
+}
+
+/* Wake the consumer of a ring, so that it checks why it waits */
+static void fmcadc_ring_wake(struct fmcadc_ring *r)
+{
+	__atomic_add_fetch(&r->event, 1, __ATOMIC_SEQ_CST);
+	fmcadc_futex(&r->event, FUTEX_WAKE_PRIVATE, INT_MAX, NULL);
+}
+
+/* Consumer side: take an entry, or return -1 if the ring is empty */
+static int fmcadc_ring_pop(struct fmcadc_ring *r)
+{
+	unsigned int tail = r->tail;
+	int i;
+
+	if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail)
+		return -1;
+	i = r->slot[tail & (r->size - 1)];
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+	return i;
+}
+
+/* Time left until "end" (CLOCK_MONOTONIC, as futex), -1 if none */
+static int fmcadc_time_left(struct timespec *end, struct timespec *left)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	left->tv_sec = end->tv_sec - now.tv_sec;
+	left->tv_nsec = end->tv_nsec - now.tv_nsec;
+	if (left->tv_nsec < 0) {
+		left->tv_sec--;
+		left->tv_nsec += 1000000000;
+	}
+	return left->tv_sec < 0 ? -1 : 0;
+}
+
+/*
+ * Consumer side: sleep until the ring is not empty, "*flag" becomes
+ * "quit", or the timeout (relative, NULL is forever) expires. Return
+ * the entry, or -1 with ENODATA (quit) or EAGAIN (timeout). Wake-ups
+ * for other reasons don't restart the timeout.
+ */
+static int fmcadc_ring_pop_wait(struct fmcadc_ring *r, int *flag, int quit,
+				struct timespec *to)
+{
+	struct timespec end, left;
+	unsigned int event;
+	int i, err;
+
+	if (to) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		end.tv_sec += to->tv_sec;
+		end.tv_nsec += to->tv_nsec;
+		if (end.tv_nsec >= 1000000000) {
+			end.tv_sec++;
+			end.tv_nsec -= 1000000000;
+		}
+	}
+	for (;;) {
+		i = fmcadc_ring_pop(r);
+		if (i >= 0)
+			return i;
+		if (__atomic_load_n(flag, __ATOMIC_SEQ_CST) == quit) {
+			errno = ENODATA;
+			return -1;
+		}
+		__atomic_store_n(&r->waiting, 1, __ATOMIC_SEQ_CST);
+		event = __atomic_load_n(&r->event, __ATOMIC_SEQ_CST);
+		err = 0;
+		if (to && fmcadc_time_left(&end, &left) < 0)
+			err = ETIMEDOUT;
+		else if (__atomic_load_n(&r->head, __ATOMIC_SEQ_CST) == r->tail &&
+			 __atomic_load_n(flag, __ATOMIC_SEQ_CST) != quit &&
+			 fmcadc_futex(&r->event, FUTEX_WAIT_PRIVATE, event,
+				      to ? &left : NULL) < 0)
+			err = errno;
+		__atomic_store_n(&r->waiting, 0, __ATOMIC_SEQ_CST);
+		if (err == ETIMEDOUT) {
+			i = fmcadc_ring_pop(r);
+			if (i >= 0)
+				return i;
+			errno = EAGAIN;
+			return -1;
+		}
+	}
+}
+
+/* Producer: stop the thread, with an error if not stopped by the user */
+static void *fmcadc_engine_exit(struct fmcadc_engine *e, int err)
+{
+	if (!__atomic_load_n(&e->stop, __ATOMIC_ACQUIRE))
+		e->error = err;
+	__atomic_store_n(&e->running, 0, __ATOMIC_SEQ_CST);
+	fmcadc_ring_wake(&e->full);
+	return NULL;
+}
+
+static void *fmcadc_engine_thread(void *arg)
+{
+	struct fmcadc_engine *e = arg;
+	struct fmcadc_buffer *fill[e->nbuf];
+	unsigned int *own = e->own;
+	unsigned int run, shot, nshots, flags = e->flags, k;
+	struct timeval to;
+	struct fmcadc_conf acq;
+	uint64_t now;
+	int i, n;
+
+	memset(&acq, 0, sizeof(acq));
+	acq.type = FMCADC_CONF_TYPE_ACQ;
+	fmcadc_set_conf_mask(&acq, FMCADC_CONF_ACQ_N_SHOTS);
+	if (fmcadc_retrieve_config(e->dev, &acq) < 0)
+		return fmcadc_engine_exit(e, errno);
+	nshots = acq.value[FMCADC_CONF_ACQ_N_SHOTS];
+
+	for (run = 0; !e->nruns || run < e->nruns; run++) {
+		to.tv_sec = to.tv_usec = 0;
+		if (fmcadc_acq_start(e->dev, flags, &to) < 0)
+			return fmcadc_engine_exit(e, errno);
+		flags = 0; /* flush only before the first run */
+		fmcadc_engine_add(e->stats.runs, 1);
+
+		for (shot = 0; shot < nshots; shot += n) {
+			/* Get all the free buffers, waiting for the first */
+			while (e->nown < e->nbuf && e->nown < nshots - shot) {
+				i = fmcadc_ring_pop(&e->free);
+				if (i < 0 && !e->nown) {
+					fmcadc_engine_add(e->stats.starved, 1);
+					i = fmcadc_ring_pop_wait(&e->free,
+								 &e->stop, 1,
+								 NULL);
+				}
+				if (i < 0)
+					break;
+				own[e->nown++] = i;
+			}
+			if (__atomic_load_n(&e->stop, __ATOMIC_ACQUIRE))
+				return fmcadc_engine_exit(e, 0);
+
+			for (k = 0; k < e->nown && k < nshots - shot; k++)
+				fill[k] = e->buf[own[k]];
+			to.tv_sec = 0;
+			to.tv_usec = FMCADC_ENGINE_POLL_US;
+			n = fmcadc_fill_buffers(e->dev, fill, k, 0, &to);
+			if (n < 0) {
+				n = 0;
+				if (__atomic_load_n(&e->stop, __ATOMIC_ACQUIRE))
+					return fmcadc_engine_exit(e, 0);
+				if (errno == EAGAIN)
+					continue; /* nothing yet */
+				return fmcadc_engine_exit(e, errno);
+			}
+
+			now = fmcadc_engine_ns();
+			for (k = 0; k < n; k++) {
+				fmcadc_engine_add(e->stats.bytes,
+						  (uint64_t)fill[k]->samplesize *
+						  fill[k]->nsamples);
+				e->t_ready[own[k]] = now;
+				fmcadc_ring_push(&e->full, own[k]);
+			}
+			e->nown -= n;
+			memmove(own, own + n, e->nown * sizeof(*own));
+			fmcadc_engine_add(e->stats.shots, n);
+			__atomic_store_n(&e->t_last, now, __ATOMIC_RELAXED);
+		}
+	}
+	return fmcadc_engine_exit(e, 0);
+}
+
+/*
+ * fmcadc_engine_create
+ * @dev: the device, already configured
+ * @nbuf: how many buffers go around
+ * @nsamples: samples of each buffer (pre + post samples)
+ *
+ * Buffers are filled several at a time and given to the application
+ * later, so they need their own data: if the device maps its data (that
+ * is only valid until the next fill), they are requested with malloc
+ * and the samples are copied.
+ */
+struct fmcadc_engine *fmcadc_engine_create(struct fmcadc_dev *dev,
+					   unsigned int nbuf,
+					   unsigned int nsamples)
+{
+	struct fmcadc_buffer *buf;
+	struct fmcadc_engine *e;
+	unsigned int i;
+
+	if (!nbuf || !nsamples) {
+		errno = EINVAL;
+		return NULL;
+	}
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return NULL;
+	e->dev = dev;
+	e->buf = calloc(nbuf, sizeof(*e->buf));
+	e->t_ready = calloc(nbuf, sizeof(*e->t_ready));
+	e->own = calloc(nbuf, sizeof(*e->own));
+	if (!e->buf || !e->t_ready || !e->own ||
+	    fmcadc_ring_init(&e->free, nbuf) < 0 ||
+	    fmcadc_ring_init(&e->full, nbuf) < 0)
+		goto out_free;
+	for (e->nbuf = 0; e->nbuf < nbuf;) {
+		buf = fmcadc_request_buffer(dev, nsamples,
+					    e->free_fn ? malloc : NULL, 0);
+		if (!buf)
+			goto out_free;
+		if (!e->free_fn && buf->flags & FMCADC_FLAG_MMAP) {
+			/* Mapped: request it again, with data of its own */
+			fmcadc_release_buffer(dev, buf, NULL);
+			e->free_fn = free;
+			continue;
+		}
+		e->buf[e->nbuf++] = buf;
+	}
+	for (i = 0; i < nbuf; i++)
+		fmcadc_ring_push(&e->free, i);
+	return e;
+
+out_free:
+	for (i = 0; i < e->nbuf; i++)
+		fmcadc_release_buffer(dev, e->buf[i], e->free_fn);
+	free(e->free.slot);
+	free(e->full.slot);
+	free(e->own);
+	free(e->t_ready);
+	free(e->buf);
+	free(e);
+	return NULL;
+}
+
+/*
+ * Consumer: the next filled buffer, in acquisition order. At the end of
+ * the runs, or after a stop, it fails with ENODATA; if the producer
+ * failed, with its error.
+ */
+static int fmcadc_engine_next(struct fmcadc_engine *e, struct timespec *to)
+{
+	uint64_t lat;
+	int i;
+
+	i = fmcadc_ring_pop_wait(&e->full, &e->running, 0, to);
+	if (i < 0 && errno == ENODATA) {
+		/* The producer stops after its last push: check again */
+		i = fmcadc_ring_pop(&e->full);
+		if (i < 0)
+			errno = e->error ? e->error : ENODATA;
+	}
+	if (i < 0)
+		return -1;
+
+	lat = fmcadc_engine_ns() - e->t_ready[i];
+	fmcadc_engine_add(e->stats.consumed, 1);
+	fmcadc_engine_add(e->stats.latency_sum, lat);
+	if (lat > e->stats.latency_max)
+		__atomic_store_n(&e->stats.latency_max, lat, __ATOMIC_RELAXED);
+	return i;
+}
+
+/* Consumer with a callback: the buffer is reused when it returns */
+static void *fmcadc_engine_cb_thread(void *arg)
+{
+	struct fmcadc_engine *e = arg;
+	struct fmcadc_timestamp ts;
+	struct fmcadc_buffer *buf;
+	int i, err;
+
+	while ((i = fmcadc_engine_next(e, NULL)) >= 0) {
+		buf = e->buf[i];
+		fmcadc_tstamp_buffer(buf, &ts);
+		err = e->cb(buf, &ts, e->cb_arg);
+		fmcadc_ring_push(&e->free, i);
+		if (err) {
+			/* Like fmcadc_engine_stop, but we can't join */
+			__atomic_store_n(&e->stop, 1, __ATOMIC_SEQ_CST);
+			fmcadc_ring_wake(&e->free);
+			/* Buffers filled meanwhile go back unseen */
+			while ((i = fmcadc_engine_next(e, NULL)) >= 0)
+				fmcadc_ring_push(&e->free, i);
+			errno = ECANCELED;
+			break;
+		}
+	}
+	/* The last call tells why it's over */
+	e->cb(NULL, NULL, e->cb_arg);
+	return NULL;
+}
+
+/* Wait for the threads of the previous start, that are over or stopped */
+static void fmcadc_engine_join(struct fmcadc_engine *e)
+{
+	if (e->started)
+		pthread_join(e->thread, NULL);
+	if (e->cb_started)
+		pthread_join(e->cb_thread, NULL);
+	e->started = e->cb_started = 0;
+}
+
+/*
+ * fmcadc_engine_start
+ * @e: the engine
+ * @nruns: acquisitions of N_SHOTS shots to run, 0 until stopped
+ * @flags: for the first fmcadc_acq_start (e.g. FMCADC_F_FLUSH)
+ */
+int fmcadc_engine_start(struct fmcadc_engine *e, unsigned int nruns,
+			unsigned int flags)
+{
+	int err;
+
+	if (__atomic_load_n(&e->running, __ATOMIC_ACQUIRE)) {
+		errno = EBUSY;
+		return -1;
+	}
+	fmcadc_engine_join(e); /* the previous runs are over */
+	e->nruns = nruns;
+	e->flags = flags;
+	e->stop = 0;
+	e->error = 0;
+	e->t_start = e->t_last = fmcadc_engine_ns();
+	e->running = 1;
+	err = pthread_create(&e->thread, NULL, fmcadc_engine_thread, e);
+	if (err) {
+		e->running = 0;
+		errno = err;
+		return -1;
+	}
+	e->started = 1;
+	if (!e->cb)
+		return 0;
+	err = pthread_create(&e->cb_thread, NULL, fmcadc_engine_cb_thread, e);
+	if (err) {
+		fmcadc_engine_stop(e);
+		errno = err;
+		return -1;
+	}
+	e->cb_started = 1;
+	return 0;
+}
+
+/*
+ * fmcadc_engine_set_callback
+ * @e: the engine, not running
+ * @cb: called for each buffer, NULL to use fmcadc_engine_get again
+ * @arg: passed to the callback
+ *
+ * The callback is called from a thread of the engine, in acquisition
+ * order; the buffer is filled again after it returns. A non-zero return
+ * value stops the engine. The last call has a NULL buffer, and errno
+ * tells why the runs are over (ENODATA, ECANCELED or the error).
+ */
+int fmcadc_engine_set_callback(struct fmcadc_engine *e,
+			       int (*cb)(struct fmcadc_buffer *buf,
+					 struct fmcadc_timestamp *ts,
+					 void *arg),
+			       void *arg)
+{
+	if (__atomic_load_n(&e->running, __ATOMIC_ACQUIRE)) {
+		errno = EBUSY;
+		return -1;
+	}
+	fmcadc_engine_join(e); /* the last buffers may be in the callback */
+	e->cb = cb;
+	e->cb_arg = arg;
+	return 0;
+}
+
+/*
+ * fmcadc_engine_get
+ * @e: the engine
+ * @timeout: NULL to wait forever
+ *
+ * Return the next filled buffer, see fmcadc_engine_next. It fails with
+ * EBUSY if the engine has a callback.
+ */
+struct fmcadc_buffer *fmcadc_engine_get(struct fmcadc_engine *e,
+					struct timeval *timeout)
+{
+	struct timespec ts, *to = NULL;
+	int i;
+
+	if (e->cb) {
+		errno = EBUSY;
+		return NULL;
+	}
+	if (timeout) {
+		ts.tv_sec = timeout->tv_sec;
+		ts.tv_nsec = timeout->tv_usec * 1000;
+		to = &ts;
+	}
+	i = fmcadc_engine_next(e, to);
+	return i < 0 ? NULL : e->buf[i];
+}
+
+/* Give a buffer back, to be filled again */
+int fmcadc_engine_put(struct fmcadc_engine *e, struct fmcadc_buffer *buf)
+{
+	unsigned int i;
+
+	if (e->cb) {
+		errno = EBUSY; /* the callback thread gives buffers back */
+		return -1;
+	}
+	for (i = 0; i < e->nbuf; i++) {
+		if (e->buf[i] == buf) {
+			fmcadc_ring_push(&e->free, i);
+			return 0;
+		}
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+/*
+ * Stop the producer, then the acquisition: the producer notices within
+ * FMCADC_ENGINE_POLL_US, and it is gone before the acquisition stops, so
+ * it never reads a stopped device. Other threads may still configure the
+ * device meanwhile (a software trigger, for example): configuration calls
+ * are serialized by the library (see config-zio.c). Buffers already
+ * filled can still be taken with fmcadc_engine_get, or are passed to the
+ * callback before this returns. It must not be called by the callback.
+ */
+int fmcadc_engine_stop(struct fmcadc_engine *e)
+{
+	if (!e->started && !e->cb_started)
+		return 0;
+	__atomic_store_n(&e->stop, 1, __ATOMIC_SEQ_CST);
+	fmcadc_ring_wake(&e->free);
+	fmcadc_engine_join(e);
+	return fmcadc_acq_stop(e->dev, 0);
+}
+
+int fmcadc_engine_stats(struct fmcadc_engine *e,
+			struct fmcadc_engine_stats *st)
+{
+	uint64_t t;
+
+	st->shots = __atomic_load_n(&e->stats.shots, __ATOMIC_RELAXED);
+	st->bytes = __atomic_load_n(&e->stats.bytes, __ATOMIC_RELAXED);
+	st->runs = __atomic_load_n(&e->stats.runs, __ATOMIC_RELAXED);
+	st->starved = __atomic_load_n(&e->stats.starved, __ATOMIC_RELAXED);
+	st->consumed = __atomic_load_n(&e->stats.consumed, __ATOMIC_RELAXED);
+	st->latency_sum = __atomic_load_n(&e->stats.latency_sum,
+					  __ATOMIC_RELAXED);
+	st->latency_max = __atomic_load_n(&e->stats.latency_max,
+					  __ATOMIC_RELAXED);
+	st->latency_avg = st->consumed ? st->latency_sum / st->consumed : 0;
+	t = __atomic_load_n(&e->t_last, __ATOMIC_RELAXED) - e->t_start;
+	st->seconds = t / 1e9;
+	st->rate = t ? st->shots / st->seconds : 0;
+	st->mbps = t ? st->bytes / st->seconds / 1e6 : 0;
+	return 0;
+}
+
+/* Stop the engine if needed, and release all buffers */
+int fmcadc_engine_destroy(struct fmcadc_engine *e)
+{
+	unsigned int i;
+	int err;
+
+	err = fmcadc_engine_stop(e);
+	for (i = 0; i < e->nbuf; i++)
+		fmcadc_release_buffer(e->dev, e->buf[i], e->free_fn);
+	free(e->free.slot);
+	free(e->full.slot);
+	free(e->own);
+	free(e->t_ready);
+	free(e->buf);
+	free(e);
+	return err;
+}
@@ -81,10 +81,11 @@ struct fmcadc_dev *fmcadc_zio_open(const struct fmcadc_board_type *b,
 	fa->sysbase = syspath;
 	fa->devbase = devpath;
 	fa->cset = 0;
+	pthread_mutex_init(&fa->lock, NULL);
 
 	/* Open char devices */
 	sprintf(fname, "%s-0-i-ctrl", fa->devbase);
-	fa->fdc = open(fname, O_RDONLY);
+	fa->fdc = open(fname, O_RDONLY | O_NONBLOCK); /* we poll before reading */
 	sprintf(fname, "%s-0-i-data", fa->devbase);
 	fa->fdd = open(fname, O_RDONLY);
 	if (fa->fdc < 0 || fa->fdd < 0)
@@ -106,6 +107,11 @@ struct fmcadc_dev *fmcadc_zio_open(const struct fmcadc_board_type *b,
 	/* Support verbose operation (turn user flag into internal flag)*/
 	if (flags & FMCADC_F_VERBOSE || getenv("LIB_FMCADC_VERBOSE"))
 		fa->flags |= FMCADC_FLAG_VERBOSE;
+	if (flags & FMCADC_F_HUGETLB || getenv("LIB_FMCADC_HUGETLB"))
+		fa->flags |= FMCADC_FLAG_HUGETLB;
+
+	/* With a vmalloc buffer, map its whole data area once */
+	fmcadc_zio_map_data(fa);
 
 	return (void *) &fa->gid;
 
@@ -114,6 +120,7 @@ out_fa_open:
 		close(fa->fdc);
 	if (fa->fdd >= 0)
 		close(fa->fdd);
+	pthread_mutex_destroy(&fa->lock);
 	free(fa);
 out_fa_alloc:
 	free(devpath);
@@ -127,14 +134,24 @@ int fmcadc_zio_close(struct fmcadc_dev *dev)
 {
 	struct __fmcadc_dev_zio *fa = to_dev_zio(dev);
 
+	fmcadc_zio_unmap_data(fa);
+	fmcadc_zio_sysfs_close(fa);
+	fmcadc_pool_destroy(fa->pool);
 	close(fa->fdc);
 	close(fa->fdd);
 	free(fa->sysbase);
 	free(fa->devbase);
+	pthread_mutex_destroy(&fa->lock);
 	free(fa);
 	return 0;
 }
 
+/* The control device is readable when a block is there, like for poll */
+int fmcadc_zio_get_fd(struct fmcadc_dev *dev)
+{
+	return to_dev_zio(dev)->fdc;
+}
+
 /* poll is used by start, so it's defined first */
 int fmcadc_zio_acq_poll(struct fmcadc_dev *dev,
 			unsigned int flags, struct timeval *to)
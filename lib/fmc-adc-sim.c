@@ -0,0 +1,948 @@
+/*
+ * Simulated ADC board: the whole library without the hardware. The
+ * replay board is the same, but its blocks come from a recording
+ *
+ * Copyright (C) 2013 CERN (www.cern.ch)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2 as published by the Free Software Foundation or, at your
+ * option, any later version.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
+
+#include <linux/zio-user.h>
+#include <fmc-adc-100m14b4cha.h>
+
+#include "fmcadc-lib.h"
+#include "fmcadc-lib-int.h"
+
+/*
+ * The simulator triggers "sim/trigger-rate" times per second and a block
+ * is ready "sim/latency-us" after its trigger, like after DMA and
+ * interrupt. At most "nbuffer" blocks (the argument of fmcadc_open) are
+ * stored: later triggers are lost, like with a full ZIO buffer. With a
+ * rate of 0 the shots are triggered as soon as there is room for them. Nothing
+ * runs in the background: the state is computed from the clock when the
+ * library is called.
+ *
+ * The replay board serves the blocks of a recording (see replay.c), as
+ * fast as requested or at "replay/speed" percent of the original pace.
+ *
+ * For fmcadc_get_fd, a timerfd stands for the control device: it is
+ * armed for the time the next block is ready, whenever the state changes.
+ */
+#define FMCADC_SIM_NCHAN 4
+#define FMCADC_SIM_SAMPLE_NS 10 /* 100MS/s */
+#define FMCADC_SIM_TABLE 4096 /* samples for each channel, power of 2 */
+#define FMCADC_SIM_MSHOT_MAX 2048
+
+enum fmcadc_sim_waveform {
+	FMCADC_SIM_SINE = 0,	/* a sine for each channel, with noise */
+	FMCADC_SIM_RAMP,	/* a 16-bit counter over interleaved samples */
+};
+
+struct __fmcadc_dev_sim {
+	uint32_t dev_id;
+	unsigned long flags;
+	uint32_t trg[__FMCADC_CONF_TRG_ATTRIBUTE_LAST_INDEX];
+	uint32_t acq[__FMCADC_CONF_ACQ_ATTRIBUTE_LAST_INDEX];
+	uint32_t chn[FMCADC_SIM_NCHAN][__FMCADC_CONF_CHN_ATTRIBUTE_LAST_INDEX];
+	/* parameters (see fmcadc_sim_params) */
+	uint32_t rate;
+	uint32_t latency_us;
+	uint32_t waveform;
+	uint32_t lost;
+	uint32_t sw_trg_enable;
+	uint32_t mshot_max;
+	char buffer_type[16];
+	uint32_t speed;
+	uint32_t loop;
+	uint32_t n_blocks;
+	/* board time: UTC when the monotonic clock was utc_mono */
+	uint64_t utc_ns;
+	uint64_t utc_mono;
+	/* current acquisition, programmed at start like the hardware does */
+	unsigned int n_shots;	/* truncated by stop */
+	unsigned int nsamples;	/* pre + post */
+	unsigned int presamples;
+	uint64_t t_trg;		/* monotonic time of shot 0 */
+	uint64_t period;	/* ns between triggers, 0 for all at once */
+	uint64_t shot_ns;	/* duration of a shot */
+	uint64_t t_start;	/* board time of the start */
+	uint32_t seq;		/* sequence number of shot 0 */
+	uint64_t sample;	/* sample number of shot 0 */
+	/* the ZIO buffer: list of stored shots, when nbuffer is not 0 */
+	unsigned int nbuffer;
+	unsigned int *stored;
+	unsigned int n_stored;
+	unsigned int first;	/* in the list */
+	unsigned int next;	/* next shot to store */
+	int16_t *table;		/* FMCADC_SIM_TABLE interleaved samples */
+	struct fmcadc_replay *rec; /* replay only */
+	uint64_t pos;		/* block of shot 0, counting the loops */
+	int fd;			/* timerfd, created by get_fd */
+	struct fmcadc_pool *pool; /* released buffers, see pool.c */
+	struct fmcadc_conf_stats conf_stats;
+	/* Mandatory field */
+	struct fmcadc_gid gid;
+};
+#define to_dev_sim(dev) (container_of(dev, struct __fmcadc_dev_sim, gid))
+
+/* Integer parameters, for get_param and set_param */
+static struct fmcadc_sim_param {
+	char *name;
+	size_t offset;
+	int writable;
+} fmcadc_sim_params[] = {
+	{"sim/trigger-rate", offsetof(struct __fmcadc_dev_sim, rate), 1},
+	{"sim/latency-us", offsetof(struct __fmcadc_dev_sim, latency_us), 1},
+	{"sim/waveform", offsetof(struct __fmcadc_dev_sim, waveform), 1},
+	{"sim/lost-blocks", offsetof(struct __fmcadc_dev_sim, lost), 0},
+	{"cset0/trigger/sw-trg-enable",
+	 offsetof(struct __fmcadc_dev_sim, sw_trg_enable), 1},
+	{"cset0/max-sample-mshot",
+	 offsetof(struct __fmcadc_dev_sim, mshot_max), 0},
+	{"replay/speed", offsetof(struct __fmcadc_dev_sim, speed), 1},
+	{"replay/loop", offsetof(struct __fmcadc_dev_sim, loop), 1},
+	{"replay/blocks", offsetof(struct __fmcadc_dev_sim, n_blocks), 0},
+};
+
+static uint64_t fmcadc_sim_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t fmcadc_sim_utc(struct __fmcadc_dev_sim *fa, uint64_t mono)
+{
+	return fa->utc_ns + (mono - fa->utc_mono);
+}
+
+/* Sine of 2*pi*x, for x in [0, 1): we don't want libm in the users */
+static double fmcadc_sim_sin(double x)
+{
+	double sign = 1, x2;
+
+	if (x >= 0.5) {
+		x -= 0.5;
+		sign = -1;
+	}
+	if (x > 0.25)
+		x = 0.5 - x;
+	x *= 2 * 3.14159265358979323846;
+	x2 = x * x;
+	return sign * x * (1 - x2 / 6 * (1 - x2 / 20 * (1 - x2 / 42 *
+							   (1 - x2 / 72))));
+}
+
+/* One period of a different sine on each channel, plus some noise */
+static void fmcadc_sim_fill_table(struct __fmcadc_dev_sim *fa)
+{
+	uint32_t rnd = fa->dev_id + 1;
+	int i, ch;
+
+	for (i = 0; i < FMCADC_SIM_TABLE; ++i) {
+		for (ch = 0; ch < FMCADC_SIM_NCHAN; ++ch) {
+			rnd = rnd * 1103515245 + 12345;
+			fa->table[i * FMCADC_SIM_NCHAN + ch] = 25000 *
+				fmcadc_sim_sin((double)(i * (ch + 1) %
+					FMCADC_SIM_TABLE) / FMCADC_SIM_TABLE)
+				+ (int)((rnd >> 16) & 0xf) - 8;
+		}
+	}
+}
+
+struct fmcadc_dev *fmcadc_sim_open(const struct fmcadc_board_type *b,
+				   unsigned int dev_id,
+				   unsigned long totalsamples,
+				   unsigned int nbuffer,
+				   unsigned long flags)
+{
+	struct __fmcadc_dev_sim *fa;
+	int ch;
+
+	fa = calloc(1, sizeof(*fa));
+	if (!fa)
+		return NULL;
+	fa->table = malloc(FMCADC_SIM_TABLE * FMCADC_SIM_NCHAN *
+			   sizeof(*fa->table));
+	fa->nbuffer = nbuffer;
+	if (nbuffer)
+		fa->stored = malloc(nbuffer * sizeof(*fa->stored));
+	if (!fa->table || (nbuffer && !fa->stored)) {
+		free(fa->table);
+		free(fa->stored);
+		free(fa);
+		errno = ENOMEM;
+		return NULL;
+	}
+	fa->dev_id = dev_id;
+	fa->fd = -1;
+	fa->gid.board = b;
+	if (flags & FMCADC_F_VERBOSE || getenv("LIB_FMCADC_VERBOSE"))
+		fa->flags |= FMCADC_FLAG_VERBOSE;
+	if (flags & FMCADC_F_HUGETLB || getenv("LIB_FMCADC_HUGETLB"))
+		fa->flags |= FMCADC_FLAG_HUGETLB;
+
+	/* Same defaults as the driver, 1V range */
+	fa->acq[FMCADC_CONF_ACQ_N_SHOTS] = 1;
+	fa->acq[FMCADC_CONF_ACQ_POST_SAMP] = 1000;
+	fa->acq[FMCADC_CONF_ACQ_DECIMATION] = 1;
+	fa->acq[FMCADC_CONF_ACQ_FREQ_HZ] = 1000000000 / FMCADC_SIM_SAMPLE_NS;
+	fa->acq[FMCADC_CONF_ACQ_N_BITS] = 14;
+	for (ch = 0; ch < FMCADC_SIM_NCHAN; ++ch)
+		fa->chn[ch][FMCADC_CONF_CHN_RANGE] = 0x11;
+
+	fa->rate = 1000;
+	fa->mshot_max = FMCADC_SIM_MSHOT_MAX;
+	strcpy(fa->buffer_type, "kmalloc");
+	fa->utc_mono = fmcadc_sim_ns(CLOCK_MONOTONIC);
+	fa->utc_ns = fmcadc_sim_ns(CLOCK_REALTIME);
+	fmcadc_sim_fill_table(fa);
+
+	return (void *) &fa->gid;
+}
+
+int fmcadc_sim_close(struct fmcadc_dev *dev)
+{
+	struct __fmcadc_dev_sim *fa = to_dev_sim(dev);
+
+	if (fa->rec)
+		fmcadc_replay_free(fa->rec);
+	if (fa->fd >= 0)
+		close(fa->fd);
+	fmcadc_pool_destroy(fa->pool);
+	free(fa->stored);
+	free(fa->table);
+	free(fa);
+	return 0;
+}
+
+/* The configuration of the replay board is the one of the recording */
+static void fmcadc_replay_get_conf(struct __fmcadc_dev_sim *fa,
+				   struct zio_control *ctrl)
+{
+	struct zio_ctrl_attr *cattr = &ctrl->attr_channel;
+	struct zio_ctrl_attr *tattr = &ctrl->attr_trigger;
+	int ch;
+
+	fa->acq[FMCADC_CONF_ACQ_N_SHOTS] = fa->rec->n;
+	fa->acq[FMCADC_CONF_ACQ_PRE_SAMP] =
+		tattr->std_val[ZIO_ATTR_TRIG_PRE_SAMP];
+	fa->acq[FMCADC_CONF_ACQ_POST_SAMP] =
+		tattr->std_val[ZIO_ATTR_TRIG_POST_SAMP];
+	fa->acq[FMCADC_CONF_ACQ_DECIMATION] =
+		cattr->ext_val[FA100M14B4C_DATTR_DECI];
+	for (ch = 0; ch < FMCADC_SIM_NCHAN; ++ch) {
+		fa->chn[ch][FMCADC_CONF_CHN_OFFSET] =
+			cattr->ext_val[FA100M14B4C_DATTR_CH0_OFFSET + ch];
+		fa->chn[ch][FMCADC_CONF_CHN_RANGE] =
+			cattr->ext_val[FA100M14B4C_DATTR_CH0_VREF + ch];
+		fa->chn[ch][FMCADC_CONF_CHN_TERMINATION] =
+			cattr->ext_val[FA100M14B4C_DATTR_CH0_50TERM + ch];
+	}
+	fa->trg[FMCADC_CONF_TRG_SOURCE] = tattr->ext_val[FA100M14B4C_TATTR_EXT];
+	fa->trg[FMCADC_CONF_TRG_POLARITY] =
+		tattr->ext_val[FA100M14B4C_TATTR_POL];
+	fa->trg[FMCADC_CONF_TRG_SOURCE_CHAN] =
+		tattr->ext_val[FA100M14B4C_TATTR_INT_CHAN];
+	fa->trg[FMCADC_CONF_TRG_THRESHOLD] =
+		tattr->ext_val[FA100M14B4C_TATTR_INT_THRES];
+	fa->trg[FMCADC_CONF_TRG_DELAY] = tattr->ext_val[FA100M14B4C_TATTR_DELAY];
+}
+
+/* The recording is named by the environment: open has no room for it */
+struct fmcadc_dev *fmcadc_replay_open(const struct fmcadc_board_type *b,
+				      unsigned int dev_id,
+				      unsigned long totalsamples,
+				      unsigned int nbuffer,
+				      unsigned long flags)
+{
+	struct fmcadc_dev *dev;
+	struct __fmcadc_dev_sim *fa;
+	char *name = getenv("LIB_FMCADC_REPLAY");
+
+	if (!name) {
+		errno = EINVAL;
+		return NULL;
+	}
+	dev = fmcadc_sim_open(b, dev_id, totalsamples, nbuffer, flags);
+	if (!dev)
+		return NULL;
+	fa = to_dev_sim(dev);
+	fa->rec = fmcadc_replay_load(name);
+	if (!fa->rec) {
+		if (fa->flags & FMCADC_FLAG_VERBOSE)
+			fprintf(stderr, "%s: %s: %s\n", __func__, name,
+				strerror(errno));
+		fmcadc_sim_close(dev);
+		return NULL;
+	}
+	fa->n_blocks = fa->rec->n;
+	fa->rate = 0;
+	fmcadc_replay_get_conf(fa, fa->rec->blk[0].ctrl);
+	return dev;
+}
+
+/* Time of block j of the recording, counting the loops */
+static uint64_t fmcadc_replay_time(struct fmcadc_replay *r, uint64_t j)
+{
+	return (j / r->n) * r->duration + r->blk[j % r->n].t;
+}
+
+/* Monotonic time of the trigger of shot n */
+static uint64_t fmcadc_sim_shot_time(struct __fmcadc_dev_sim *fa,
+				     unsigned int n)
+{
+	uint64_t t;
+
+	if (!fa->rec)
+		return fa->t_trg + n * fa->period;
+	if (!fa->speed)
+		return fa->t_trg;
+	t = fmcadc_replay_time(fa->rec, fa->pos + n) -
+		fmcadc_replay_time(fa->rec, fa->pos);
+	return fa->t_trg + t * 100 / fa->speed;
+}
+
+/* Number of shots triggered up to the monotonic time t */
+static unsigned int fmcadc_sim_triggered(struct __fmcadc_dev_sim *fa,
+					 uint64_t t)
+{
+	uint64_t n;
+
+	if (t < fa->t_trg)
+		return 0;
+	if (fa->rec && fa->speed) {
+		/* Shots before "next" are surely triggered */
+		for (n = fa->next; n < fa->n_shots; n++)
+			if (fmcadc_sim_shot_time(fa, n) > t)
+				break;
+		return n;
+	}
+	if (!fa->period)
+		return fa->n_shots; /* and replay at full speed */
+	n = (t - fa->t_trg) / fa->period + 1;
+	return n < fa->n_shots ? n : fa->n_shots;
+}
+
+/* Move the blocks that are ready into the buffer, or lose them */
+static void fmcadc_sim_store(struct __fmcadc_dev_sim *fa, uint64_t now)
+{
+	uint64_t latency = fa->latency_us * 1000ULL;
+	unsigned int ready;
+
+	ready = now < latency ? 0 : fmcadc_sim_triggered(fa, now - latency);
+	for (; fa->next < ready; fa->next++) {
+		if (!fa->nbuffer) {
+			fa->n_stored++;
+			continue;
+		}
+		if (fa->n_stored == fa->nbuffer) {
+			/* Unpaced: the next trigger waits for room */
+			if (!fa->period && (!fa->rec || !fa->speed))
+				break;
+			fa->lost++;
+			continue;
+		}
+		fa->stored[(fa->first + fa->n_stored) % fa->nbuffer] = fa->next;
+		fa->n_stored++;
+	}
+}
+
+/* Make the timerfd readable when a block is (or will be) stored */
+static void fmcadc_sim_update_fd(struct __fmcadc_dev_sim *fa)
+{
+	struct itimerspec its;
+	uint64_t ready;
+
+	if (fa->fd < 0)
+		return;
+	memset(&its, 0, sizeof(its));
+	if (fa->n_stored) {
+		its.it_value.tv_nsec = 1; /* in the past: expired already */
+	} else if (fa->next < fa->n_shots) {
+		ready = fmcadc_sim_shot_time(fa, fa->next) +
+			fa->latency_us * 1000ULL;
+		its.it_value.tv_sec = ready / 1000000000;
+		its.it_value.tv_nsec = ready % 1000000000;
+	}
+	/* Setting the timer clears the expirations, if any */
+	timerfd_settime(fa->fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* Wait for a stored block, as poll() on the control device does */
+static int fmcadc_sim_wait(struct __fmcadc_dev_sim *fa, struct timeval *to)
+{
+	uint64_t now, ready, end = 0;
+	struct timespec ts;
+
+	now = fmcadc_sim_ns(CLOCK_MONOTONIC);
+	if (to)
+		end = now + to->tv_sec * 1000000000ULL + to->tv_usec * 1000;
+	fmcadc_sim_store(fa, now);
+	if (fa->n_stored)
+		return 0;
+
+	/* Nothing will come with no timeout: don't sleep forever */
+	if (fa->next >= fa->n_shots && !to) {
+		errno = EAGAIN;
+		return -1;
+	}
+	ready = fmcadc_sim_shot_time(fa, fa->next) + fa->latency_us * 1000ULL;
+	if (fa->next >= fa->n_shots || (to && end < ready))
+		ready = end;
+	ts.tv_sec = ready / 1000000000;
+	ts.tv_nsec = ready % 1000000000;
+	errno = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	if (errno)
+		return -1;
+
+	fmcadc_sim_store(fa, fmcadc_sim_ns(CLOCK_MONOTONIC));
+	if (fa->n_stored)
+		return 0;
+	fmcadc_sim_update_fd(fa);
+	errno = EAGAIN;
+	return -1;
+}
+
+int fmcadc_sim_acq_poll(struct fmcadc_dev *dev, unsigned int flags,
+			struct timeval *timeout)
+{
+	return fmcadc_sim_wait(to_dev_sim(dev), timeout);
+}
+
+int fmcadc_sim_acq_start(struct fmcadc_dev *dev,
+			 unsigned int flags, struct timeval *timeout)
+{
+	struct __fmcadc_dev_sim *fa = to_dev_sim(dev);
+	uint32_t *acq = fa->acq;
+	uint64_t now;
+
+	if (!acq[FMCADC_CONF_ACQ_N_SHOTS] || (!fa->rec &&
+	    !(acq[FMCADC_CONF_ACQ_PRE_SAMP] + acq[FMCADC_CONF_ACQ_POST_SAMP]))) {
+		errno = EINVAL; /* the driver refuses to arm */
+		return -1;
+	}
+
+	/* Blocks left from the previous acquisition are dropped */
+	fa->seq += fa->next;
+	fa->sample += (uint64_t)fa->next * fa->nsamples;
+	fa->pos += fa->next;
+	fa->next = fa->first = fa->n_stored = 0;
+
+	now = fmcadc_sim_ns(CLOCK_MONOTONIC);
+	fa->n_shots = acq[FMCADC_CONF_ACQ_N_SHOTS];
+	if (fa->rec && !fa->loop) {
+		if (fa->pos >= fa->rec->n) {
+			errno = ENODATA; /* end of the recording */
+			return -1;
+		}
+		if (fa->n_shots > fa->rec->n - fa->pos)
+			fa->n_shots = fa->rec->n - fa->pos;
+	}
+	fa->presamples = acq[FMCADC_CONF_ACQ_PRE_SAMP];
+	fa->nsamples = fa->presamples + acq[FMCADC_CONF_ACQ_POST_SAMP];
+	fa->shot_ns = (uint64_t)fa->nsamples * FMCADC_SIM_SAMPLE_NS;
+	if (acq[FMCADC_CONF_ACQ_DECIMATION])
+		fa->shot_ns *= acq[FMCADC_CONF_ACQ_DECIMATION];
+	fa->period = fa->rate ? 1000000000ULL / fa->rate : 0;
+	/* The trigger is accepted only after the pre-samples */
+	fa->t_trg = now + fa->presamples * FMCADC_SIM_SAMPLE_NS;
+	fa->t_start = fmcadc_sim_utc(fa, now);
+	fmcadc_sim_update_fd(fa);
+
+	if (timeout && timeout->tv_sec == 0 && timeout->tv_usec == 0)
+		return 0;
+	return fmcadc_sim_acq_poll(dev, flags, timeout);
+}
+
+int fmcadc_sim_acq_stop(struct fmcadc_dev *dev, unsigned int flags)
+{
+	struct __fmcadc_dev_sim *fa = to_dev_sim(dev);
+
+	/* Shots already triggered are still delivered */
+	fa->n_shots = fmcadc_sim_triggered(fa, fmcadc_sim_ns(CLOCK_MONOTONIC));
+	fmcadc_sim_update_fd(fa);
+	return 0;
+}
+
+int fmcadc_sim_get_fd(struct fmcadc_dev *dev)
+{
+	struct __fmcadc_dev_sim *fa = to_dev_sim(dev);
+
+	if (fa->fd < 0) {
+		fa->fd = timerfd_create(CLOCK_MONOTONIC,
+					TFD_NONBLOCK | TFD_CLOEXEC);
+		if (fa->fd < 0)
+			return -1;
+		fmcadc_sim_update_fd(fa);
+	}
+	return fa->fd;
+}
+
+/* The software trigger moves the next trigger to now */
+static void fmcadc_sim_sw_fire(struct __fmcadc_dev_sim *fa)
+{
+	uint64_t now = fmcadc_sim_ns(CLOCK_MONOTONIC);
+	unsigned int n = fmcadc_sim_triggered(fa, now);
+
+	if (!fa->period || n >= fa->n_shots || now < fa->t_trg)
+		return;
+	fa->t_trg = now - n * fa->period;
+	fmcadc_sim_update_fd(fa);
+}
+
+/* Configuration: the items are just stored, and used at start */
+static uint32_t *fmcadc_sim_conf_item(struct __fmcadc_dev_sim *fa,
+				      struct fmcadc_conf *conf,
+				      unsigned int index)
+{
+	switch (conf->type) {
+	case FMCADC_CONF_TYPE_TRG:
+		if (index < ARRAY_SIZE(fa->trg))
+			return &fa->trg[index];
+		break;
+	case FMCADC_CONF_TYPE_ACQ:
+		if (index < ARRAY_SIZE(fa->acq))
+			return &fa->acq[index];
+		break;
+	case FMCADC_CONF_TYPE_CHN:
+		if (index < ARRAY_SIZE(fa->chn[0]))
+			return &fa->chn[conf->route_to][index];
+		break;
+	default:
+		break;
+	}
+	return NULL;
+}
+
+static int fmcadc_sim_config_brd(struct __fmcadc_dev_sim *fa,
+				 unsigned int index, uint32_t *value,
+				 unsigned int direction)
+{
+	uint64_t now = fmcadc_sim_ns(CLOCK_MONOTONIC);
+	uint64_t utc = fmcadc_sim_utc(fa, now);
+
+	switch (index) {
+	case FMCADC_CONF_UTC_TIMING_BASE_S:
+		if (!direction) {
+			*value = utc / 1000000000;
+			return 0;
+		}
+		fa->utc_ns = *value * 1000000000ULL + utc % 1000000000;
+		fa->utc_mono = now;
+		return 0;
+	case FMCADC_CONF_UTC_TIMING_BASE_T:
+		if (!direction) {
+			*value = utc % 1000000000 / FA100M14B4C_UTC_CLOCK_NS;
+			return 0;
+		}
+		fa->utc_ns = utc - utc % 1000000000 +
+			(uint64_t)*value * FA100M14B4C_UTC_CLOCK_NS;
+		fa->utc_mono = now;
+		return 0;
+	case FMCADC_CONF_BRD_STATE_MACHINE_STATUS:
+		if (direction)
+			break;
+		*value = fmcadc_sim_triggered(fa, now) < fa->n_shots ?
+			FA100M14B4C_STATE_WAIT : FA100M14B4C_STATE_IDLE;
+		return 0;
+	case FMCADC_CONF_BRD_N_CHAN:
+		if (direction)
+			break;
+		*value = FMCADC_SIM_NCHAN;
+		return 0;
+	default:
+		errno = FMCADC_ENOCAP;
+		return -1;
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+static int fmcadc_sim_config(struct __fmcadc_dev_sim *fa,
+			     struct fmcadc_conf *conf, unsigned int direction)
+{
+	uint64_t t = fmcadc_sim_ns(CLOCK_MONOTONIC);
+	uint32_t *item;
+	int i, err = 0;
+
+	if (conf->type == FMCADC_CONF_TYPE_CHN &&
+	    conf->route_to >= FMCADC_SIM_NCHAN) {
+		errno = FMCADC_ENOCHAN;
+		return -1;
+	}
+	for (i = 0; i < __FMCADC_CONF_LEN && !err; ++i) {
+		if (!(conf->mask & (1LL << i)))
+			continue;
+		if (direction)
+			fa->conf_stats.n_set++;
+		else
+			fa->conf_stats.n_get++;
+
+		if (conf->type == FMCADC_CONF_TYPE_BRD) {
+			err = fmcadc_sim_config_brd(fa, i, &conf->value[i],
+						    direction);
+			continue;
+		}
+		item = fmcadc_sim_conf_item(fa, conf, i);
+		if (!item) {
+			errno = FMCADC_ENOCAP;
+			err = -1;
+		} else if (!direction) {
+			conf->value[i] = *item;
+		} else if (conf->type == FMCADC_CONF_TYPE_ACQ &&
+			   (i == FMCADC_CONF_ACQ_FREQ_HZ ||
+			    i == FMCADC_CONF_ACQ_N_BITS)) {
+			errno = FMCADC_ENOSET;
+			err = -1;
+		} else {
+			*item = conf->value[i];
+		}
+	}
+
+	t = fmcadc_sim_ns(CLOCK_MONOTONIC) - t;
+	if (direction)
+		fa->conf_stats.set_ns += t;
+	else
+		fa->conf_stats.get_ns += t;
+	return err;
+}
+
+int fmcadc_sim_apply_config(struct fmcadc_dev *dev, unsigned int flags,
+			    struct fmcadc_conf *conf)
+{
+	return fmcadc_sim_config(to_dev_sim(dev), conf, 1);
+}
+
+int fmcadc_sim_retrieve_config(struct fmcadc_dev *dev,
+			       struct fmcadc_conf *conf)
+{
+	return fmcadc_sim_config(to_dev_sim(dev), conf, 0);
+}
+
+int fmcadc_sim_get_conf_stats(struct fmcadc_dev *dev,
+			      struct fmcadc_conf_stats *stats)
+{
+	memcpy(stats, &to_dev_sim(dev)->conf_stats, sizeof(*stats));
+	return 0;
+}
+
+static struct fmcadc_sim_param *fmcadc_sim_param(char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(fmcadc_sim_params); i++)
+		if (!strcmp(name, fmcadc_sim_params[i].name))
+			return &fmcadc_sim_params[i];
+	errno = ENOENT; /* like a missing sysfs attribute */
+	return NULL;
+}
+
+int fmcadc_sim_set_param(struct fmcadc_dev *dev, char *name,
+			 char *sptr, int *iptr)
+{
+	struct __fmcadc_dev_sim *fa = to_dev_sim(dev);
+	struct fmcadc_sim_param *p;
+	uint32_t val;
+
+	fa->conf_stats.n_set++;
+	if (!strcmp(name, "cset0/current_buffer") && sptr) {
+		/* accepted, but data is always copied to the user buffer */
+		snprintf(fa->buffer_type, sizeof(fa->buffer_type), "%s", sptr);
+		return 0;
+	}
+	val = sptr ? strtoul(sptr, NULL, 0) : *iptr;
+	if (!strcmp(name, "cset0/trigger/sw-trg-fire")) {
+		if (fa->sw_trg_enable)
+			fmcadc_sim_sw_fire(fa);
+		return 0;
+	}
+	p = fmcadc_sim_param(name);
+	if (!p)
+		return -1;
+	if (!p->writable) {
+		errno = EACCES;
+		return -1;
+	}
+	*(uint32_t *)((char *)fa + p->offset) = val;
+	return 0;
+}
+
+int fmcadc_sim_get_param(struct fmcadc_dev *dev, char *name,
+			 char *sptr, int *iptr)
+{
+	struct __fmcadc_dev_sim *fa = to_dev_sim(dev);
+	struct fmcadc_sim_param *p;
+	uint32_t val;
+
+	fa->conf_stats.n_get++;
+	if (!strcmp(name, "cset0/current_buffer") && sptr) {
+		strcpy(sptr, fa->buffer_type);
+		return 0;
+	}
+	p = fmcadc_sim_param(name);
+	if (!p)
+		return -1;
+	val = *(uint32_t *)((char *)fa + p->offset);
+	if (sptr)
+		sprintf(sptr, "%u", val);
+	else
+		*iptr = val;
+	return 0;
+}
+
+struct fmcadc_buffer *fmcadc_sim_request_buffer(struct fmcadc_dev *dev,
+						int nsamples,
+						void *(*alloc)(size_t),
+						unsigned int flags)
+{
+	struct __fmcadc_dev_sim *fa = to_dev_sim(dev);
+	struct fmcadc_buffer *buf;
+
+	/* Our own data comes from the pool, like with ZIO */
+	if (!alloc && !fa->rec) {
+		if (!fa->pool)
+			fa->pool = fmcadc_pool_create(fa->flags &
+						      FMCADC_FLAG_HUGETLB);
+		if (!fa->pool) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		buf = fmcadc_pool_get(fa->pool, nsamples * FMCADC_SIM_NCHAN *
+				      sizeof(int16_t));
+		if (!buf)
+			return NULL;
+		flags |= buf->flags;
+		goto out;
+	}
+
+	buf = calloc(1, sizeof(*buf));
+	if (!buf) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	buf->metadata = calloc(1, sizeof(struct zio_control));
+	if (!buf->metadata) {
+		free(buf);
+		errno = ENOMEM;
+		return NULL;
+	}
+	/* Replayed data is not copied, if the user has no own allocator */
+	if (!alloc)
+		flags |= FMCADC_FLAG_MMAP;
+	else
+		buf->data = alloc(nsamples * FMCADC_SIM_NCHAN * sizeof(int16_t));
+	if (alloc && !buf->data) {
+		free(buf->metadata);
+		free(buf);
+		errno = ENOMEM;
+		return NULL;
+	}
+out:
+	buf->samplesize = FMCADC_SIM_NCHAN * sizeof(int16_t);
+	buf->nsamples = nsamples;
+	buf->dev = (void *)&fa->gid;
+	buf->flags = flags;
+	return buf;
+}
+
+/* Metadata of shot n, like the driver reports it */
+static void fmcadc_sim_fill_ctrl(struct __fmcadc_dev_sim *fa,
+				 struct zio_control *ctrl, unsigned int n)
+{
+	struct zio_ctrl_attr *cattr = &ctrl->attr_channel;
+	struct zio_ctrl_attr *tattr = &ctrl->attr_trigger;
+	uint64_t t;
+	int ch;
+
+	memset(ctrl, 0, sizeof(*ctrl));
+	ctrl->seq_num = fa->seq + n;
+	ctrl->nsamples = fa->nsamples * FMCADC_SIM_NCHAN;
+	ctrl->ssize = sizeof(int16_t);
+	ctrl->nbits = fa->acq[FMCADC_CONF_ACQ_N_BITS];
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	ctrl->flags = ZIO_CONTROL_LITTLE_ENDIAN;
+#else
+	ctrl->flags = ZIO_CONTROL_BIG_ENDIAN;
+#endif
+	ctrl->addr.dev_id = fa->dev_id;
+	ctrl->addr.chan = FMCADC_SIM_NCHAN; /* the interleaved channel */
+	strncpy(ctrl->addr.devname, fa->gid.board->devname,
+		sizeof(ctrl->addr.devname) - 1);
+	strncpy(ctrl->triggername, fa->gid.board->devname,
+		sizeof(ctrl->triggername) - 1);
+
+	/* At the trigger rate, or back to back if all triggered at once */
+	if (fa->period)
+		t = fmcadc_sim_utc(fa, fa->t_trg + n * fa->period);
+	else
+		t = fmcadc_sim_utc(fa, fa->t_trg) + n * fa->shot_ns;
+	ctrl->tstamp.secs = t / 1000000000;
+	ctrl->tstamp.ticks = t % 1000000000 / FA100M14B4C_UTC_CLOCK_NS;
+
+	cattr->ext_mask = (1 << (FA100M14B4C_DATTR_ACQ_START_F + 1)) - 1;
+	cattr->ext_val[FA100M14B4C_DATTR_DECI] =
+		fa->acq[FMCADC_CONF_ACQ_DECIMATION];
+	for (ch = 0; ch < FMCADC_SIM_NCHAN; ++ch) {
+		cattr->ext_val[FA100M14B4C_DATTR_CH0_OFFSET + ch] =
+			fa->chn[ch][FMCADC_CONF_CHN_OFFSET];
+		cattr->ext_val[FA100M14B4C_DATTR_CH0_VREF + ch] =
+			fa->chn[ch][FMCADC_CONF_CHN_RANGE];
+		cattr->ext_val[FA100M14B4C_DATTR_CH0_50TERM + ch] =
+			fa->chn[ch][FMCADC_CONF_CHN_TERMINATION];
+	}
+	cattr->ext_val[FA100M14B4C_DATTR_ACQ_START_S] = fa->t_start / 1000000000;
+	cattr->ext_val[FA100M14B4C_DATTR_ACQ_START_C] =
+		fa->t_start % 1000000000 / FA100M14B4C_UTC_CLOCK_NS;
+
+	tattr->std_mask = (1 << ZIO_ATTR_TRIG_MAX) - 1;
+	tattr->std_val[ZIO_ATTR_TRIG_N_SHOTS] = fa->acq[FMCADC_CONF_ACQ_N_SHOTS];
+	tattr->std_val[ZIO_ATTR_TRIG_PRE_SAMP] = fa->presamples;
+	tattr->std_val[ZIO_ATTR_TRIG_POST_SAMP] = fa->nsamples - fa->presamples;
+	tattr->ext_mask = (1 << (FA100M14B4C_TATTR_DELAY + 1)) - 1;
+	tattr->ext_val[FA100M14B4C_TATTR_EXT] = fa->trg[FMCADC_CONF_TRG_SOURCE];
+	tattr->ext_val[FA100M14B4C_TATTR_POL] =
+		fa->trg[FMCADC_CONF_TRG_POLARITY];
+	tattr->ext_val[FA100M14B4C_TATTR_INT_CHAN] =
+		fa->trg[FMCADC_CONF_TRG_SOURCE_CHAN];
+	tattr->ext_val[FA100M14B4C_TATTR_INT_THRES] =
+		fa->trg[FMCADC_CONF_TRG_THRESHOLD];
+	tattr->ext_val[FA100M14B4C_TATTR_DELAY] = fa->trg[FMCADC_CONF_TRG_DELAY];
+}
+
+/* Samples of shot n: each shot continues the waveform of the previous */
+static void fmcadc_sim_fill_data(struct __fmcadc_dev_sim *fa,
+				 int16_t *data, unsigned int n,
+				 unsigned int nsamples)
+{
+	uint64_t sample = fa->sample + (uint64_t)n * fa->nsamples;
+	unsigned int i, pos, len;
+	uint16_t v;
+
+	if (fa->waveform == FMCADC_SIM_RAMP) {
+		v = sample * FMCADC_SIM_NCHAN;
+		for (i = 0; i < nsamples * FMCADC_SIM_NCHAN; ++i)
+			data[i] = v++;
+		return;
+	}
+	pos = sample % FMCADC_SIM_TABLE;
+	for (i = 0; i < nsamples; i += len, pos = 0) {
+		len = FMCADC_SIM_TABLE - pos;
+		if (len > nsamples - i)
+			len = nsamples - i;
+		memcpy(data + i * FMCADC_SIM_NCHAN,
+		       fa->table + pos * FMCADC_SIM_NCHAN,
+		       len * FMCADC_SIM_NCHAN * sizeof(*data));
+	}
+}
+
+/* Replay block j (counting the loops): data is mapped, or copied */
+static void fmcadc_replay_fill_one(struct __fmcadc_dev_sim *fa,
+				   struct fmcadc_buffer *buf, uint64_t j)
+{
+	struct fmcadc_replay_block *blk = &fa->rec->blk[j % fa->rec->n];
+	size_t len = blk->datalen;
+
+	memcpy(buf->metadata, blk->ctrl, sizeof(struct zio_control));
+	if (buf->flags & FMCADC_FLAG_MMAP) {
+		buf->data = blk->data;
+		buf->nsamples = len / buf->samplesize;
+		return;
+	}
+	/* we allocated buf->nsamples, we can have more or less */
+	if (len > (size_t)buf->nsamples * buf->samplesize)
+		len = (size_t)buf->nsamples * buf->samplesize;
+	memcpy(buf->data, blk->data, len);
+	buf->nsamples = len / buf->samplesize;
+}
+
+/* Fill a buffer with the first stored block */
+static void fmcadc_sim_fill_one(struct __fmcadc_dev_sim *fa,
+				struct fmcadc_buffer *buf)
+{
+	unsigned int n;
+
+	if (fa->nbuffer) {
+		n = fa->stored[fa->first];
+		fa->first = (fa->first + 1) % fa->nbuffer;
+	} else {
+		n = fa->next - fa->n_stored;
+	}
+	fa->n_stored--;
+
+	if (fa->rec) {
+		fmcadc_replay_fill_one(fa, buf, fa->pos + n);
+		return;
+	}
+	/* we allocated buf->nsamples, we can have more or less */
+	if (buf->nsamples > fa->nsamples)
+		buf->nsamples = fa->nsamples;
+	fmcadc_sim_fill_ctrl(fa, buf->metadata, n);
+	fmcadc_sim_fill_data(fa, buf->data, n, buf->nsamples);
+}
+
+int fmcadc_sim_fill_buffer(struct fmcadc_dev *dev,
+			   struct fmcadc_buffer *buf,
+			   unsigned int flags,
+			   struct timeval *timeout)
+{
+	struct __fmcadc_dev_sim *fa = to_dev_sim(dev);
+
+	if (fmcadc_sim_wait(fa, timeout) < 0)
+		return -1;
+	fmcadc_sim_fill_one(fa, buf);
+	fmcadc_sim_update_fd(fa);
+	return 0;
+}
+
+int fmcadc_sim_fill_buffers(struct fmcadc_dev *dev,
+			    struct fmcadc_buffer **buf,
+			    unsigned int n,
+			    unsigned int flags,
+			    struct timeval *timeout)
+{
+	struct __fmcadc_dev_sim *fa = to_dev_sim(dev);
+	unsigned int i;
+
+	if (!n)
+		return 0;
+	if (fmcadc_sim_wait(fa, timeout) < 0)
+		return -1;
+	for (i = 0; i < n && fa->n_stored; i++)
+		fmcadc_sim_fill_one(fa, buf[i]);
+	fmcadc_sim_update_fd(fa);
+	return i;
+}
+
+int fmcadc_sim_release_buffer(struct fmcadc_dev *dev,
+			      struct fmcadc_buffer *buf,
+			      void (*free_fn)(void *))
+{
+	struct __fmcadc_dev_sim *fa = to_dev_sim(dev);
+
+	if (buf->flags & FMCADC_FLAG_POOL) {
+		fmcadc_pool_put(fa->pool, buf);
+		return 0;
+	}
+	free(buf->metadata);
+	if (!free_fn && !(buf->flags & FMCADC_FLAG_MMAP))
+		free_fn = free;
+	if (free_fn)
+		free_fn(buf->data);
+	free(buf);
+	return 0;
+}
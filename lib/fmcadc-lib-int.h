@@ -5,6 +5,8 @@
 #ifndef FMCADC_LIB_INT_H_
 #define FMCADC_LIB_INT_H_
 
+#include <pthread.h>
+
 /*
  * offsetof and container_of come from kernel.h header file
  */
@@ -33,14 +35,19 @@ struct fmcadc_operations {
 	typeof(fmcadc_acq_start)	*acq_start;
 	typeof(fmcadc_acq_poll)		*acq_poll;
 	typeof(fmcadc_acq_stop)		*acq_stop;
+	typeof(fmcadc_get_fd)		*get_fd;
 
 	typeof(fmcadc_apply_config)	*apply_config;
 	typeof(fmcadc_retrieve_config)	*retrieve_config;
+	typeof(fmcadc_invalidate_config) *invalidate_config;
+	typeof(fmcadc_revalidate_config) *revalidate_config;
 	typeof(fmcadc_get_param)	*get_param;
 	typeof(fmcadc_set_param)	*set_param;
+	typeof(fmcadc_get_conf_stats)	*get_conf_stats;
 
 	typeof(fmcadc_request_buffer)	*request_buffer;
 	typeof(fmcadc_fill_buffer)	*fill_buffer;
+	typeof(fmcadc_fill_buffers)	*fill_buffers;
 	typeof(fmcadc_tstamp_buffer)	*tstamp_buffer;
 	typeof(fmcadc_release_buffer)	*release_buffer;
 };
@@ -70,6 +77,8 @@ struct fmcadc_gid {
 
 /* Definition of board types */
 extern struct fmcadc_board_type fmcadc_100ms_4ch_14bit;
+extern struct fmcadc_board_type fmcadc_sim;
+extern struct fmcadc_board_type fmcadc_replay;
 
 /* Internal structure (ZIO specific, for ZIO drivers only) */
 struct __fmcadc_dev_zio {
@@ -82,6 +91,18 @@ struct __fmcadc_dev_zio {
 	char *sysbase;
 	unsigned long samplesize;
 	unsigned long pagesize;
+	void *mapaddr; /* whole data area of a vmalloc buffer, if mapped */
+	unsigned long maplen;
+	/* The engine, the user and its threads may configure the device */
+	pthread_mutex_t lock; /* protects attrs, conf_stats and the caches */
+	struct fmcadc_zio_attr *attrs; /* open sysfs files, see config-zio.c */
+	struct fmcadc_conf_stats conf_stats;
+	struct fmcadc_pool *pool; /* released buffers, see pool.c */
+	int fill_errno; /* a shot lost by fill_buffers, for the next fill */
+	/* Items applied to the driver, to skip them if unchanged */
+	struct fmcadc_conf cache_trg;
+	struct fmcadc_conf cache_acq;
+	struct fmcadc_conf cache_chn[4];
 	/* Mandatory field */
 	struct fmcadc_gid gid;
 };
@@ -89,6 +110,9 @@ struct __fmcadc_dev_zio {
 #define FMCADC_FLAG_VERBOSE 0x00000001
 #define FMCADC_FLAG_MALLOC  0x00000002 /* allocate data */
 #define FMCADC_FLAG_MMAP    0x00000004 /* mmap data */
+#define FMCADC_FLAG_NOBIN   0x00000008 /* no binary configuration */
+#define FMCADC_FLAG_HUGETLB 0x00000010 /* huge pages for big buffers */
+#define FMCADC_FLAG_POOL    0x00000020 /* buffer from the pool */
 
 /* The board-specific functions are defined in fmc-adc-100m14b4cha.c */
 struct fmcadc_dev *fmcadc_zio_open(const struct fmcadc_board_type *b,
@@ -104,6 +128,7 @@ int fmcadc_zio_acq_poll(struct fmcadc_dev *dev, unsigned int flags,
 			struct timeval *timeout);
 int fmcadc_zio_acq_stop(struct fmcadc_dev *dev,
 			unsigned int flags);
+int fmcadc_zio_get_fd(struct fmcadc_dev *dev);
 struct fmcadc_buffer *fmcadc_zio_request_buffer(struct fmcadc_dev *dev,
 						int nsamples,
 						void *(*alloc)(size_t),
@@ -112,8 +137,15 @@ int fmcadc_zio_fill_buffer(struct fmcadc_dev *dev,
 			   struct fmcadc_buffer *buf,
 			   unsigned int flags,
 			   struct timeval *timeout);
+int fmcadc_zio_fill_buffers(struct fmcadc_dev *dev,
+			    struct fmcadc_buffer **buf,
+			    unsigned int n,
+			    unsigned int flags,
+			    struct timeval *timeout);
 struct fmcadc_timestamp *fmcadc_zio_tstamp_buffer(struct fmcadc_buffer *buf,
 						  struct fmcadc_timestamp *);
+void fmcadc_zio_map_data(struct __fmcadc_dev_zio *fa);
+void fmcadc_zio_unmap_data(struct __fmcadc_dev_zio *fa);
 int fmcadc_zio_release_buffer(struct fmcadc_dev *dev,
 			      struct fmcadc_buffer *buf,
 			      void (*free_fn)(void *));
@@ -123,13 +155,110 @@ int fmcadc_zio_apply_config(struct fmcadc_dev *dev, unsigned int flags,
 			    struct fmcadc_conf *conf);
 int fmcadc_zio_retrieve_config(struct fmcadc_dev *dev,
 			       struct fmcadc_conf *conf);
+int fmcadc_zio_invalidate_config(struct fmcadc_dev *dev);
+int fmcadc_zio_revalidate_config(struct fmcadc_dev *dev);
 int fmcadc_zio_set_param(struct fmcadc_dev *dev, char *name,
 			 char *sptr, int *iptr);
 int fmcadc_zio_get_param(struct fmcadc_dev *dev, char *name,
 			 char *sptr, int *iptr);
+int fmcadc_zio_get_conf_stats(struct fmcadc_dev *dev,
+			      struct fmcadc_conf_stats *stats);
+void fmcadc_zio_sysfs_close(struct __fmcadc_dev_zio *fa);
 
 
 int fa_zio_sysfs_set(struct __fmcadc_dev_zio *fa, char *name,
 		     uint32_t *value);
 
+/* Conversion of a channel to volts, in data.c */
+int fmcadc_scale_channel(struct fmcadc_scale *s, unsigned int k,
+			 uint32_t range, uint32_t offset);
+
+/* Buffers released to a device, for its next requests (see pool.c) */
+struct fmcadc_pool;
+struct fmcadc_pool *fmcadc_pool_create(int hugetlb);
+struct fmcadc_buffer *fmcadc_pool_get(struct fmcadc_pool *p, size_t len);
+void fmcadc_pool_put(struct fmcadc_pool *p, struct fmcadc_buffer *buf);
+void fmcadc_pool_destroy(struct fmcadc_pool *p);
+
+/* The first bytes of a capture file, see capture.c */
+#define FMCADC_CAPTURE_MAGIC "FMCADCAP"
+struct fmcadc_capture *fmcadc_capture_create_align(char *name,
+						   struct fmcadc_dev *dev,
+						   unsigned int align,
+						   int oflags);
+int fmcadc_capture_append(struct fmcadc_capture *cap, void *shot,
+			  size_t datalen);
+
+/*
+ * A recording for the replay board (see replay.c). Times are relative
+ * to the first block; duration includes a period after the last one
+ */
+struct zio_control;
+struct fmcadc_replay_block {
+	struct zio_control *ctrl;
+	void *data;
+	size_t datalen;
+	uint64_t t;		/* trigger time, ns */
+	void *map;		/* only for pairs of files */
+	size_t maplen;
+};
+struct fmcadc_replay {
+	unsigned int n;
+	struct fmcadc_replay_block *blk;
+	void *map;		/* only for a single file */
+	size_t maplen;
+	struct fmcadc_capture *cap;	/* only for a capture file */
+	uint64_t duration;
+};
+struct fmcadc_replay *fmcadc_replay_load(char *name);
+void fmcadc_replay_free(struct fmcadc_replay *r);
+
+/*
+ * The simulated board is in fmc-adc-sim.c, the replay board uses it too
+ * (tstamp_buffer is the ZIO one)
+ */
+struct fmcadc_dev *fmcadc_sim_open(const struct fmcadc_board_type *b,
+				   unsigned int dev_id,
+				   unsigned long totalsamples,
+				   unsigned int nbuffer,
+				   unsigned long flags);
+struct fmcadc_dev *fmcadc_replay_open(const struct fmcadc_board_type *b,
+				      unsigned int dev_id,
+				      unsigned long totalsamples,
+				      unsigned int nbuffer,
+				      unsigned long flags);
+int fmcadc_sim_close(struct fmcadc_dev *dev);
+int fmcadc_sim_acq_start(struct fmcadc_dev *dev,
+			 unsigned int flags, struct timeval *timeout);
+int fmcadc_sim_acq_poll(struct fmcadc_dev *dev, unsigned int flags,
+			struct timeval *timeout);
+int fmcadc_sim_acq_stop(struct fmcadc_dev *dev, unsigned int flags);
+int fmcadc_sim_get_fd(struct fmcadc_dev *dev);
+int fmcadc_sim_apply_config(struct fmcadc_dev *dev, unsigned int flags,
+			    struct fmcadc_conf *conf);
+int fmcadc_sim_retrieve_config(struct fmcadc_dev *dev,
+			       struct fmcadc_conf *conf);
+int fmcadc_sim_set_param(struct fmcadc_dev *dev, char *name,
+			 char *sptr, int *iptr);
+int fmcadc_sim_get_param(struct fmcadc_dev *dev, char *name,
+			 char *sptr, int *iptr);
+int fmcadc_sim_get_conf_stats(struct fmcadc_dev *dev,
+			      struct fmcadc_conf_stats *stats);
+struct fmcadc_buffer *fmcadc_sim_request_buffer(struct fmcadc_dev *dev,
+						int nsamples,
+						void *(*alloc)(size_t),
+						unsigned int flags);
+int fmcadc_sim_fill_buffer(struct fmcadc_dev *dev,
+			   struct fmcadc_buffer *buf,
+			   unsigned int flags,
+			   struct timeval *timeout);
+int fmcadc_sim_fill_buffers(struct fmcadc_dev *dev,
+			    struct fmcadc_buffer **buf,
+			    unsigned int n,
+			    unsigned int flags,
+			    struct timeval *timeout);
+int fmcadc_sim_release_buffer(struct fmcadc_dev *dev,
+			      struct fmcadc_buffer *buf,
+			      void (*free_fn)(void *));
+
 #endif /* FMCADC_LIB_INT_H_ */
@@ -139,10 +139,22 @@ static inline int fmcadc_get_conf(struct fmcadc_conf *conf,
 	}
 }
 
+/* Cost of the configuration: accesses to the driver and time spent */
+struct fmcadc_conf_stats {
+	unsigned long n_get;	/* parameters read */
+	unsigned long n_set;	/* parameters written */
+	unsigned long n_open;	/* files opened (the others are reused) */
+	unsigned long n_skip;	/* items not applied: already set */
+	uint64_t get_ns;	/* total time spent reading, nanoseconds */
+	uint64_t set_ns;	/* total time spent writing, nanoseconds */
+};
+
 /* Flags used in open/acq/config -- note: low-bits are used by lib-int.h */
 #define FMCSDC_F_USERMASK	0xffff0000
 #define FMCADC_F_FLUSH		0x00010000
 #define FMCADC_F_VERBOSE	0x00020000
+#define FMCADC_F_FORCE		0x00040000 /* config: apply unchanged items */
+#define FMCADC_F_HUGETLB	0x00080000 /* open: huge pages for big buffers */
 
 /*
  * Actual functions follow
@@ -167,16 +179,25 @@ extern int fmcadc_acq_poll(struct fmcadc_dev *dev, unsigned int flags,
 			    struct timeval *timeout);
 extern int fmcadc_acq_stop(struct fmcadc_dev *dev, unsigned int flags);
 
+/* To wait for many devices in one thread, see fmcadc_wait_devs */
+extern int fmcadc_get_fd(struct fmcadc_dev *dev);
+extern int fmcadc_wait_devs(struct fmcadc_dev **dev, unsigned int n,
+			    int *ready, struct timeval *timeout);
+
 extern int fmcadc_reset_conf(struct fmcadc_dev *dev, unsigned int flags,
 			       struct fmcadc_conf *conf);
 extern int fmcadc_apply_config(struct fmcadc_dev *dev, unsigned int flags,
 			       struct fmcadc_conf *conf);
 extern int fmcadc_retrieve_config(struct fmcadc_dev *dev,
 				 struct fmcadc_conf *conf);
+extern int fmcadc_invalidate_config(struct fmcadc_dev *dev);
+extern int fmcadc_revalidate_config(struct fmcadc_dev *dev);
 extern int fmcadc_get_param(struct fmcadc_dev *dev, char *name,
 			    char *sptr, int *iptr);
 extern int fmcadc_set_param(struct fmcadc_dev *dev, char *name,
 			    char *sptr, int *iptr);
+extern int fmcadc_get_conf_stats(struct fmcadc_dev *dev,
+				 struct fmcadc_conf_stats *stats);
 
 extern struct fmcadc_buffer *fmcadc_request_buffer(struct fmcadc_dev *dev,
 						   int nsamples,
@@ -186,6 +207,11 @@ extern int fmcadc_fill_buffer(struct fmcadc_dev *dev,
 			      struct fmcadc_buffer *buf,
 			      unsigned int flags,
 			      struct timeval *timeout);
+extern int fmcadc_fill_buffers(struct fmcadc_dev *dev,
+			       struct fmcadc_buffer **buf,
+			       unsigned int n,
+			       unsigned int flags,
+			       struct timeval *timeout);
 extern struct fmcadc_timestamp *fmcadc_tstamp_buffer(struct fmcadc_buffer *buf,
 						     struct fmcadc_timestamp *);
 extern int fmcadc_release_buffer(struct fmcadc_dev *dev,
@@ -194,6 +220,129 @@ extern int fmcadc_release_buffer(struct fmcadc_dev *dev,
 
 extern char *fmcadc_get_driver_type(struct fmcadc_dev *dev);
 
+/* Processing of interleaved samples (4 channels), see data.c */
+extern int fmcadc_deinterleave(int16_t **dst, const int16_t *src,
+			       unsigned int nsamples, unsigned int chmask);
+extern int fmcadc_deinterleave_inplace(int16_t *data, unsigned int nsamples);
+
+/* Conversion to volts of each channel: volts = raw * scale + offset */
+struct fmcadc_scale {
+	float scale[4];
+	float offset[4];
+};
+extern int fmcadc_get_scale(struct fmcadc_dev *dev, struct fmcadc_scale *s);
+extern int fmcadc_convert_float(float *dst, const int16_t *src,
+				unsigned int nsamples,
+				const struct fmcadc_scale *s);
+extern int fmcadc_convert_double(double *dst, const int16_t *src,
+				 unsigned int nsamples,
+				 const struct fmcadc_scale *s);
+extern int fmcadc_deinterleave_float(float **dst, const int16_t *src,
+				     unsigned int nsamples, unsigned int chmask,
+				     const struct fmcadc_scale *s);
+extern int fmcadc_deinterleave_double(double **dst, const int16_t *src,
+				      unsigned int nsamples,
+				      unsigned int chmask,
+				      const struct fmcadc_scale *s);
+extern int fmcadc_deinterleave_float_shots(float **dst, const int16_t **src,
+					   unsigned int nshots,
+					   unsigned int nsamples,
+					   unsigned int chmask,
+					   const struct fmcadc_scale *s);
+
+/* Capture files: shots in a single file, with an index (see capture.c) */
+struct fmcadc_capture;
+struct fmcadc_capture_info {
+	uint32_t dev_id;
+	uint32_t nshots;
+	/* channel configuration when the file was created */
+	uint32_t range[4];
+	uint32_t offset[4];
+	uint32_t termination[4];
+};
+struct fmcadc_capture_shot {
+	void *ctrl;		/* struct zio_control */
+	int16_t *data;		/* interleaved, like in a buffer */
+	unsigned int nsamples;	/* of each channel */
+	size_t datalen;
+};
+extern struct fmcadc_capture *fmcadc_capture_create(char *name,
+						    struct fmcadc_dev *dev);
+extern int fmcadc_capture_write(struct fmcadc_capture *cap,
+				struct fmcadc_buffer *buf);
+extern struct fmcadc_capture *fmcadc_capture_open(char *name);
+extern int fmcadc_capture_close(struct fmcadc_capture *cap);
+extern int fmcadc_capture_info(struct fmcadc_capture *cap,
+			       struct fmcadc_capture_info *info);
+extern int fmcadc_capture_scale(struct fmcadc_capture *cap,
+				struct fmcadc_scale *s);
+extern int fmcadc_capture_shot(struct fmcadc_capture *cap, unsigned int n,
+			       struct fmcadc_capture_shot *shot);
+extern int fmcadc_capture_find(struct fmcadc_capture *cap,
+			       struct fmcadc_timestamp *ts);
+
+/* Capture files written by a thread, through a ring (see writer.c) */
+struct fmcadc_writer;
+struct fmcadc_writer_stats {
+	uint64_t shots;		/* written to the file */
+	uint64_t bytes;
+	uint64_t dropped;	/* the ring was full, with F_DROP */
+	uint64_t waits;		/* the ring was full, without F_DROP */
+	unsigned int nslots;
+	unsigned int used;	/* slots waiting for the disk, now */
+	unsigned int max_used;	/* slots waiting for the disk, at most */
+	int direct;		/* the file is written with O_DIRECT */
+	double seconds;		/* from the first shot to the last write */
+	double mbps;		/* sustained speed, MB/s */
+};
+#define FMCADC_WRITER_F_DIRECT	0x1	/* try O_DIRECT */
+#define FMCADC_WRITER_F_DROP	0x2	/* don't wait when the ring is full */
+extern struct fmcadc_writer *fmcadc_writer_open(char *name,
+						struct fmcadc_dev *dev,
+						unsigned int nslots,
+						size_t slotsize, int flags);
+extern int fmcadc_writer_put(struct fmcadc_writer *w,
+			     struct fmcadc_buffer *buf);
+extern int fmcadc_writer_flush(struct fmcadc_writer *w);
+extern int fmcadc_writer_stats(struct fmcadc_writer *w,
+			       struct fmcadc_writer_stats *st);
+extern int fmcadc_writer_close(struct fmcadc_writer *w);
+
+/* A thread that fills buffers for the application (see engine.c) */
+struct fmcadc_engine;
+struct fmcadc_engine_stats {
+	uint64_t shots;		/* filled by the engine */
+	uint64_t bytes;
+	uint64_t runs;		/* acquisitions started */
+	uint64_t starved;	/* the application held all buffers */
+	uint64_t consumed;	/* taken by the application */
+	/* nanoseconds from the end of the fill to get (or the callback) */
+	uint64_t latency_sum;
+	uint64_t latency_avg;
+	uint64_t latency_max;
+	double seconds;		/* from the start to the last shot */
+	double rate;		/* shots per second */
+	double mbps;
+};
+extern struct fmcadc_engine *fmcadc_engine_create(struct fmcadc_dev *dev,
+						  unsigned int nbuf,
+						  unsigned int nsamples);
+extern int fmcadc_engine_set_callback(struct fmcadc_engine *e,
+				      int (*cb)(struct fmcadc_buffer *buf,
+						struct fmcadc_timestamp *ts,
+						void *arg),
+				      void *arg);
+extern int fmcadc_engine_start(struct fmcadc_engine *e, unsigned int nruns,
+			       unsigned int flags);
+extern struct fmcadc_buffer *fmcadc_engine_get(struct fmcadc_engine *e,
+					       struct timeval *timeout);
+extern int fmcadc_engine_put(struct fmcadc_engine *e,
+			     struct fmcadc_buffer *buf);
+extern int fmcadc_engine_stop(struct fmcadc_engine *e);
+extern int fmcadc_engine_stats(struct fmcadc_engine *e,
+			       struct fmcadc_engine_stats *st);
+extern int fmcadc_engine_destroy(struct fmcadc_engine *e);
+
 /* libfmcadc version string */
 extern const char * const libfmcadc_version_s;
 
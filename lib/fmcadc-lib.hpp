@@ -0,0 +1,499 @@
+/*
+ * C++17 interface to libfmcadc: only inline wrappers, no library code
+ *
+ * Copyright (C) 2013 CERN (www.cern.ch)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2 as published by the Free Software Foundation or, at your
+ * option, any later version.
+ */
+#ifndef FMCADC_LIB_HPP_
+#define FMCADC_LIB_HPP_
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "fmcadc-lib.h"
+
+/*
+ * Devices and buffers are move-only owners of the C objects, and release
+ * them when destroyed. Errors are thrown as fmcadc::Error, with the errno
+ * of the C call; waiting for data that is not there is not an error, so
+ * the fill functions return false on timeout instead. Channels are views
+ * over the interleaved samples in the buffer: nothing is copied.
+ */
+namespace fmcadc {
+
+enum { nchan = 4 }; /* the samples of all boards have 4 channels */
+
+class Error : public std::runtime_error {
+public:
+	explicit Error(int err)
+		: std::runtime_error(fmcadc_strerror(err)), err_(err) {}
+	int code() const noexcept { return err_; }
+
+private:
+	int err_;
+};
+
+[[noreturn]] inline void throw_errno()
+{
+	throw Error(errno);
+}
+
+/* Convert a timeout; a negative value is "forever" (a NULL timeval) */
+inline struct timeval *timeout_tv(struct timeval &tv, long usec)
+{
+	if (usec < 0)
+		return nullptr;
+	tv.tv_sec = usec / 1000000;
+	tv.tv_usec = usec % 1000000;
+	return &tv;
+}
+
+/* Every stride-th element from p: one channel of interleaved samples */
+template <class T>
+class StridedSpan {
+public:
+	class iterator {
+	public:
+		using iterator_category = std::random_access_iterator_tag;
+		using value_type = std::remove_cv_t<T>;
+		using difference_type = std::ptrdiff_t;
+		using pointer = T *;
+		using reference = T &;
+
+		iterator() = default;
+		iterator(T *p, std::ptrdiff_t stride)
+			: p_(p), stride_(stride) {}
+		reference operator*() const { return *p_; }
+		reference operator[](difference_type n) const
+		{
+			return p_[n * stride_];
+		}
+		iterator &operator++() { p_ += stride_; return *this; }
+		iterator operator++(int)
+		{
+			iterator i = *this;
+
+			++*this;
+			return i;
+		}
+		iterator &operator--() { p_ -= stride_; return *this; }
+		iterator operator--(int)
+		{
+			iterator i = *this;
+
+			--*this;
+			return i;
+		}
+		iterator &operator+=(difference_type n)
+		{
+			p_ += n * stride_;
+			return *this;
+		}
+		iterator &operator-=(difference_type n)
+		{
+			p_ -= n * stride_;
+			return *this;
+		}
+		iterator operator+(difference_type n) const
+		{
+			return iterator(p_ + n * stride_, stride_);
+		}
+		iterator operator-(difference_type n) const
+		{
+			return iterator(p_ - n * stride_, stride_);
+		}
+		difference_type operator-(const iterator &i) const
+		{
+			return (p_ - i.p_) / stride_;
+		}
+		bool operator==(const iterator &i) const { return p_ == i.p_; }
+		bool operator!=(const iterator &i) const { return p_ != i.p_; }
+		bool operator<(const iterator &i) const { return p_ < i.p_; }
+		bool operator>(const iterator &i) const { return p_ > i.p_; }
+		bool operator<=(const iterator &i) const { return p_ <= i.p_; }
+		bool operator>=(const iterator &i) const { return p_ >= i.p_; }
+
+	private:
+		T *p_ = nullptr;
+		std::ptrdiff_t stride_ = 1;
+	};
+
+	StridedSpan(T *p, std::size_t n, std::ptrdiff_t stride)
+		: p_(p), n_(n), stride_(stride) {}
+	T &operator[](std::size_t i) const { return p_[i * stride_]; }
+	std::size_t size() const { return n_; }
+	std::ptrdiff_t stride() const { return stride_; }
+	T *data() const { return p_; }
+	iterator begin() const { return iterator(p_, stride_); }
+	iterator end() const { return iterator(p_ + n_ * stride_, stride_); }
+
+private:
+	T *p_;
+	std::size_t n_;
+	std::ptrdiff_t stride_;
+};
+
+/*
+ * Configuration items, collected by type and applied together: one
+ * fmcadc_apply_config for each type (and each channel) that was set
+ */
+class Config {
+public:
+	Config()
+	{
+		init(trg_, FMCADC_CONF_TYPE_TRG, 0);
+		init(acq_, FMCADC_CONF_TYPE_ACQ, 0);
+		for (unsigned int ch = 0; ch < nchan; ++ch)
+			init(chn_[ch], FMCADC_CONF_TYPE_CHN, ch);
+	}
+
+	Config &shots(uint32_t n)
+	{
+		return set(acq_, FMCADC_CONF_ACQ_N_SHOTS, n);
+	}
+	Config &pre_samples(uint32_t n)
+	{
+		return set(acq_, FMCADC_CONF_ACQ_PRE_SAMP, n);
+	}
+	Config &post_samples(uint32_t n)
+	{
+		return set(acq_, FMCADC_CONF_ACQ_POST_SAMP, n);
+	}
+	Config &decimation(uint32_t n)
+	{
+		return set(acq_, FMCADC_CONF_ACQ_DECIMATION, n);
+	}
+	Config &trigger_source(uint32_t v)
+	{
+		return set(trg_, FMCADC_CONF_TRG_SOURCE, v);
+	}
+	Config &trigger_channel(uint32_t ch)
+	{
+		return set(trg_, FMCADC_CONF_TRG_SOURCE_CHAN, ch);
+	}
+	Config &threshold(uint32_t v)
+	{
+		return set(trg_, FMCADC_CONF_TRG_THRESHOLD, v);
+	}
+	Config &polarity(uint32_t v)
+	{
+		return set(trg_, FMCADC_CONF_TRG_POLARITY, v);
+	}
+	Config &delay(uint32_t v)
+	{
+		return set(trg_, FMCADC_CONF_TRG_DELAY, v);
+	}
+	Config &range(unsigned int ch, uint32_t v)
+	{
+		return set(chn(ch), FMCADC_CONF_CHN_RANGE, v);
+	}
+	Config &termination(unsigned int ch, uint32_t v)
+	{
+		return set(chn(ch), FMCADC_CONF_CHN_TERMINATION, v);
+	}
+	Config &offset(unsigned int ch, uint32_t v)
+	{
+		return set(chn(ch), FMCADC_CONF_CHN_OFFSET, v);
+	}
+
+	/* The C structures, for items that have no name here */
+	struct fmcadc_conf &trigger() { return trg_; }
+	struct fmcadc_conf &acquisition() { return acq_; }
+	struct fmcadc_conf &channel(unsigned int ch) { return chn(ch); }
+
+	void apply(struct fmcadc_dev *dev, unsigned int flags = 0)
+	{
+		apply(dev, flags, trg_);
+		apply(dev, flags, acq_);
+		for (unsigned int ch = 0; ch < nchan; ++ch)
+			apply(dev, flags, chn_[ch]);
+	}
+
+private:
+	static void init(struct fmcadc_conf &c,
+			 enum fmcadc_configuration_type type, uint32_t route)
+	{
+		memset(&c, 0, sizeof(c));
+		c.type = type;
+		c.route_to = route;
+	}
+	Config &set(struct fmcadc_conf &c, unsigned int index, uint32_t v)
+	{
+		fmcadc_set_conf(&c, index, v);
+		return *this;
+	}
+	struct fmcadc_conf &chn(unsigned int ch)
+	{
+		if (ch >= nchan)
+			throw Error(FMCADC_ENOCHAN);
+		return chn_[ch];
+	}
+	static void apply(struct fmcadc_dev *dev, unsigned int flags,
+			  struct fmcadc_conf &c)
+	{
+		if (c.mask && fmcadc_apply_config(dev, flags, &c) < 0)
+			throw_errno();
+	}
+
+	struct fmcadc_conf trg_, acq_, chn_[nchan];
+};
+
+class Buffer {
+public:
+	Buffer() = default;
+	Buffer(struct fmcadc_dev *dev, struct fmcadc_buffer *buf)
+		: dev_(dev), buf_(buf) {}
+	Buffer(const Buffer &) = delete;
+	Buffer &operator=(const Buffer &) = delete;
+	Buffer(Buffer &&b) noexcept
+		: dev_(b.dev_), buf_(std::exchange(b.buf_, nullptr)) {}
+	Buffer &operator=(Buffer &&b) noexcept
+	{
+		if (this != &b) {
+			reset();
+			dev_ = b.dev_;
+			buf_ = std::exchange(b.buf_, nullptr);
+		}
+		return *this;
+	}
+	~Buffer() { reset(); }
+
+	void reset() noexcept
+	{
+		if (buf_)
+			fmcadc_release_buffer(dev_, buf_, nullptr);
+		buf_ = nullptr;
+	}
+	struct fmcadc_buffer *get() const noexcept { return buf_; }
+	explicit operator bool() const noexcept { return buf_; }
+
+	/* Samples of each channel; the data is nsamples * nchan values */
+	std::size_t size() const { return buf_->nsamples; }
+	const int16_t *data() const
+	{
+		return static_cast<const int16_t *>(buf_->data);
+	}
+	int16_t *data() { return static_cast<int16_t *>(buf_->data); }
+	const void *metadata() const { return buf_->metadata; }
+
+	StridedSpan<const int16_t> channel(unsigned int ch) const
+	{
+		return StridedSpan<const int16_t>(data() + ch, size(), nchan);
+	}
+	StridedSpan<int16_t> channel(unsigned int ch)
+	{
+		return StridedSpan<int16_t>(data() + ch, size(), nchan);
+	}
+
+	struct fmcadc_timestamp timestamp() const
+	{
+		struct fmcadc_timestamp ts;
+
+		if (!fmcadc_tstamp_buffer(buf_, &ts))
+			throw_errno();
+		return ts;
+	}
+
+private:
+	struct fmcadc_dev *dev_ = nullptr;
+	struct fmcadc_buffer *buf_ = nullptr;
+};
+
+/*
+ * Shots of the current acquisition, filled one at a time in the same
+ * buffer: the iterator is an input iterator, the buffer is valid until
+ * it is incremented. The range ends after n shots, or at the timeout.
+ */
+class ShotRange {
+public:
+	class iterator {
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type = Buffer;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const Buffer *;
+		using reference = const Buffer &;
+
+		iterator() = default;
+		explicit iterator(ShotRange *r) : r_(r) { next(); }
+		reference operator*() const { return r_->buf_; }
+		pointer operator->() const { return &r_->buf_; }
+		iterator &operator++() { next(); return *this; }
+		bool operator==(const iterator &i) const { return r_ == i.r_; }
+		bool operator!=(const iterator &i) const { return r_ != i.r_; }
+
+	private:
+		inline void next();
+		ShotRange *r_ = nullptr;
+	};
+
+	ShotRange(struct fmcadc_dev *dev, Buffer &buf, unsigned int n,
+		  long timeout_us)
+		: dev_(dev), buf_(buf), left_(n), timeout_us_(timeout_us) {}
+	iterator begin() { return iterator(this); }
+	iterator end() { return iterator(); }
+
+private:
+	struct fmcadc_dev *dev_;
+	Buffer &buf_;
+	unsigned int left_;
+	long timeout_us_;
+};
+
+class Device {
+public:
+	Device() = default;
+	Device(const std::string &name, unsigned int dev_id,
+	       unsigned long totalsamples = 0, unsigned int nbuffer = 0,
+	       unsigned long flags = 0)
+		: dev_(fmcadc_open(const_cast<char *>(name.c_str()), dev_id,
+				   totalsamples, nbuffer, flags))
+	{
+		if (!dev_)
+			throw_errno();
+	}
+	Device(const Device &) = delete;
+	Device &operator=(const Device &) = delete;
+	Device(Device &&d) noexcept : dev_(std::exchange(d.dev_, nullptr)) {}
+	Device &operator=(Device &&d) noexcept
+	{
+		if (this != &d) {
+			close();
+			dev_ = std::exchange(d.dev_, nullptr);
+		}
+		return *this;
+	}
+	~Device() { close(); }
+
+	void close() noexcept
+	{
+		if (dev_)
+			fmcadc_close(dev_);
+		dev_ = nullptr;
+	}
+	struct fmcadc_dev *get() const noexcept { return dev_; }
+	explicit operator bool() const noexcept { return dev_; }
+
+	void apply(Config &c, unsigned int flags = 0) { c.apply(dev_, flags); }
+	void set_param(const std::string &name, int value)
+	{
+		if (fmcadc_set_param(dev_, const_cast<char *>(name.c_str()),
+				     nullptr, &value) < 0)
+			throw_errno();
+	}
+	int get_param(const std::string &name)
+	{
+		int value;
+
+		if (fmcadc_get_param(dev_, const_cast<char *>(name.c_str()),
+				     nullptr, &value) < 0)
+			throw_errno();
+		return value;
+	}
+
+	/* It doesn't wait: blocks are waited for by fill */
+	void start(unsigned int flags = 0)
+	{
+		struct timeval tv = {0, 0};
+
+		if (fmcadc_acq_start(dev_, flags, &tv) < 0)
+			throw_errno();
+	}
+	void stop(unsigned int flags = 0)
+	{
+		if (fmcadc_acq_stop(dev_, flags) < 0)
+			throw_errno();
+	}
+	int fd() const
+	{
+		int fd = fmcadc_get_fd(dev_);
+
+		if (fd < 0)
+			throw_errno();
+		return fd;
+	}
+
+	Buffer request_buffer(unsigned int nsamples, unsigned int flags = 0)
+	{
+		struct fmcadc_buffer *b;
+
+		b = fmcadc_request_buffer(dev_, nsamples, nullptr, flags);
+		if (!b)
+			throw_errno();
+		return Buffer(dev_, b);
+	}
+	/* Timeouts in microseconds: 0 doesn't wait, negative is forever */
+
+	/* Return false if no block came within the timeout */
+	bool fill(Buffer &b, long timeout_us = -1, unsigned int flags = 0)
+	{
+		struct timeval tv;
+
+		if (fmcadc_fill_buffer(dev_, b.get(), flags,
+				       timeout_tv(tv, timeout_us)) == 0)
+			return true;
+		if (errno != EAGAIN)
+			throw_errno();
+		return false;
+	}
+	/* Fill several buffers with the blocks that are there, or the first */
+	template <std::size_t N>
+	unsigned int fill(Buffer (&b)[N], long timeout_us = -1,
+			  unsigned int flags = 0)
+	{
+		struct fmcadc_buffer *p[N];
+		struct timeval tv;
+		int n;
+
+		for (std::size_t i = 0; i < N; ++i)
+			p[i] = b[i].get();
+		n = fmcadc_fill_buffers(dev_, p, N, flags,
+					timeout_tv(tv, timeout_us));
+		if (n >= 0)
+			return n;
+		if (errno != EAGAIN)
+			throw_errno();
+		return 0;
+	}
+
+	ShotRange shots(Buffer &b, unsigned int n, long timeout_us = -1)
+	{
+		return ShotRange(dev_, b, n, timeout_us);
+	}
+
+private:
+	struct fmcadc_dev *dev_ = nullptr;
+};
+
+inline void ShotRange::iterator::next()
+{
+	struct timeval tv;
+
+	if (!r_->left_) {
+		r_ = nullptr;
+		return;
+	}
+	if (fmcadc_fill_buffer(r_->dev_, r_->buf_.get(), 0,
+			       timeout_tv(tv, r_->timeout_us_)) < 0) {
+		if (errno != EAGAIN)
+			throw_errno();
+		r_ = nullptr;
+		return;
+	}
+	r_->left_--;
+}
+
+} /* namespace fmcadc */
+
+#endif /* FMCADC_LIB_HPP_ */
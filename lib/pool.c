@@ -0,0 +1,267 @@
+/*
+ * Buffer pool: released buffers are kept by the device and reused
+ *
+ * Copyright (C) 2013 CERN (www.cern.ch)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2 as published by the Free Software Foundation or, at your
+ * option, any later version.
+ */
+#define _GNU_SOURCE /* MAP_HUGETLB, MADV_HUGEPAGE */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <linux/zio-user.h>
+
+#include "fmcadc-lib.h"
+#include "fmcadc-lib-int.h"
+
+/*
+ * A buffer of the library is a single allocation for the structure and
+ * the metadata, plus the data area. When released, it goes to the free
+ * list of its size class, and request_buffer takes it from there: the
+ * data area is not freed and allocated again (and its pages are not
+ * faulted in again). Sizes are rounded up to a quarter of their power of
+ * two, so that a class wastes at most 25% of the memory. Data is aligned
+ * to a cache line, or a page if it is bigger than that. With hugetlb,
+ * areas of more than half a huge page are made of huge pages: reserved
+ * ones (MAP_HUGETLB) if the system has them, transparent ones otherwise.
+ * The free lists hold at most FMCADC_POOL_KEEP_BYTES of data: to make
+ * room, a release frees the buffers of the least recently used classes,
+ * or the released buffer itself.
+ */
+#define FMCADC_POOL_ALIGN 64		/* a cache line */
+#define FMCADC_POOL_PAGE 4096
+#define FMCADC_POOL_HUGE (2UL << 20)	/* a huge page on x86 */
+#define FMCADC_POOL_CLASSES 32		/* more sizes are not kept */
+#define FMCADC_POOL_KEEP 64		/* free buffers kept in each class */
+#define FMCADC_POOL_KEEP_BYTES (256UL << 20) /* free data kept in all */
+
+struct fmcadc_pool_item {
+	struct fmcadc_buffer buf;
+	struct zio_control ctrl;
+	struct fmcadc_pool_item *next;	/* in the free list */
+	void *data;
+	size_t size;			/* of the data area */
+	int mapped;			/* from mmap, not posix_memalign */
+};
+
+struct fmcadc_pool_class {
+	size_t size;
+	unsigned int nfree;
+	unsigned long used;		/* pool clock at the last get or put */
+	struct fmcadc_pool_item *free;
+};
+
+struct fmcadc_pool {
+	pthread_mutex_t lock;		/* release may come from any thread */
+	int hugetlb;
+	size_t free_bytes;		/* data areas in the free lists */
+	unsigned long clock;		/* counts the gets and puts */
+	unsigned int ncls;
+	struct fmcadc_pool_class cls[FMCADC_POOL_CLASSES];
+};
+
+struct fmcadc_pool *fmcadc_pool_create(int hugetlb)
+{
+	struct fmcadc_pool *p;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return NULL;
+	p->hugetlb = hugetlb;
+	pthread_mutex_init(&p->lock, NULL);
+	return p;
+}
+
+/* The size class of a data area of len bytes */
+static size_t fmcadc_pool_size(struct fmcadc_pool *p, size_t len)
+{
+	size_t base, step;
+
+	if (len <= FMCADC_POOL_ALIGN)
+		return FMCADC_POOL_ALIGN;
+	if (p->hugetlb && len > FMCADC_POOL_HUGE / 2)
+		step = FMCADC_POOL_HUGE;
+	else {
+		for (base = FMCADC_POOL_ALIGN; base * 2 <= len; base *= 2)
+			;
+		step = base < 4 * FMCADC_POOL_ALIGN ? base : base / 4;
+	}
+	return (len + step - 1) / step * step;
+}
+
+static void *fmcadc_pool_alloc(struct fmcadc_pool *p,
+			       struct fmcadc_pool_item *it)
+{
+	void *data;
+
+	if (p->hugetlb && !(it->size % FMCADC_POOL_HUGE)) {
+		data = mmap(NULL, it->size, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (data != MAP_FAILED) {
+			it->mapped = 1;
+			return data;
+		}
+		/* No huge pages reserved: ask for transparent ones */
+		if (posix_memalign(&data, FMCADC_POOL_HUGE, it->size))
+			return NULL;
+		madvise(data, it->size, MADV_HUGEPAGE);
+		return data;
+	}
+	if (posix_memalign(&data, it->size >= FMCADC_POOL_PAGE ?
+			   FMCADC_POOL_PAGE : FMCADC_POOL_ALIGN, it->size))
+		return NULL;
+	return data;
+}
+
+static void fmcadc_pool_free_item(struct fmcadc_pool_item *it)
+{
+	if (it->mapped)
+		munmap(it->data, it->size);
+	else
+		free(it->data);
+	free(it);
+}
+
+/* Find the class of this size, and add it if there is room */
+static struct fmcadc_pool_class *fmcadc_pool_class(struct fmcadc_pool *p,
+						   size_t size, int add)
+{
+	unsigned int i;
+
+	for (i = 0; i < p->ncls; i++)
+		if (p->cls[i].size == size)
+			return &p->cls[i];
+	if (!add || p->ncls == FMCADC_POOL_CLASSES)
+		return NULL;
+	p->cls[p->ncls].size = size;
+	return &p->cls[p->ncls++];
+}
+
+/* The least recently used class with free buffers, other than "c" */
+static struct fmcadc_pool_class *fmcadc_pool_lru(struct fmcadc_pool *p,
+						 struct fmcadc_pool_class *c)
+{
+	struct fmcadc_pool_class *lru = NULL;
+	unsigned int i;
+
+	for (i = 0; i < p->ncls; i++) {
+		if (&p->cls[i] == c || !p->cls[i].free)
+			continue;
+		if (!lru || p->cls[i].used < lru->used)
+			lru = &p->cls[i];
+	}
+	return lru;
+}
+
+/*
+ * A buffer with room for len bytes of data, and its metadata zeroed;
+ * the caller fills the other fields
+ */
+struct fmcadc_buffer *fmcadc_pool_get(struct fmcadc_pool *p, size_t len)
+{
+	struct fmcadc_pool_class *c;
+	struct fmcadc_pool_item *it = NULL;
+	size_t size = fmcadc_pool_size(p, len);
+
+	pthread_mutex_lock(&p->lock);
+	c = fmcadc_pool_class(p, size, 0);
+	if (c && c->free) {
+		it = c->free;
+		c->free = it->next;
+		c->nfree--;
+		c->used = ++p->clock;
+		p->free_bytes -= it->size;
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	if (it) {
+		memset(&it->buf, 0, sizeof(it->buf));
+		memset(&it->ctrl, 0, sizeof(it->ctrl));
+	} else {
+		it = calloc(1, sizeof(*it));
+		if (!it) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		it->size = size;
+		it->data = fmcadc_pool_alloc(p, it);
+		if (!it->data) {
+			free(it);
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+	it->buf.data = it->data;
+	it->buf.metadata = &it->ctrl;
+	it->buf.flags = FMCADC_FLAG_POOL;
+	return &it->buf;
+}
+
+/*
+ * Keep a buffer from fmcadc_pool_get for reuse, or free it. Buffers of
+ * other classes are freed first if needed, to stay within
+ * FMCADC_POOL_KEEP_BYTES; the memory is released out of the lock.
+ */
+void fmcadc_pool_put(struct fmcadc_pool *p, struct fmcadc_buffer *buf)
+{
+	struct fmcadc_pool_item *it, *old, *evicted = NULL;
+	struct fmcadc_pool_class *c, *lru;
+
+	it = container_of(buf, struct fmcadc_pool_item, buf);
+	pthread_mutex_lock(&p->lock);
+	c = fmcadc_pool_class(p, it->size, 1);
+	if (c && c->nfree < FMCADC_POOL_KEEP &&
+	    it->size <= FMCADC_POOL_KEEP_BYTES) {
+		c->used = ++p->clock;
+		while (p->free_bytes + it->size > FMCADC_POOL_KEEP_BYTES &&
+		       (lru = fmcadc_pool_lru(p, c))) {
+			old = lru->free;
+			lru->free = old->next;
+			lru->nfree--;
+			p->free_bytes -= old->size;
+			old->next = evicted;
+			evicted = old;
+		}
+		/* Only this class is left: keep its older buffers instead */
+		if (p->free_bytes + it->size <= FMCADC_POOL_KEEP_BYTES) {
+			it->next = c->free;
+			c->free = it;
+			c->nfree++;
+			p->free_bytes += it->size;
+			it = NULL;
+		}
+	}
+	pthread_mutex_unlock(&p->lock);
+	if (it)
+		fmcadc_pool_free_item(it);
+	while ((old = evicted)) {
+		evicted = old->next;
+		fmcadc_pool_free_item(old);
+	}
+}
+
+/* Free the buffers in the pool: the device is being closed */
+void fmcadc_pool_destroy(struct fmcadc_pool *p)
+{
+	struct fmcadc_pool_item *it;
+	unsigned int i;
+
+	if (!p)
+		return;
+	for (i = 0; i < p->ncls; i++) {
+		while ((it = p->cls[i].free)) {
+			p->cls[i].free = it->next;
+			fmcadc_pool_free_item(it);
+		}
+	}
+	pthread_mutex_destroy(&p->lock);
+	free(p);
+}
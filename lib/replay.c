@@ -0,0 +1,268 @@
+/*
+ * Loading of recorded acquisitions, for the replay board
+ *
+ * Copyright (C) 2013 CERN (www.cern.ch)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2 as published by the Free Software Foundation or, at your
+ * option, any later version.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <linux/zio-user.h>
+#include <fmc-adc-100m14b4cha.h>
+
+#include "fmcadc-lib.h"
+#include "fmcadc-lib-int.h"
+
+/*
+ * The tools save blocks in two ways: a single file with control and
+ * data of each block one after the other (fald-acq -B), or a pair of
+ * files for each block, "<name>.000.ctrl" and "<name>.000.data" (-M).
+ * Capture files (fald-acq -C) are read with their index.
+ * Files are mapped read-only, so that blocks are served without copies.
+ */
+static struct fmcadc_replay_block *fmcadc_replay_add(struct fmcadc_replay *r)
+{
+	struct fmcadc_replay_block *blk;
+
+	if (r->n % 64 == 0) {
+		blk = realloc(r->blk, (r->n + 64) * sizeof(*blk));
+		if (!blk)
+			return NULL;
+		r->blk = blk;
+	}
+	blk = r->blk + r->n;
+	memset(blk, 0, sizeof(*blk));
+	return blk;
+}
+
+static void *fmcadc_replay_map(char *name, size_t *len)
+{
+	struct stat st;
+	void *addr;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+	*len = st.st_size;
+	if (!st.st_size) {
+		close(fd);
+		errno = ENODATA;
+		return NULL;
+	}
+	addr = mmap(0, *len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	return addr == MAP_FAILED ? NULL : addr;
+}
+
+/* A capture file: the shots are already indexed */
+static int fmcadc_replay_load_capture(struct fmcadc_replay *r, char *name)
+{
+	struct fmcadc_replay_block *blk;
+	struct fmcadc_capture_shot shot;
+
+	r->cap = fmcadc_capture_open(name);
+	if (!r->cap)
+		return -1;
+	while (fmcadc_capture_shot(r->cap, r->n, &shot) == 0) {
+		blk = fmcadc_replay_add(r);
+		if (!blk)
+			return -1;
+		blk->ctrl = shot.ctrl;
+		blk->data = shot.data;
+		blk->datalen = shot.datalen;
+		r->n++;
+	}
+	return 0;
+}
+
+/* A single file of control and data pairs */
+static int fmcadc_replay_load_file(struct fmcadc_replay *r, char *name)
+{
+	struct fmcadc_replay_block *blk;
+	struct zio_control *ctrl;
+	size_t off, len;
+
+	r->map = fmcadc_replay_map(name, &r->maplen);
+	if (!r->map)
+		return -1;
+	if (r->maplen >= strlen(FMCADC_CAPTURE_MAGIC) &&
+	    !memcmp(r->map, FMCADC_CAPTURE_MAGIC,
+		    strlen(FMCADC_CAPTURE_MAGIC))) {
+		munmap(r->map, r->maplen);
+		r->map = NULL;
+		return fmcadc_replay_load_capture(r, name);
+	}
+	for (off = 0; off + sizeof(*ctrl) <= r->maplen; off += len) {
+		ctrl = r->map + off;
+		len = sizeof(*ctrl) + (size_t)ctrl->ssize * ctrl->nsamples;
+		if (off + len > r->maplen)
+			break; /* truncated: the tool was interrupted */
+		blk = fmcadc_replay_add(r);
+		if (!blk)
+			return -1;
+		blk->ctrl = ctrl;
+		blk->data = (void *)(ctrl + 1);
+		blk->datalen = len - sizeof(*ctrl);
+		r->n++;
+	}
+	return 0;
+}
+
+/* One pair of files: "<base>.ctrl" and "<base>.data" */
+static int fmcadc_replay_load_pair(struct fmcadc_replay *r, char *base)
+{
+	struct fmcadc_replay_block *blk;
+	char name[PATH_MAX];
+	size_t len;
+	int fd, ret;
+
+	blk = fmcadc_replay_add(r);
+	if (!blk)
+		return -1;
+	blk->ctrl = malloc(sizeof(*blk->ctrl));
+	if (!blk->ctrl)
+		return -1;
+	snprintf(name, sizeof(name), "%s.ctrl", base);
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		free(blk->ctrl);
+		return -1;
+	}
+	ret = read(fd, blk->ctrl, sizeof(*blk->ctrl));
+	close(fd);
+
+	snprintf(name, sizeof(name), "%s.data", base);
+	if (ret == sizeof(*blk->ctrl))
+		blk->map = fmcadc_replay_map(name, &blk->maplen);
+	if (!blk->map) {
+		if (ret >= 0)
+			errno = EINVAL;
+		free(blk->ctrl);
+		return -1;
+	}
+	len = (size_t)blk->ctrl->ssize * blk->ctrl->nsamples;
+	blk->data = blk->map;
+	blk->datalen = len < blk->maplen ? len : blk->maplen;
+	r->n++;
+	return 0;
+}
+
+static int fmcadc_replay_is_ctrl(const struct dirent *d)
+{
+	int len = strlen(d->d_name);
+
+	return len > 5 && !strcmp(d->d_name + len - 5, ".ctrl");
+}
+
+/* All the pairs in a directory, in alphabetical order */
+static int fmcadc_replay_load_dir(struct fmcadc_replay *r, char *dir)
+{
+	struct dirent **names;
+	char base[PATH_MAX];
+	int i, n, ret = 0;
+
+	n = scandir(dir, &names, fmcadc_replay_is_ctrl, alphasort);
+	if (n < 0)
+		return -1;
+	for (i = 0; i < n; i++) {
+		snprintf(base, sizeof(base), "%s/%.*s", dir,
+			 (int)strlen(names[i]->d_name) - 5, names[i]->d_name);
+		if (!ret)
+			ret = fmcadc_replay_load_pair(r, base);
+		free(names[i]);
+	}
+	free(names);
+	return ret;
+}
+
+/*
+ * Load a recording: "name" is a single file, a directory of pairs, or
+ * the base name given to the tool that saved the pairs
+ */
+struct fmcadc_replay *fmcadc_replay_load(char *name)
+{
+	struct fmcadc_replay *r;
+	struct fmcadc_timestamp *ts;
+	char base[PATH_MAX];
+	struct stat st;
+	uint64_t t, t0 = 0;
+	int i, err;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return NULL;
+	if (stat(name, &st) < 0) {
+		for (i = 0, err = 0; !err; i++) {
+			snprintf(base, sizeof(base), "%s.%03i", name, i);
+			err = fmcadc_replay_load_pair(r, base);
+		}
+		err = r->n ? 0 : -1;
+	} else if (S_ISDIR(st.st_mode)) {
+		err = fmcadc_replay_load_dir(r, name);
+	} else {
+		err = fmcadc_replay_load_file(r, name);
+	}
+	if (!err && !r->n) {
+		errno = ENODATA;
+		err = -1;
+	}
+	if (err) {
+		fmcadc_replay_free(r);
+		return NULL;
+	}
+
+	/* Trigger times, relative to the first block, never going back */
+	for (i = 0; i < r->n; i++) {
+		ts = (void *)&r->blk[i].ctrl->tstamp;
+		t = ts->secs * 1000000000ULL +
+			ts->ticks * FA100M14B4C_UTC_CLOCK_NS;
+		if (!i)
+			t0 = t;
+		r->blk[i].t = t < t0 ? 0 : t - t0;
+		if (i && r->blk[i].t < r->blk[i - 1].t)
+			r->blk[i].t = r->blk[i - 1].t;
+	}
+	/* When looping, the first block comes one average period later */
+	r->duration = r->blk[r->n - 1].t;
+	if (r->n > 1)
+		r->duration += r->duration / (r->n - 1);
+	return r;
+}
+
+void fmcadc_replay_free(struct fmcadc_replay *r)
+{
+	int i;
+
+	for (i = 0; i < r->n; i++) {
+		if (!r->blk[i].map)
+			continue;
+		munmap(r->blk[i].map, r->blk[i].maplen);
+		free(r->blk[i].ctrl);
+	}
+	if (r->map)
+		munmap(r->map, r->maplen);
+	if (r->cap)
+		fmcadc_capture_close(r->cap);
+	free(r->blk);
+	free(r);
+}
@@ -15,6 +15,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -48,6 +49,67 @@ int fmcadc_acq_stop(struct fmcadc_dev *dev, unsigned int flags)
 	return b->fa_op->acq_stop(dev, flags);
 }
 
+int fmcadc_get_fd(struct fmcadc_dev *dev)
+{
+	struct fmcadc_gid *g = (struct fmcadc_gid *)dev;
+	const struct fmcadc_board_type *b = g->board;
+
+	if (!b->fa_op->get_fd) {
+		errno = FMCADC_ENOP;
+		return -1;
+	}
+	return b->fa_op->get_fd(dev);
+}
+
+/*
+ * Wait for any of n devices, setting ready[i] for each device that has a
+ * block (or an error, that fill_buffer reports). Like acq_poll, it fails
+ * with EAGAIN on timeout; otherwise it returns the number of ready devices.
+ * Hang-ups and invalid descriptors are errors too: poll reports them even
+ * if not requested, and a device left not ready would make us spin
+ */
+#define FMCADC_WAIT_DEVS_STACK 16
+int fmcadc_wait_devs(struct fmcadc_dev **dev, unsigned int n, int *ready,
+		     struct timeval *timeout)
+{
+	struct pollfd stack_p[FMCADC_WAIT_DEVS_STACK], *p = stack_p;
+	unsigned int i;
+	int ret, to_ms = -1;
+
+	if (!n) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (n > FMCADC_WAIT_DEVS_STACK) {
+		p = calloc(n, sizeof(*p));
+		if (!p)
+			return -1;
+	}
+	for (i = 0; i < n; i++) {
+		p[i].fd = fmcadc_get_fd(dev[i]);
+		p[i].events = POLLIN | POLLERR;
+		if (p[i].fd < 0) {
+			ret = -1;
+			goto out;
+		}
+	}
+	if (timeout)
+		to_ms = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+
+	ret = poll(p, n, to_ms);
+	if (ret == 0) {
+		errno = EAGAIN;
+		ret = -1;
+	}
+	for (i = 0; ret > 0 && i < n; i++)
+		ready[i] = !!(p[i].revents & (POLLIN | POLLERR | POLLHUP |
+					      POLLNVAL));
+out:
+	if (p != stack_p)
+		free(p);
+	return ret;
+}
+
 int fmcadc_apply_config(struct fmcadc_dev *dev, unsigned int flags,
 			struct fmcadc_conf *conf)
 {
@@ -87,6 +149,26 @@ int fmcadc_retrieve_config(struct fmcadc_dev *dev, struct fmcadc_conf *conf)
 	return b->fa_op->retrieve_config(dev, conf);
 }
 
+int fmcadc_invalidate_config(struct fmcadc_dev *dev)
+{
+	struct fmcadc_gid *g = (struct fmcadc_gid *)dev;
+	const struct fmcadc_board_type *b = g->board;
+
+	if (!b->fa_op->invalidate_config)
+		return 0; /* no cache, nothing to do */
+	return b->fa_op->invalidate_config(dev);
+}
+
+int fmcadc_revalidate_config(struct fmcadc_dev *dev)
+{
+	struct fmcadc_gid *g = (struct fmcadc_gid *)dev;
+	const struct fmcadc_board_type *b = g->board;
+
+	if (!b->fa_op->revalidate_config)
+		return 0;
+	return b->fa_op->revalidate_config(dev);
+}
+
 int fmcadc_get_param(struct fmcadc_dev *dev, char *name,
 		     char *sptr, int *iptr)
 {
@@ -102,9 +184,24 @@ int fmcadc_set_param(struct fmcadc_dev *dev, char *name,
 	struct fmcadc_gid *g = (struct fmcadc_gid *)dev;
 	const struct fmcadc_board_type *b = g->board;
 
+	/* We don't know which configuration item this is */
+	fmcadc_invalidate_config(dev);
 	return b->fa_op->set_param(dev, name, sptr, iptr);
 }
 
+int fmcadc_get_conf_stats(struct fmcadc_dev *dev,
+			  struct fmcadc_conf_stats *stats)
+{
+	struct fmcadc_gid *g = (struct fmcadc_gid *)dev;
+	const struct fmcadc_board_type *b = g->board;
+
+	if (!b->fa_op->get_conf_stats) {
+		errno = FMCADC_ENOP;
+		return -1;
+	}
+	return b->fa_op->get_conf_stats(dev, stats);
+}
+
 struct fmcadc_buffer *fmcadc_request_buffer(struct fmcadc_dev *dev,
 					    int nsamples,
 					    void *(*alloc)(size_t),
@@ -127,6 +224,29 @@ int fmcadc_fill_buffer(struct fmcadc_dev *dev,
 	return b->fa_op->fill_buffer(dev, buf, flags, timeout);
 }
 
+int fmcadc_fill_buffers(struct fmcadc_dev *dev,
+			struct fmcadc_buffer **buf,
+			unsigned int n,
+			unsigned int flags,
+			struct timeval *timeout)
+{
+	struct fmcadc_gid *g = (struct fmcadc_gid *)dev;
+	const struct fmcadc_board_type *b = g->board;
+	struct timeval now = {0, 0};
+	unsigned int i;
+
+	if (b->fa_op->fill_buffers)
+		return b->fa_op->fill_buffers(dev, buf, n, flags, timeout);
+
+	/* Generic version: wait for the first shot only */
+	for (i = 0; i < n; i++) {
+		if (b->fa_op->fill_buffer(dev, buf[i], flags,
+					  i ? &now : timeout) < 0)
+			break;
+	}
+	return i || !n ? i : -1;
+}
+
 struct fmcadc_timestamp *fmcadc_tstamp_buffer(struct fmcadc_buffer *buf,
 					      struct fmcadc_timestamp *ts)
 {
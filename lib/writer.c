@@ -0,0 +1,294 @@
+/*
+ * Asynchronous writing of capture files, in a thread of its own
+ *
+ * Copyright (C) 2013 CERN (www.cern.ch)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2 as published by the Free Software Foundation or, at your
+ * option, any later version.
+ */
+#define _GNU_SOURCE /* O_DIRECT */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <linux/zio-user.h>
+
+#include "fmcadc-lib.h"
+#include "fmcadc-lib-int.h"
+
+/*
+ * The application copies each shot into a slot of a ring, and the
+ * writer thread appends full slots to a capture file. So a slow disk
+ * only delays the writer: readout goes on until the ring is full, and
+ * then it waits (or drops the shot, with FMCADC_WRITER_F_DROP). Slots
+ * are aligned and padded to FMCADC_WRITER_ALIGN, so that the file can
+ * be written with O_DIRECT, bypassing the page cache.
+ */
+#define FMCADC_WRITER_ALIGN 4096
+
+struct fmcadc_writer {
+	struct fmcadc_capture *cap;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;	/* a slot is full */
+	pthread_cond_t room;	/* a slot is free */
+	void *slots;
+	size_t slotlen;
+	unsigned int nslots;
+	unsigned int head;	/* next slot to fill, modulo nslots */
+	unsigned int tail;	/* next slot to write */
+	size_t *datalen;	/* of each slot */
+	int flags;
+	int closing;
+	int error;		/* errno of the writer thread */
+	struct timespec t_first, t_last;
+	struct fmcadc_writer_stats stats;
+};
+
+static double fmcadc_writer_elapsed(struct timespec *t0, struct timespec *t1)
+{
+	return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static void *fmcadc_writer_thread(void *arg)
+{
+	struct fmcadc_writer *w = arg;
+	unsigned int i;
+	size_t datalen;
+	int err;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (w->head == w->tail && !w->closing)
+			pthread_cond_wait(&w->ready, &w->lock);
+		if (w->head == w->tail)
+			break; /* closing, and all written */
+		i = w->tail % w->nslots;
+		datalen = w->datalen[i];
+		pthread_mutex_unlock(&w->lock);
+
+		/* Only this thread uses the capture after open */
+		err = 0;
+		if (!w->error &&
+		    fmcadc_capture_append(w->cap, w->slots + i * w->slotlen,
+					  datalen) < 0)
+			err = errno;
+
+		pthread_mutex_lock(&w->lock);
+		if (err) {
+			w->error = err;
+		} else if (!w->error) {
+			w->stats.shots++;
+			w->stats.bytes += sizeof(struct zio_control) + datalen;
+			clock_gettime(CLOCK_MONOTONIC, &w->t_last);
+		}
+		w->tail++;
+		pthread_cond_broadcast(&w->room);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+/*
+ * fmcadc_writer_open
+ * @name: the capture file to create
+ * @dev: the device, to save the channel configuration; may be NULL
+ * @nslots: number of shots that can wait for the disk
+ * @slotsize: the biggest data size of a shot, in bytes
+ * @flags: FMCADC_WRITER_F_*
+ *
+ * If the file system refuses O_DIRECT (e.g., tmpfs), the file is written
+ * through the page cache; the statistics tell which way was used.
+ */
+struct fmcadc_writer *fmcadc_writer_open(char *name, struct fmcadc_dev *dev,
+					 unsigned int nslots, size_t slotsize,
+					 int flags)
+{
+	struct fmcadc_writer *w;
+	int err;
+
+	if (!nslots || !slotsize) {
+		errno = EINVAL;
+		return NULL;
+	}
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+	w->nslots = nslots;
+	w->flags = flags;
+	w->slotlen = sizeof(struct zio_control) + slotsize;
+	w->slotlen += (FMCADC_WRITER_ALIGN - w->slotlen % FMCADC_WRITER_ALIGN) %
+		FMCADC_WRITER_ALIGN;
+	w->datalen = calloc(nslots, sizeof(*w->datalen));
+	if (!w->datalen)
+		goto out_free;
+	if (posix_memalign(&w->slots, FMCADC_WRITER_ALIGN,
+			   nslots * w->slotlen)) {
+		errno = ENOMEM;
+		goto out_free;
+	}
+
+	if (flags & FMCADC_WRITER_F_DIRECT) {
+		w->cap = fmcadc_capture_create_align(name, dev,
+						     FMCADC_WRITER_ALIGN,
+						     O_DIRECT);
+		w->stats.direct = !!w->cap;
+	}
+	if (!w->cap)
+		w->cap = fmcadc_capture_create_align(name, dev,
+						     FMCADC_WRITER_ALIGN, 0);
+	if (!w->cap)
+		goto out_free;
+
+	w->stats.nslots = nslots;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->ready, NULL);
+	pthread_cond_init(&w->room, NULL);
+	err = pthread_create(&w->thread, NULL, fmcadc_writer_thread, w);
+	if (err) {
+		fmcadc_capture_close(w->cap);
+		errno = err;
+		goto out_free;
+	}
+	return w;
+
+out_free:
+	free(w->slots);
+	free(w->datalen);
+	free(w);
+	return NULL;
+}
+
+/*
+ * fmcadc_writer_put
+ * @w: the writer
+ * @buf: a buffer filled by the library
+ *
+ * Copy the shot to the ring; the buffer can be filled again on return.
+ * It fails with EAGAIN if the ring is full and FMCADC_WRITER_F_DROP is
+ * set, with EMSGSIZE if the shot is bigger than the slots, and with the
+ * error of the writer thread if a write failed.
+ */
+int fmcadc_writer_put(struct fmcadc_writer *w, struct fmcadc_buffer *buf)
+{
+	struct zio_control *ctrl = buf->metadata;
+	size_t datalen, len;
+	unsigned int i, used;
+	void *slot;
+
+	datalen = (size_t)ctrl->ssize * ctrl->nsamples;
+	if (datalen > (size_t)buf->samplesize * buf->nsamples)
+		datalen = (size_t)buf->samplesize * buf->nsamples;
+	len = sizeof(*ctrl) + datalen;
+	if (len > w->slotlen) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	pthread_mutex_lock(&w->lock);
+	if (!w->error && w->head == w->tail + w->nslots) {
+		if (w->flags & FMCADC_WRITER_F_DROP) {
+			w->stats.dropped++;
+			pthread_mutex_unlock(&w->lock);
+			errno = EAGAIN;
+			return -1;
+		}
+		w->stats.waits++;
+		while (!w->error && w->head == w->tail + w->nslots)
+			pthread_cond_wait(&w->room, &w->lock);
+	}
+	if (w->error) {
+		errno = w->error;
+		pthread_mutex_unlock(&w->lock);
+		return -1;
+	}
+	if (!w->head)
+		clock_gettime(CLOCK_MONOTONIC, &w->t_first);
+	i = w->head % w->nslots;
+	pthread_mutex_unlock(&w->lock);
+
+	/* The slot is ours until head moves: copy without the lock */
+	slot = w->slots + i * w->slotlen;
+	memcpy(slot, ctrl, sizeof(*ctrl));
+	memcpy(slot + sizeof(*ctrl), buf->data, datalen);
+	memset(slot + len, 0, w->slotlen - len);
+	w->datalen[i] = datalen;
+
+	pthread_mutex_lock(&w->lock);
+	w->head++;
+	used = w->head - w->tail;
+	if (used > w->stats.max_used)
+		w->stats.max_used = used;
+	pthread_cond_signal(&w->ready);
+	pthread_mutex_unlock(&w->lock);
+	return 0;
+}
+
+/* Wait for the shots in the ring to be written */
+int fmcadc_writer_flush(struct fmcadc_writer *w)
+{
+	int err = 0;
+
+	pthread_mutex_lock(&w->lock);
+	while (w->head != w->tail)
+		pthread_cond_wait(&w->room, &w->lock);
+	if (w->error) {
+		errno = w->error;
+		err = -1;
+	}
+	pthread_mutex_unlock(&w->lock);
+	return err;
+}
+
+int fmcadc_writer_stats(struct fmcadc_writer *w,
+			struct fmcadc_writer_stats *st)
+{
+	pthread_mutex_lock(&w->lock);
+	*st = w->stats;
+	st->used = w->head - w->tail;
+	if (st->shots)
+		st->seconds = fmcadc_writer_elapsed(&w->t_first, &w->t_last);
+	if (st->seconds > 0)
+		st->mbps = st->bytes / st->seconds / 1e6;
+	pthread_mutex_unlock(&w->lock);
+	return 0;
+}
+
+/*
+ * fmcadc_writer_close
+ * @w: the writer
+ *
+ * Wait for the shots in the ring to be written, and complete the file.
+ * The statistics must be read before closing (after fmcadc_writer_flush,
+ * to count all shots).
+ */
+int fmcadc_writer_close(struct fmcadc_writer *w)
+{
+	int err;
+
+	pthread_mutex_lock(&w->lock);
+	w->closing = 1;
+	pthread_cond_signal(&w->ready);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+
+	err = fmcadc_capture_close(w->cap);
+	if (w->error) {
+		errno = w->error;
+		err = -1;
+	}
+	pthread_cond_destroy(&w->room);
+	pthread_cond_destroy(&w->ready);
+	pthread_mutex_destroy(&w->lock);
+	free(w->slots);
+	free(w->datalen);
+	free(w);
+	return err;
+}
@@ -59,6 +59,8 @@ static void fald_help()
 	printf("  --binary|-B <file>       save binary to <file>\n");
 	printf("  --multi-binary|-M <file> save two files per shot: "
 						"<file>.0000.ctrl etc\n");
+	printf("  --capture|-C <file>      save all shots to an indexed "
+						"capture file\n");
 	printf("  --dont-read|-N           config-only, use with zio-dump\n");
 	printf("  --loop|-l <num>          number of loop before exiting\n");
 	printf("  --show-data|-s <num>     how many data to display: "
@@ -88,6 +90,7 @@ static struct option options[] = {
 	/* new options, to help stress-test */
 	{"binary",	required_argument, 0, 'B'},
 	{"multi-binary",required_argument, 0, 'M'},
+	{"capture",	required_argument, 0, 'C'},
 	{"dont-read",	no_argument,       0, 'N'},
 	{"loop",	required_argument, 0, 'l'},
 	{"show-data",	required_argument, 0, 's'},
@@ -108,7 +111,7 @@ static struct option options[] = {
 	{0, 0, 0, 0}
 };
 
-#define GETOPT_STRING "b:a:n:d:u:t:c:T:B:M:N:l:s:r:g:X:p:P:D:Vhew:"
+#define GETOPT_STRING "b:a:n:d:u:t:c:T:B:M:C:N:l:s:r:g:X:p:P:D:Vhew:"
 
 static void print_version(char *pname)
 {
@@ -120,13 +123,7 @@ static void print_version(char *pname)
 
 /* variables shared between threads */
 unsigned int devid = 0;
-static pthread_mutex_t mtx;
-static pthread_cond_t readyToPollCondVar;
-static pthread_cond_t readyToReadOrCfgCondVar;
-static int adc_wait_thread_ready;
-static int adc_state;
-static int poll_state;
-static int new_config = 0;
+static int new_config; /* set by change_config_thread, cleared by main */
 static struct fmcadc_conf trg_cfg, acq_cfg, ch_cfg;
 static int show_ndata = INT_MAX; /* by default all values are displayed */
 static int plot_chno = -1;
@@ -135,6 +132,10 @@ static int binmode;
 static int timeout = -1;
 static int loop = 1;
 static char *basefile;
+static struct fmcadc_writer *writer;
+#define FALD_ACQ_WRITER_SLOTS 64
+static struct fmcadc_engine *engine;
+#define FALD_ACQ_NBUF 16
 #define MAX_BUF 512
 static char buf_fifo[MAX_BUF];
 static char *_argv[16];
@@ -142,10 +143,6 @@ static int _argc;
 static unsigned int sw_trigger_enable;
 static unsigned int sw_trigger_enable_old;
 static unsigned int sw_trigger_wait;
-#define ADC_STATE_START_ACQ (1 << 0)
-#define ADC_STATE_CHANGE_CFG (1 << 1)
-#define ADC_STATE_FAILURE (1 << 2)
-#define START_POLL 1
 
 /* default is 1 V*/
 static double bit_scale = 0.5/(1<<15);
@@ -287,6 +284,10 @@ static void fald_acq_parse_args_and_configure(int argc, char *argv[])
 			binmode = 2; /* do many binaries */
 			basefile = optarg;
 			break;
+		case 'C':
+			binmode = 3; /* do a capture file */
+			basefile = optarg;
+			break;
 		case 'N':
 			binmode = -1;
 			break;
@@ -369,58 +370,6 @@ static void fald_acq_apply_config(struct fmcadc_dev *adc,
 			_argv[0], fmcadc_strerror(errno));
 		exit(1);
 	}
-	// raise new_config flag
-	pthread_mutex_lock(&mtx);
-	new_config = 1;
-	pthread_mutex_unlock(&mtx);
-}
-
-
-/**
- * It starts an acquisition
- * @param[in] arg fmc-adc-100m device
- * @param[in] called_from identifier of the parent function
- * @param[in] flag flag for the fmcadc_acq_start() function
- */
-static void fald_acq_start(struct fmcadc_dev *adc, char *called_from, int flag)
-{
-	int try = 5, err;
-	struct timeval tv = {0, 0};
-
-	fald_print_debug("%s : call fmcadc_acq_start with %s\n",
-			 called_from, ((flag) ? "flush" : "no flush"));
-	while (try) {
-		err = fmcadc_acq_start(adc, flag, &tv);
-		if (!err)
-			break;
-
-		/* Cannot start acquisition right now */
-		fprintf(stderr, "%s: cannot start acquisition: %s\n(Retry)\n",
-			_argv[0], fmcadc_strerror(errno));
-		/* Instead of leaving try another stop/start sequence */
-		fald_acq_stop(adc, "start_adc");
-		/* give a chance to breath in case the error persists */
-		sleep(1);
-		try--;
-	}
-
-	/*
-	 * If also the last try fails, then set FAILURE state
-	 * Otherwise, start polling
-	 */
-	if (!try) {
-		fald_print_debug("%s: Cannot start acquisition. Exit\n");
-		pthread_mutex_lock(&mtx);
-		adc_state |= ADC_STATE_FAILURE;
-		pthread_mutex_unlock(&mtx);
-	} else {
-		/* Start the poll */
-		pthread_mutex_lock(&mtx);
-		poll_state = START_POLL; /* adc has been flushed and started */
-		pthread_mutex_unlock(&mtx);
-		pthread_cond_signal(&readyToPollCondVar);
-		fald_print_debug("%s send signal to readyToPollCondVar\n", called_from);
-	}
 }
 
 
@@ -446,75 +395,39 @@ static void fald_acq_stop(struct fmcadc_dev *adc, char *called_from)
 		try--;
 	}
 
-	/* If also the last try fails, then set FAILURE state */
+	/* If also the last try fails, give up */
 	if (!try) {
 		fald_print_debug("%s: Cannot stop acquisition. Exit\n");
-		pthread_mutex_lock(&mtx);
-		adc_state |= ADC_STATE_FAILURE;
-		pthread_mutex_unlock(&mtx);
+		exit(1);
 	}
 }
 
-static void adc_trigger_sw(struct fmcadc_dev *adc, unsigned int sdelay)
-{
-	sleep(sdelay);
-	fmcadc_trigger_sw_fire(adc);
-}
-
 /**
- * It waits until data is ready, then it send a signal and wait again for the
- * next block of data
+ * It fires a software trigger every sw_trigger_wait seconds. The engine
+ * and main use the device too: the library serializes the sysfs accesses
  * @param[in] arg pointer to fmc-adc-100m device
  */
-static void *adc_wait_thread(void *arg)
+static void *adc_trigger_sw_thread(void *arg)
 {
 	struct fmcadc_dev *adc = arg;
-	int err;
 
 	for (;;) {
-		pthread_mutex_lock(&mtx);
-		while (!poll_state) {
-			fald_print_debug("cond_wait readyToPollCondVar\n");
-			adc_wait_thread_ready = 1;
-			pthread_cond_wait(&readyToPollCondVar, &mtx);
-		}
-		poll_state = 0;
-		pthread_mutex_unlock(&mtx);
-
-		if (sw_trigger_enable)
-			adc_trigger_sw(adc, sw_trigger_wait);
-
-		fald_print_debug("It's time to call fmcadc_acq_poll\n");
-		err = fmcadc_acq_poll(adc, 0 , NULL);
-		if (err) {
-			if (errno == FMCADC_EDISABLED) {
-				fprintf(stderr, "fmcadc_acq_poll has been aborted due to a triiger stop:  err:%d errno:%s(%d)\n",
-					err, fmcadc_strerror(errno), errno);
-				continue;
-			} else {
-				fprintf(stderr, "fmcadc_acq_poll failed:  err:%d errno:%s(%d)\n",
-					err, strerror(errno), errno);
-				exit(-1);
-			}
-		}
-		fald_print_debug("fmc-adc_poll ends normally, send signal to readyToReadOrCfgCondVar requesting to read data\n");
-		pthread_mutex_lock(&mtx);
-		adc_state |= ADC_STATE_START_ACQ; /* means start acquisition */
-		pthread_mutex_unlock(&mtx);
-		// Wake up the change config thread
-		pthread_cond_signal(&readyToReadOrCfgCondVar);
+		sleep(sw_trigger_wait);
+		fmcadc_trigger_sw_fire(adc);
 	}
+	/* function never returns, but return NULL to avoid warning */
+	return NULL;
 }
 
 
 /**
- * It configures the device. It applies configurations coming from a temporary
- * files. Other process may write configurations on this file.
+ * It reads configurations from a temporary file, for the main thread to
+ * apply between two shots. Other process may write configurations on
+ * this file.
  * @param[in] arg pointer to fmc-adc-100m device
  */
 static void *change_config_thread(void *arg)
 {
-	struct fmcadc_dev *adc = arg;
 	int fd, ret;
 	char adcfifo[128];
 	char *s, *t;
@@ -531,6 +444,9 @@ static void *change_config_thread(void *arg)
 		memset(buf, 0, MAX_BUF);
 		ret = read(fd, buf, MAX_BUF);
 		if (ret > 0) {
+			/* wait for main to apply the previous one */
+			while (__atomic_load_n(&new_config, __ATOMIC_ACQUIRE))
+				usleep(10000);
 			_argc = 1;
 			memcpy(buf_fifo, buf, MAX_BUF); /* for future parsing */
 			s = buf_fifo;
@@ -538,15 +454,7 @@ static void *change_config_thread(void *arg)
 				s = NULL;
 				_argv[_argc++] = t;
 			}
-
-			/* async way of changing trig config */
-			fald_acq_stop(adc, "change_config");
-			fald_acq_parse_args_and_configure(_argc, _argv);
-			fald_acq_apply_config(adc, &trg_cfg, &acq_cfg, &ch_cfg);
-			fprintf(stdout, "mainThread: Change trig config ................. done\n");
-
-			fald_acq_start(adc, "change_config", FMCADC_F_FLUSH) ;
-
+			__atomic_store_n(&new_config, 1, __ATOMIC_RELEASE);
 		} else {
 			fprintf(stdout, "read returns %d\n", ret);
 			/* writer close the fifo. Colse the reader side */
@@ -561,46 +469,30 @@ static void *change_config_thread(void *arg)
 
 
 /**
- * It creates threads for configuration and to wait data. We do not really
- * need these threads but we did it on purpose in order to emulate a complex
- * scenario and stress the library/driver.
+ * It creates threads for configuration and for the software trigger.
+ * Shots are read by the acquisition engine of the library, with no lock
+ * between its thread and the main one.
  * @param[in] adc fmc-adc-100m device
  */
 static void create_thread(struct fmcadc_dev *adc)
 {
-	/* Config thread */
 	pthread_attr_t thread_attr;
 	pthread_t tid;
+	int res;
 
 	pthread_attr_init(&thread_attr);
 	pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
-	int res = pthread_create(&tid, &thread_attr, change_config_thread, (void *)adc);
-
+	res = pthread_create(&tid, &thread_attr, change_config_thread, adc);
 	if (res)
 		fprintf(stderr, "Cannot create 'change_config_thread' (%d)\n",
 			res);
 
-	pthread_attr_init(&thread_attr);
-	pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
-	res = pthread_create(&tid, &thread_attr, adc_wait_thread, (void *)adc);
+	if (!sw_trigger_enable)
+		return;
+	res = pthread_create(&tid, &thread_attr, adc_trigger_sw_thread, adc);
 	if (res)
-		fprintf(stderr, "Cannot create 'adc_wait_thread' (%d)\n", res);
-
-	// initialize condition variables
-	pthread_condattr_t condVarAttr;
-	pthread_condattr_init(&condVarAttr);
-	pthread_cond_init(&readyToPollCondVar, &condVarAttr);
-	pthread_condattr_destroy(&condVarAttr);
-	pthread_condattr_init(&condVarAttr);
-	pthread_cond_init(&readyToReadOrCfgCondVar, &condVarAttr);
-	pthread_condattr_destroy(&condVarAttr);
-	// initialize mutexes
-	pthread_mutexattr_t mtxAttr;
-	pthread_mutexattr_init(&mtxAttr);
-	pthread_mutex_init(&mtx, &mtxAttr);
-	pthread_mutexattr_destroy(&mtxAttr);
-	/* Give a chance to newly created thread to be up and running */
-//	sleep(1);
+		fprintf(stderr, "Cannot create 'adc_trigger_sw_thread' (%d)\n",
+			res);
 }
 
 
@@ -819,30 +711,14 @@ static void fald_acq_plot_data(struct fmcadc_buffer *buf, unsigned int ch)
 
 
 /**
- * It handles a a shot. Retreive data from the driver and show data
+ * It handles a shot, filled by the acquisition engine: show or store data
  */
-static int fald_acq_handle_shot(struct fmcadc_dev *adc,
-				struct fmcadc_conf *acq_cfg,
+static int fald_acq_handle_shot(struct fmcadc_conf *acq_cfg,
 				struct fmcadc_buffer *buf,
 				unsigned int shot_i)
 {
 	struct zio_control *ctrl;
-	int err;
-
-	if (binmode < 0) /* no data must be acquired */
-		return -1;
-
-	err = fmcadc_fill_buffer(adc, buf, 0, NULL);
-	if (err) {
-		if (errno == FMCADC_EDISABLED) {
-			fprintf(stdout, "mainThread: leaves fmcadc_fill_buffer with errno=FMCADC_EDISABLED\n");
-			return 0;
-		}
-		fprintf(stderr, "shot %i/%i: cannot fill buffer: %s\n", shot_i + 1,
-			acq_cfg->value[FMCADC_CONF_ACQ_N_SHOTS],
-			fmcadc_strerror(errno));
-	        return -1;
-	}
+	int err = 0;
 
 	ctrl = buf->metadata;
 	/* FIXME adc-lib should provide enums to retrive
@@ -866,6 +742,12 @@ static int fald_acq_handle_shot(struct fmcadc_dev *adc,
 	case 2:
 		err = fald_acq_write_multiple(buf, shot_i);
 		break;
+	case 3:
+		err = fmcadc_writer_put(writer, buf);
+		if (err)
+			fprintf(stderr, "%s: %s\n", basefile,
+				fmcadc_strerror(errno));
+		break;
 	}
 	if (err)
 		return -1;
@@ -873,10 +755,69 @@ static int fald_acq_handle_shot(struct fmcadc_dev *adc,
 	return 0;
 }
 
+static void fald_acq_close_writer(void)
+{
+	struct fmcadc_writer_stats st;
+
+	fmcadc_writer_flush(writer);
+	fmcadc_writer_stats(writer, &st);
+	if (fmcadc_writer_close(writer) < 0)
+		fprintf(stderr, "%s: %s\n", basefile, fmcadc_strerror(errno));
+	fprintf(stderr, "%s: %llu shots, %.1f MB/s%s; ring full %llu times, "
+		"at most %u/%u slots used\n", basefile,
+		(unsigned long long)st.shots, st.mbps,
+		st.direct ? " (O_DIRECT)" : "", (unsigned long long)st.waits,
+		st.max_used, st.nslots);
+}
+
+/**
+ * It starts the engine for the remaining acquisitions, if any: when
+ * none is left, the engine is not started and get returns ENODATA
+ * @param[in] adc fmc-adc-100m device
+ * @param[in] nsamples samples of each shot
+ */
+static struct fmcadc_engine *fald_acq_start_engine(struct fmcadc_dev *adc,
+						   unsigned int nsamples)
+{
+	struct fmcadc_engine *e;
+
+	e = fmcadc_engine_create(adc, FALD_ACQ_NBUF, nsamples);
+	if (!e) {
+		fprintf(stderr, "Cannot allocate buffer (%s)\n",
+			fmcadc_strerror(errno));
+		exit(1);
+	}
+	if (loop <= 0)
+		return e;
+	if (fmcadc_engine_start(e, loop, FMCADC_F_FLUSH) < 0) {
+		fprintf(stderr, "%s: cannot start acquisition: %s\n",
+			_argv[0], fmcadc_strerror(errno));
+		exit(1);
+	}
+	return e;
+}
+
+/**
+ * It prints throughput and latency of the shots read so far
+ */
+static void fald_acq_engine_stats(void)
+{
+	struct fmcadc_engine_stats st;
+
+	fmcadc_engine_stats(engine, &st);
+	fprintf(stderr, "%llu shots in %.3f s: %.1f shots/s, %.1f MB/s; "
+		"latency %.1f us (max %.1f us); no free buffer %llu times\n",
+		(unsigned long long)st.shots, st.seconds, st.rate, st.mbps,
+		st.latency_avg / 1e3, st.latency_max / 1e3,
+		(unsigned long long)st.starved);
+}
+
 int main(int argc, char *argv[])
 {
 	struct fmcadc_dev *adc;
 	struct fmcadc_buffer *buf;
+	struct timeval tv = {0, 100000};
+	unsigned int nsamples;
 	int i, err;
 
 	if (argc == 1) {
@@ -938,87 +879,95 @@ int main(int argc, char *argv[])
 	/* Only the ones provided will override the current ones */
 	fald_acq_parse_args_and_configure(argc, argv);
 
-	/* fmc-adc-100m work only with ZIO framework */
-	if (strcmp(fmcadc_get_driver_type(adc), "zio")) {
+	/* fmc-adc-100m work only with ZIO framework, or its simulation */
+	if (strcmp(fmcadc_get_driver_type(adc), "zio") &&
+	    strcmp(fmcadc_get_driver_type(adc), "sim") &&
+	    strcmp(fmcadc_get_driver_type(adc), "replay")) {
 		fprintf(stderr, "%s: not a zio driver, aborting\n", argv[0]);
 		exit(1);
 	}
 
-	/* create the various thread and sync mechanism */
+	/* create the various thread */
 	create_thread(adc);
-	while (!adc_wait_thread_ready)
-		nanosleep((struct timespec[]){{0, 10000}}, NULL);
-	fprintf(stdout, "adc_wait_thread_ready\n");
 
 	/* configure adc */
 	fald_acq_stop(adc, "main");
 	fald_acq_apply_config(adc, &trg_cfg, &acq_cfg, &ch_cfg);
+	nsamples = acq_cfg.value[FMCADC_CONF_ACQ_PRE_SAMP] +
+		acq_cfg.value[FMCADC_CONF_ACQ_POST_SAMP];
 
-	/* Allocate a first buffer in the default way */
-	buf = fmcadc_request_buffer(adc,
-		acq_cfg.value[FMCADC_CONF_ACQ_PRE_SAMP] +
-		acq_cfg.value[FMCADC_CONF_ACQ_POST_SAMP],
-		NULL /* alloc */, 0);
-	if (!buf) {
-		fprintf(stderr, "Cannot allocate buffer (%s)\n",
-			fmcadc_strerror(errno));
-		exit(1);
+	/*
+	 * The capture file saves the channel configuration, now applied.
+	 * A thread writes it, so that a slow disk doesn't delay readout.
+	 */
+	if (binmode == 3) {
+		writer = fmcadc_writer_open(basefile, adc,
+					    FALD_ACQ_WRITER_SLOTS,
+					    nsamples * 4 * sizeof(int16_t),
+					    FMCADC_WRITER_F_DIRECT);
+		if (!writer) {
+			fprintf(stderr, "%s: %s\n", basefile,
+				fmcadc_strerror(errno));
+			exit(1);
+		}
 	}
 
-	fald_acq_start(adc, "main", FMCADC_F_FLUSH);
-	while (loop > 0) {
-		pthread_mutex_lock(&mtx);
-		while (!adc_state) {
-			fald_print_debug("mainThread: cond_wait readyToReadOrCfgCondVar\n");
-			pthread_cond_wait(&readyToReadOrCfgCondVar, &mtx);
-			fald_print_debug("mainThread:  waked up adc_state:%d\n", adc_state);
+	/* no data must be acquired: leave the device armed for zio-dump */
+	if (binmode < 0) {
+		tv.tv_usec = 0;
+		if (fmcadc_acq_start(adc, FMCADC_F_FLUSH, &tv) < 0) {
+			fprintf(stderr, "%s: cannot start acquisition: %s\n",
+				argv[0], fmcadc_strerror(errno));
+			exit(1);
 		}
+		exit(0);
+	}
 
-		fald_print_debug("mainThread: wakeup readyToReadOrCfgCondVar with adc_state: %s\n",
-				 ((adc_state==1)?"Read data":"Change trigger config"));
-
-		/* If the system fails stop the loop and close the program */
-		if (adc_state & ADC_STATE_FAILURE) {
-			pthread_mutex_unlock(&mtx);
+	/* The engine runs "loop" acquisitions, then get returns ENODATA */
+	engine = fald_acq_start_engine(adc, nsamples);
+	for (i = 0;;) {
+		buf = fmcadc_engine_get(engine, &tv);
+		if (!buf && errno == ENODATA)
 			break;
+		if (!buf && errno != EAGAIN) {
+			fprintf(stderr, "shot %i/%i: cannot fill buffer: %s\n",
+				i + 1, acq_cfg.value[FMCADC_CONF_ACQ_N_SHOTS],
+				fmcadc_strerror(errno));
+			exit(1);
 		}
-
-		/* time to acquire data */
-		adc_state &= ~ADC_STATE_START_ACQ; /* ack time to acquire data */
-		if (new_config && buf != NULL) {
-			/* first release previous buffer */
-			fmcadc_release_buffer(adc, buf, NULL);
-			buf = NULL;
-			new_config = 0;
-		}
-		pthread_mutex_unlock(&mtx);
-
-		if (buf == NULL) { /* buf has been released due to a change of trig config */
-			/* Allocate a buffer in the default way */
-			buf = fmcadc_request_buffer(adc,
-				acq_cfg.value[FMCADC_CONF_ACQ_PRE_SAMP] +
-				acq_cfg.value[FMCADC_CONF_ACQ_POST_SAMP],
-				NULL /* alloc */, 0);
-			if (!buf) {
-				fprintf(stderr, "Cannot allocate buffer (%s)\n",
-					fmcadc_strerror(errno));
-				exit(1);
-			}
-		}
-		/* Fill the buffer once for each shot */
-		for (i = 0; i < acq_cfg.value[FMCADC_CONF_ACQ_N_SHOTS]; ++i) {
-			err = fald_acq_handle_shot(adc, &acq_cfg, buf, i);
+		if (buf) {
+			err = fald_acq_handle_shot(&acq_cfg, buf, i);
 			if (err)
 				exit(1);
+			if (++i == acq_cfg.value[FMCADC_CONF_ACQ_N_SHOTS]) {
+				i = 0;
+				--loop;
+				/* Plot only the last Acquisition */
+				if (!loop && plot_chno != -1)
+					fald_acq_plot_data(buf, plot_chno);
+			}
+			fmcadc_engine_put(engine, buf);
 		}
 
-		--loop;
-		if (loop > 0)
-			fald_acq_start(adc, "End of data processing", 0);
-		else if (plot_chno != -1)  /* Plot only the last Acquisition */
-			fald_acq_plot_data(buf, plot_chno);
-	}
-
+		/* A new configuration is applied between two shots */
+		if (!__atomic_load_n(&new_config, __ATOMIC_ACQUIRE))
+			continue;
+		fald_acq_engine_stats();
+		fmcadc_engine_destroy(engine);
+		fald_acq_parse_args_and_configure(_argc, _argv);
+		__atomic_store_n(&new_config, 0, __ATOMIC_RELEASE);
+		fald_acq_apply_config(adc, &trg_cfg, &acq_cfg, &ch_cfg);
+		fprintf(stdout, "mainThread: Change trig config ................. done\n");
+		nsamples = acq_cfg.value[FMCADC_CONF_ACQ_PRE_SAMP] +
+			acq_cfg.value[FMCADC_CONF_ACQ_POST_SAMP];
+		engine = fald_acq_start_engine(adc, nsamples);
+		i = 0;
+	}
+
+	fald_acq_engine_stats();
+	fmcadc_engine_destroy(engine);
+	if (writer)
+		fald_acq_close_writer();
 	fmcadc_trigger_sw_enable(adc, sw_trigger_enable_old);
 	fmcadc_close(adc);
 	exit(0);
@@ -0,0 +1,249 @@
+/* Copyright 2013 CERN
+ * License: GPLv2
+ *
+ * Benchmark of the C++ interface (fmcadc-lib.hpp) against the same work
+ * done with the C calls. It needs no hardware: it uses the simulated
+ * board.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <algorithm>
+#include <fmcadc-lib.hpp>
+
+#define N_CHAN 4
+
+static char git_version[] = "version: " GIT_VERSION;
+
+static void fald_bench_help(char *name)
+{
+	fprintf(stderr, "%s: Use \"%s [-V] [-n <nsamples>] [-l <loops>] "
+		"[-s <nshots>]\"\n", name, name);
+	fprintf(stderr, "  -n: samples of each channel (default 1M)\n");
+	fprintf(stderr, "  -l: number of runs of each data test "
+		"(default 100)\n");
+	fprintf(stderr, "  -s: shots of each fill test, of 1000 samples "
+		"(default 20000)\n");
+}
+
+static double fald_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fald_bench_report(const char *name, double t, unsigned int loops,
+			      unsigned int nsamples)
+{
+	double bytes = (double)nsamples * N_CHAN * sizeof(int16_t) * loops;
+
+	printf("%-24s %10.3f ms/run %10.1f MB/s\n", name, t * 1000 / loops,
+	       bytes / t / 1e6);
+}
+
+static void fald_bench_report_shots(const char *name, double t,
+				    unsigned int nshots)
+{
+	printf("%-24s %10.0f ns/shot\n", name, t * 1e9 / nshots);
+}
+
+/* Make the compiler reload the data, so each run is really done */
+static inline void fald_bench_barrier(void)
+{
+	asm volatile("" : : : "memory");
+}
+
+/* The C way: each channel with a stride of 4 */
+static void fald_bench_copy_c(int16_t **dst, const int16_t *src,
+			      unsigned int nsamples)
+{
+	unsigned int i, ch;
+	const int16_t *p;
+
+	for (ch = 0; ch < N_CHAN; ++ch)
+		for (i = 0, p = src + ch; i < nsamples; ++i, p += N_CHAN)
+			dst[ch][i] = *p;
+}
+
+static void fald_bench_copy_cpp(int16_t **dst, const fmcadc::Buffer &b)
+{
+	for (unsigned int ch = 0; ch < N_CHAN; ++ch) {
+		auto c = b.channel(ch);
+
+		std::copy(c.begin(), c.end(), dst[ch]);
+	}
+}
+
+static int64_t fald_bench_sum_c(const int16_t *src, unsigned int nsamples)
+{
+	int64_t sum = 0;
+	unsigned int i, ch;
+	const int16_t *p;
+
+	for (ch = 0; ch < N_CHAN; ++ch)
+		for (i = 0, p = src + ch; i < nsamples; ++i, p += N_CHAN)
+			sum += *p * (ch + 1);
+	return sum;
+}
+
+static int64_t fald_bench_sum_cpp(const fmcadc::Buffer &b)
+{
+	int64_t sum = 0;
+
+	for (unsigned int ch = 0; ch < N_CHAN; ++ch)
+		for (int16_t v : b.channel(ch))
+			sum += v * (ch + 1);
+	return sum;
+}
+
+static void fald_bench_check(char *name, bool ok, const char *what)
+{
+	if (ok)
+		return;
+	fprintf(stderr, "%s: wrong result of %s\n", name, what);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int nsamples = 1024 * 1024, loops = 100, nshots = 20000;
+	unsigned int fillsamples = 1000, i, l, ch, n;
+	int16_t *dst[N_CHAN];
+	int64_t sum_c, sum_cpp;
+	double t;
+	int c;
+
+	while ((c = getopt(argc, argv, "Vn:l:s:h")) != -1) {
+		switch (c) {
+		case 'V':
+			printf("%s %s\n", argv[0], git_version);
+			printf("%s\n", libfmcadc_version_s);
+			exit(0);
+		case 'n':
+			nsamples = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			loops = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			nshots = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fald_bench_help(argv[0]);
+			exit(1);
+		}
+	}
+	if (!nsamples || !loops || !nshots) {
+		fald_bench_help(argv[0]);
+		exit(1);
+	}
+
+	try {
+		/* Unpaced triggers and 16 blocks: nothing is lost */
+		fmcadc::Device adc("fmc-adc-sim", 0, 0, 16);
+		fmcadc::Config conf;
+
+		adc.set_param("sim/trigger-rate", 0);
+
+		/* Data: one big shot, processed over and over */
+		conf.shots(1).pre_samples(0).post_samples(nsamples);
+		adc.apply(conf);
+		fmcadc::Buffer buf = adc.request_buffer(nsamples);
+		adc.start();
+		if (!adc.fill(buf))
+			throw fmcadc::Error(EAGAIN);
+		const int16_t *src = buf.data();
+
+		for (ch = 0; ch < N_CHAN; ++ch) {
+			dst[ch] = (int16_t *)malloc(nsamples * sizeof(*dst[ch]));
+			if (!dst[ch]) {
+				fprintf(stderr, "%s: cannot allocate memory\n",
+					argv[0]);
+				exit(1);
+			}
+		}
+		printf("%u samples per channel, %u runs\n", nsamples, loops);
+
+		fald_bench_copy_cpp(dst, buf);
+		for (i = 0; i < nsamples * N_CHAN; ++i)
+			fald_bench_check(argv[0], dst[i % N_CHAN][i / N_CHAN]
+					 == src[i], "channel copy");
+		sum_c = fald_bench_sum_c(src, nsamples);
+		sum_cpp = fald_bench_sum_cpp(buf);
+		fald_bench_check(argv[0], sum_c == sum_cpp, "channel sum");
+
+		t = fald_bench_now();
+		for (l = 0; l < loops; ++l)
+			fald_bench_copy_c(dst, src, nsamples);
+		fald_bench_report("C stride copy", fald_bench_now() - t, loops,
+				  nsamples);
+
+		t = fald_bench_now();
+		for (l = 0; l < loops; ++l)
+			fald_bench_copy_cpp(dst, buf);
+		fald_bench_report("C++ channel copy", fald_bench_now() - t,
+				  loops, nsamples);
+
+		t = fald_bench_now();
+		for (l = 0; l < loops; ++l) {
+			fald_bench_barrier();
+			sum_c += fald_bench_sum_c(src, nsamples);
+		}
+		fald_bench_report("C stride sum", fald_bench_now() - t, loops,
+				  nsamples);
+
+		t = fald_bench_now();
+		for (l = 0; l < loops; ++l) {
+			fald_bench_barrier();
+			sum_cpp += fald_bench_sum_cpp(buf);
+		}
+		fald_bench_report("C++ channel sum", fald_bench_now() - t,
+				  loops, nsamples);
+		fald_bench_check(argv[0], sum_c == sum_cpp, "channel sum");
+
+		/* Calls: many small shots, read as they come */
+		conf.shots(nshots).post_samples(fillsamples);
+		adc.apply(conf);
+		buf = adc.request_buffer(fillsamples);
+		printf("%u shots of %u samples\n", nshots, fillsamples);
+
+		adc.start();
+		t = fald_bench_now();
+		for (n = 0; n < nshots; ++n)
+			if (fmcadc_fill_buffer(adc.get(), buf.get(), 0, NULL) < 0)
+				break;
+		fald_bench_report_shots("C fill_buffer", fald_bench_now() - t,
+					nshots);
+		fald_bench_check(argv[0], n == nshots, "C fill");
+
+		adc.start();
+		t = fald_bench_now();
+		for (n = 0; n < nshots && adc.fill(buf); ++n)
+			;
+		fald_bench_report_shots("C++ Device::fill",
+					fald_bench_now() - t, nshots);
+		fald_bench_check(argv[0], n == nshots, "C++ fill");
+
+		adc.start();
+		n = 0;
+		t = fald_bench_now();
+		for (const fmcadc::Buffer &b : adc.shots(buf, nshots))
+			n += b.size() == fillsamples;
+		fald_bench_report_shots("C++ shot iterator",
+					fald_bench_now() - t, nshots);
+		fald_bench_check(argv[0], n == nshots, "C++ shots");
+	} catch (fmcadc::Error &e) {
+		fprintf(stderr, "%s: %s\n", argv[0], e.what());
+		exit(1);
+	}
+
+	for (ch = 0; ch < N_CHAN; ++ch)
+		free(dst[ch]);
+	exit(0);
+}
@@ -0,0 +1,194 @@
+/* Copyright 2013 CERN
+ * License: GPLv2
+ *
+ * Benchmark of the sample processing functions of libfmcadc. It needs
+ * no hardware: data is synthetic.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <string.h>
+#include <time.h>
+#include <fmcadc-lib.h>
+
+#define N_CHAN 4
+
+static char git_version[] = "version: " GIT_VERSION;
+
+static void fald_bench_help(char *name)
+{
+	fprintf(stderr, "%s: Use \"%s [-V] [-n <nsamples>] [-l <loops>]\"\n",
+		name, name);
+	fprintf(stderr, "  -n: samples of each channel (default 1M)\n");
+	fprintf(stderr, "  -l: number of runs of each test (default 100)\n");
+}
+
+static double fald_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fald_bench_report(char *name, double t, unsigned int loops,
+			      unsigned int nsamples)
+{
+	double bytes = (double)nsamples * N_CHAN * sizeof(int16_t) * loops;
+
+	printf("%-24s %10.3f ms/run %10.1f MB/s\n", name, t * 1000 / loops,
+	       bytes / t / 1e6);
+}
+
+/* What the tools do now: pick each channel with a stride of 4 */
+static void fald_bench_stride(int16_t **dst, int16_t *src,
+			      unsigned int nsamples)
+{
+	unsigned int i, ch;
+	int16_t *p;
+
+	for (ch = 0; ch < N_CHAN; ++ch)
+		for (i = 0, p = src + ch; i < nsamples; ++i, p += N_CHAN)
+			dst[ch][i] = *p;
+}
+
+/* What the tools do now: one double multiply for each sample */
+static void fald_bench_stride_volts(double **dst, int16_t *src,
+				    unsigned int nsamples, double bit_scale)
+{
+	unsigned int i, ch;
+	int16_t *p;
+
+	for (ch = 0; ch < N_CHAN; ++ch)
+		for (i = 0, p = src + ch; i < nsamples; ++i, p += N_CHAN)
+			dst[ch][i] = (*p) * bit_scale;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int nsamples = 1024 * 1024, loops = 100, i, l, ch;
+	int16_t *src, *work, *dst[N_CHAN];
+	float *fdst[N_CHAN], *fwork;
+	double *ddst[N_CHAN];
+	struct fmcadc_scale s;
+	double t;
+	int c;
+
+	while ((c = getopt(argc, argv, "Vn:l:h")) != -1) {
+		switch (c) {
+		case 'V':
+			printf("%s %s\n", argv[0], git_version);
+			printf("%s\n", libfmcadc_version_s);
+			exit(0);
+		case 'n':
+			nsamples = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			loops = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fald_bench_help(argv[0]);
+			exit(1);
+		}
+	}
+	if (!nsamples || !loops) {
+		fald_bench_help(argv[0]);
+		exit(1);
+	}
+
+	src = malloc(nsamples * N_CHAN * sizeof(*src));
+	work = malloc(nsamples * N_CHAN * sizeof(*work));
+	fwork = malloc(nsamples * N_CHAN * sizeof(*fwork));
+	if (!src || !work || !fwork) {
+		fprintf(stderr, "%s: cannot allocate memory\n", argv[0]);
+		exit(1);
+	}
+	for (ch = 0; ch < N_CHAN; ++ch) {
+		dst[ch] = malloc(nsamples * sizeof(*dst[ch]));
+		fdst[ch] = malloc(nsamples * sizeof(*fdst[ch]));
+		ddst[ch] = malloc(nsamples * sizeof(*ddst[ch]));
+		if (!dst[ch] || !fdst[ch] || !ddst[ch]) {
+			fprintf(stderr, "%s: cannot allocate memory\n",
+				argv[0]);
+			exit(1);
+		}
+		/* 1V range, no offset: like "fald-acq -r 1" */
+		s.scale[ch] = 0.5 / (1 << 15);
+		s.offset[ch] = 0;
+	}
+	for (i = 0; i < nsamples * N_CHAN; ++i)
+		src[i] = rand();
+
+	/* Check the result first */
+	fmcadc_deinterleave(dst, src, nsamples, 0xf);
+	for (i = 0; i < nsamples * N_CHAN; ++i) {
+		if (dst[i % N_CHAN][i / N_CHAN] != src[i]) {
+			fprintf(stderr, "%s: wrong sample %i\n", argv[0], i);
+			exit(1);
+		}
+	}
+
+	printf("%u samples per channel, %u runs\n", nsamples, loops);
+
+	t = fald_bench_now();
+	for (l = 0; l < loops; ++l)
+		fald_bench_stride(dst, src, nsamples);
+	fald_bench_report("stride loop", fald_bench_now() - t, loops,
+			  nsamples);
+
+	t = fald_bench_now();
+	for (l = 0; l < loops; ++l)
+		fmcadc_deinterleave(dst, src, nsamples, 0xf);
+	fald_bench_report("deinterleave", fald_bench_now() - t, loops,
+			  nsamples);
+
+	t = fald_bench_now();
+	for (l = 0; l < loops; ++l)
+		fmcadc_deinterleave(dst, src, nsamples, 0x1);
+	fald_bench_report("deinterleave (1 chan)", fald_bench_now() - t,
+			  loops, nsamples);
+
+	t = 0;
+	for (l = 0; l < loops; ++l) {
+		memcpy(work, src, nsamples * N_CHAN * sizeof(*work));
+		t -= fald_bench_now();
+		fmcadc_deinterleave_inplace(work, nsamples);
+		t += fald_bench_now();
+	}
+	fald_bench_report("deinterleave in place", t, loops, nsamples);
+
+	t = fald_bench_now();
+	for (l = 0; l < loops; ++l)
+		fald_bench_stride_volts(ddst, src, nsamples, s.scale[0]);
+	fald_bench_report("stride loop to volts", fald_bench_now() - t, loops,
+			  nsamples);
+
+	t = fald_bench_now();
+	for (l = 0; l < loops; ++l)
+		fmcadc_convert_float(fwork, src, nsamples, &s);
+	fald_bench_report("convert float", fald_bench_now() - t, loops,
+			  nsamples);
+
+	t = fald_bench_now();
+	for (l = 0; l < loops; ++l)
+		fmcadc_deinterleave_float(fdst, src, nsamples, 0xf, &s);
+	fald_bench_report("deinterleave float", fald_bench_now() - t, loops,
+			  nsamples);
+
+	t = fald_bench_now();
+	for (l = 0; l < loops; ++l)
+		fmcadc_deinterleave_double(ddst, src, nsamples, 0xf, &s);
+	fald_bench_report("deinterleave double", fald_bench_now() - t, loops,
+			  nsamples);
+
+	for (ch = 0; ch < N_CHAN; ++ch) {
+		free(dst[ch]);
+		free(fdst[ch]);
+		free(ddst[ch]);
+	}
+	free(fwork);
+	free(work);
+	free(src);
+	exit(0);
+}
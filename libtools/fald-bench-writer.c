@@ -0,0 +1,191 @@
+/* Copyright 2013 CERN
+ * License: GPLv2
+ *
+ * Benchmark of capture files written to disk while acquiring. It needs
+ * no hardware: shots come from the simulated board, which loses them
+ * like the real one if they are not read in time.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fmcadc-lib.h>
+
+static char git_version[] = "version: " GIT_VERSION;
+
+static void fald_bench_help(char *name)
+{
+	fprintf(stderr, "%s: Use \"%s [-V] [-y] [-d] [-n <nshots>] "
+		"[-s <nsamples>] [-r <rate>] [-b <nslots>] [<file>]\"\n",
+		name, name);
+	fprintf(stderr, "  -y: write in the acquisition thread (default: "
+		"use a writer thread)\n");
+	fprintf(stderr, "  -d: try O_DIRECT\n");
+	fprintf(stderr, "  -n: number of shots (default 1000)\n");
+	fprintf(stderr, "  -s: samples of each channel in a shot "
+		"(default 64k)\n");
+	fprintf(stderr, "  -r: triggers per second, 0 is as fast as "
+		"possible (default 1000)\n");
+	fprintf(stderr, "  -b: slots of the writer (default 64)\n");
+	fprintf(stderr, "  <file>: default /tmp/fald-bench-writer.cap\n");
+}
+
+static double fald_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int nshots = 1000, nsamples = 64 * 1024, nslots = 64, i;
+	char *name = "/tmp/fald-bench-writer.cap";
+	struct fmcadc_writer_stats st;
+	struct fmcadc_capture_info info;
+	struct fmcadc_conf acq;
+	struct fmcadc_dev *adc;
+	struct fmcadc_buffer *buf;
+	struct fmcadc_capture *cap = NULL;
+	struct fmcadc_writer *w = NULL;
+	int c, sync = 0, flags = 0, rate = 1000, lost;
+	double t;
+
+	while ((c = getopt(argc, argv, "Vydn:s:r:b:h")) != -1) {
+		switch (c) {
+		case 'V':
+			printf("%s %s\n", argv[0], git_version);
+			printf("%s\n", libfmcadc_version_s);
+			exit(0);
+		case 'y':
+			sync = 1;
+			break;
+		case 'd':
+			flags |= FMCADC_WRITER_F_DIRECT;
+			break;
+		case 'n':
+			nshots = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			nsamples = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			nslots = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fald_bench_help(argv[0]);
+			exit(1);
+		}
+	}
+	if (optind < argc)
+		name = argv[optind];
+	if (!nshots || !nsamples || !nslots) {
+		fald_bench_help(argv[0]);
+		exit(1);
+	}
+
+	/* 16 blocks in the ZIO buffer, like a small one */
+	adc = fmcadc_open("fmc-adc-sim", 0, 0, 16, 0);
+	if (!adc) {
+		fprintf(stderr, "%s: cannot open device: %s\n",
+			argv[0], fmcadc_strerror(errno));
+		exit(1);
+	}
+	memset(&acq, 0, sizeof(acq));
+	acq.type = FMCADC_CONF_TYPE_ACQ;
+	fmcadc_set_conf(&acq, FMCADC_CONF_ACQ_N_SHOTS, nshots);
+	fmcadc_set_conf(&acq, FMCADC_CONF_ACQ_PRE_SAMP, 0);
+	fmcadc_set_conf(&acq, FMCADC_CONF_ACQ_POST_SAMP, nsamples);
+	if (fmcadc_apply_config(adc, 0, &acq) < 0 ||
+	    fmcadc_set_param(adc, "sim/trigger-rate", NULL, &rate) < 0) {
+		fprintf(stderr, "%s: cannot configure: %s\n",
+			argv[0], fmcadc_strerror(errno));
+		exit(1);
+	}
+	buf = fmcadc_request_buffer(adc, nsamples, NULL, 0);
+	if (!buf) {
+		fprintf(stderr, "%s: cannot allocate buffer: %s\n",
+			argv[0], fmcadc_strerror(errno));
+		exit(1);
+	}
+
+	if (sync)
+		cap = fmcadc_capture_create(name, adc);
+	else
+		w = fmcadc_writer_open(name, adc, nslots,
+				       buf->samplesize * buf->nsamples, flags);
+	if (!cap && !w) {
+		fprintf(stderr, "%s: %s: %s\n", argv[0], name,
+			fmcadc_strerror(errno));
+		exit(1);
+	}
+
+	t = fald_bench_now();
+	if (fmcadc_acq_start(adc, 0, NULL) < 0) {
+		fprintf(stderr, "%s: cannot start: %s\n",
+			argv[0], fmcadc_strerror(errno));
+		exit(1);
+	}
+	/* Shots lost by the board end the acquisition early */
+	for (i = 0; i < nshots; ++i) {
+		if (fmcadc_fill_buffer(adc, buf, 0, NULL) < 0)
+			break;
+		if (sync)
+			c = fmcadc_capture_write(cap, buf);
+		else
+			c = fmcadc_writer_put(w, buf);
+		if (c < 0) {
+			fprintf(stderr, "%s: %s: %s\n", argv[0], name,
+				fmcadc_strerror(errno));
+			exit(1);
+		}
+	}
+	fmcadc_get_param(adc, "sim/lost-blocks", NULL, &lost);
+
+	if (sync) {
+		c = fmcadc_capture_close(cap);
+		t = fald_bench_now() - t;
+		memset(&st, 0, sizeof(st));
+		st.shots = i;
+	} else {
+		fmcadc_writer_flush(w);
+		fmcadc_writer_stats(w, &st);
+		c = fmcadc_writer_close(w);
+		t = fald_bench_now() - t;
+	}
+	if (c < 0) {
+		fprintf(stderr, "%s: %s: %s\n", argv[0], name,
+			fmcadc_strerror(errno));
+		exit(1);
+	}
+
+	printf("%s: %u shots of %u samples, %s%s\n", name, i, nsamples,
+	       sync ? "written in the acquisition thread" : "writer thread",
+	       st.direct ? " (O_DIRECT)" : "");
+	printf("  %.3f s, %.1f MB/s, %i shots lost by the board\n", t,
+	       (double)i * buf->samplesize * nsamples / t / 1e6, lost);
+	if (!sync)
+		printf("  writer: %.1f MB/s, ring full %llu times, at most "
+		       "%u/%u slots used\n", st.mbps,
+		       (unsigned long long)st.waits, st.max_used, st.nslots);
+
+	/* Read back the index */
+	cap = fmcadc_capture_open(name);
+	if (!cap || fmcadc_capture_info(cap, &info) < 0 ||
+	    info.nshots != i) {
+		fprintf(stderr, "%s: %s: wrong capture file\n", argv[0], name);
+		exit(1);
+	}
+	fmcadc_capture_close(cap);
+
+	fmcadc_release_buffer(adc, buf, NULL);
+	fmcadc_close(adc);
+	exit(0);
+}
@@ -0,0 +1,213 @@
+/* Copyright 2013 CERN
+ * License: GPLv2
+ *
+ * Acquisition from several boards in one thread, with epoll on the file
+ * descriptors of the devices. Without device ids it uses simulated
+ * boards, so it needs no hardware.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+
+#include <linux/zio-user.h>
+#include <fmcadc-lib.h>
+
+static char git_version[] = "version: " GIT_VERSION;
+
+#define FALD_MULTI_MAX 64
+
+struct fald_multi_board {
+	struct fmcadc_dev *adc;
+	struct fmcadc_buffer *buf;
+	unsigned int dev_id;
+	unsigned int shots;
+	uint32_t seq;
+	int done;
+};
+
+static void fald_multi_help(char *name)
+{
+	fprintf(stderr, "%s: Use \"%s [-V] [-t <type>] [-b <nboards>] "
+		"[-n <nshots>] [-s <nsamples>] [-r <rate>] [<dev_id> ...]\"\n",
+		name, name);
+	fprintf(stderr, "  -t: board type (default fmc-adc-sim)\n");
+	fprintf(stderr, "  -b: number of simulated boards, when no <dev_id> "
+		"is given (default 8)\n");
+	fprintf(stderr, "  -n: shots of each board (default 100)\n");
+	fprintf(stderr, "  -s: post-trigger samples (default 1000)\n");
+	fprintf(stderr, "  -r: triggers per second of simulated boards "
+		"(default 100)\n");
+}
+
+static double fald_multi_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct fald_multi_board brd[FALD_MULTI_MAX];
+	struct epoll_event ev[FALD_MULTI_MAX];
+	struct timeval zero = {0, 0};
+	struct fmcadc_conf acq;
+	struct fald_multi_board *b;
+	unsigned int nboards = 8, nshots = 100, nsamples = 1000, left, i;
+	char *type = "fmc-adc-sim";
+	int c, n, efd, rate = 100, lost, sim;
+	struct zio_control *ctrl;
+	double t;
+
+	while ((c = getopt(argc, argv, "Vt:b:n:s:r:h")) != -1) {
+		switch (c) {
+		case 'V':
+			printf("%s %s\n", argv[0], git_version);
+			printf("%s\n", libfmcadc_version_s);
+			exit(0);
+		case 't':
+			type = optarg;
+			break;
+		case 'b':
+			nboards = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			nshots = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			nsamples = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rate = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fald_multi_help(argv[0]);
+			exit(1);
+		}
+	}
+	if (optind < argc)
+		nboards = argc - optind;
+	if (!nboards || nboards > FALD_MULTI_MAX || !nshots || !nsamples) {
+		fald_multi_help(argv[0]);
+		exit(1);
+	}
+	sim = !strcmp(type, "fmc-adc-sim");
+
+	efd = epoll_create1(0);
+	if (efd < 0) {
+		fprintf(stderr, "%s: epoll_create1: %s\n", argv[0],
+			strerror(errno));
+		exit(1);
+	}
+	memset(&acq, 0, sizeof(acq));
+	acq.type = FMCADC_CONF_TYPE_ACQ;
+	fmcadc_set_conf(&acq, FMCADC_CONF_ACQ_N_SHOTS, nshots);
+	fmcadc_set_conf(&acq, FMCADC_CONF_ACQ_PRE_SAMP, 0);
+	fmcadc_set_conf(&acq, FMCADC_CONF_ACQ_POST_SAMP, nsamples);
+
+	for (i = 0; i < nboards; i++) {
+		b = &brd[i];
+		b->dev_id = optind < argc ?
+			strtoul(argv[optind + i], NULL, 16) : i;
+		b->adc = fmcadc_open(type, b->dev_id, nsamples, nshots,
+				     FMCADC_F_FLUSH);
+		if (!b->adc) {
+			fprintf(stderr, "%s: cannot open %s 0x%04x: %s\n",
+				argv[0], type, b->dev_id,
+				fmcadc_strerror(errno));
+			exit(1);
+		}
+		if (fmcadc_apply_config(b->adc, 0, &acq) < 0 ||
+		    (sim && fmcadc_set_param(b->adc, "sim/trigger-rate", NULL,
+					     &rate) < 0)) {
+			fprintf(stderr, "%s: cannot configure 0x%04x: %s\n",
+				argv[0], b->dev_id, fmcadc_strerror(errno));
+			exit(1);
+		}
+		b->buf = fmcadc_request_buffer(b->adc, nsamples, NULL, 0);
+		if (!b->buf) {
+			fprintf(stderr, "%s: cannot allocate buffer: %s\n",
+				argv[0], fmcadc_strerror(errno));
+			exit(1);
+		}
+		ev[0].events = EPOLLIN;
+		ev[0].data.ptr = b;
+		n = fmcadc_get_fd(b->adc);
+		if (n < 0 || epoll_ctl(efd, EPOLL_CTL_ADD, n, ev) < 0) {
+			fprintf(stderr, "%s: cannot watch 0x%04x: %s\n",
+				argv[0], b->dev_id, fmcadc_strerror(errno));
+			exit(1);
+		}
+	}
+
+	t = fald_multi_now();
+	for (i = 0; i < nboards; i++) {
+		if (fmcadc_acq_start(brd[i].adc, 0, &zero) < 0) {
+			fprintf(stderr, "%s: cannot start 0x%04x: %s\n",
+				argv[0], brd[i].dev_id, fmcadc_strerror(errno));
+			exit(1);
+		}
+	}
+
+	/* The device is readable when a block is there: read it, no wait */
+	for (left = nboards; left; ) {
+		n = epoll_wait(efd, ev, FALD_MULTI_MAX, 1000);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			fprintf(stderr, "%s: %s\n", argv[0],
+				n ? strerror(errno) : "timeout");
+			exit(1);
+		}
+		while (n--) {
+			b = ev[n].data.ptr;
+			if (b->done)
+				continue;
+			while (fmcadc_fill_buffer(b->adc, b->buf, 0, &zero)
+			       == 0) {
+				ctrl = b->buf->metadata;
+				if (b->shots && ctrl->seq_num != b->seq + 1)
+					fprintf(stderr, "0x%04x: sequence "
+						"%u after %u\n", b->dev_id,
+						ctrl->seq_num, b->seq);
+				b->seq = ctrl->seq_num;
+				if (++b->shots == nshots)
+					break;
+			}
+			if (b->shots < nshots && errno != EAGAIN) {
+				fprintf(stderr, "%s: 0x%04x: %s\n", argv[0],
+					b->dev_id, fmcadc_strerror(errno));
+				exit(1);
+			}
+			if (b->shots == nshots) {
+				b->done = 1;
+				left--;
+				epoll_ctl(efd, EPOLL_CTL_DEL,
+					  fmcadc_get_fd(b->adc), NULL);
+			}
+		}
+	}
+	t = fald_multi_now() - t;
+
+	printf("%u boards, %u shots of %u samples each, in %.3f s\n",
+	       nboards, nshots, nsamples, t);
+	for (i = 0; i < nboards; i++) {
+		b = &brd[i];
+		lost = 0;
+		if (sim)
+			fmcadc_get_param(b->adc, "sim/lost-blocks", NULL,
+					 &lost);
+		printf("  0x%04x: %u shots, last sequence %u, %i lost\n",
+		       b->dev_id, b->shots, b->seq, lost);
+		fmcadc_acq_stop(b->adc, 0);
+		fmcadc_release_buffer(b->adc, b->buf, NULL);
+		fmcadc_close(b->adc);
+	}
+	exit(0);
+}
@@ -29,6 +29,9 @@ int print_data = 1;
 void print_buffer_content(struct fmcadc_buffer *buf);
 int read_with_one_buffer(struct fmcadc_dev *dev);
 int read_with_n_buffer(struct fmcadc_dev *dev);
+int apply_after_error(struct fmcadc_dev *dev);
+int check_trigger_position(struct fmcadc_dev *dev);
+int check_metadata(struct fmcadc_dev *dev);
 
 static void print_version(char *pname)
 {
@@ -121,6 +124,19 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
+	/* These tests configure the device on their own */
+	if (test >= 2 && test <= 4) {
+		if (test == 2)
+			err = apply_after_error(dev);
+		else if (test == 3)
+			err = check_trigger_position(dev);
+		else
+			err = check_metadata(dev);
+		fmcadc_close(dev);
+		fmcadc_exit();
+		exit(err ? 1 : 0);
+	}
+
 	/* Start the acquisition */
 	err = fmcadc_acq_start(dev, 0 , NULL);
 	if (err) {
@@ -176,19 +192,25 @@ int read_with_one_buffer(struct fmcadc_dev *dev)
 int read_with_n_buffer(struct fmcadc_dev *dev)
 {
 	struct fmcadc_buffer *buf[nshots] ;
-	int err = 0, i;
+	int err = 0, i, j, n;
 
 	/* Allocate all buffers before the use */
 	for (i = 0; i < nshots; ++i)
 		buf[i] = fmcadc_request_buffer(dev,
 				presamples + postsamples, NULL, 0);
 
-	/* Fill all buffers */
-	for (i = 0; i < nshots; ++i) {
-		err = fmcadc_fill_buffer(dev, buf[i], 0, NULL);
-		if (err)
+	/*
+	 * Fill all buffers, as many as available at each call. Print them
+	 * at once: mapped data is only valid until the next fill
+	 */
+	for (i = 0; i < nshots; i += n) {
+		n = fmcadc_fill_buffers(dev, buf + i, nshots - i, 0, NULL);
+		if (n < 0) {
+			err = n;
 			break;
-		print_buffer_content(buf[i]);
+		}
+		for (j = i; j < i + n; ++j)
+			print_buffer_content(buf[j]);
 	}
 
 	/* Release all buffers */
@@ -198,6 +220,173 @@ int read_with_n_buffer(struct fmcadc_dev *dev)
 	return err;
 }
 
+/*
+ * Apply a value the driver refuses, then the valid one again: the library
+ * must not skip the second write because it remembers the value
+ */
+int apply_after_error(struct fmcadc_dev *dev)
+{
+	struct fmcadc_conf acq;
+	int err, val;
+
+	memset(&acq, 0, sizeof(acq));
+	acq.type = FMCADC_CONF_TYPE_ACQ;
+	fmcadc_set_conf(&acq, FMCADC_CONF_ACQ_POST_SAMP, 1); /* minimum is 2 */
+	err = fmcadc_apply_config(dev, 0, &acq);
+	if (!err) {
+		fprintf(stderr, "post-samples 1 has been accepted\n");
+		return -1;
+	}
+
+	/* Nothing changed for the library, but the driver may have changed */
+	fmcadc_set_conf(&acq, FMCADC_CONF_ACQ_POST_SAMP, postsamples);
+	err = fmcadc_apply_config(dev, 0, &acq);
+	if (err) {
+		fprintf(stderr, "apply_config(post-samples %i): %s\n",
+			postsamples, fmcadc_strerror(errno));
+		return err;
+	}
+
+	/* Read the driver attribute, not what the library remembers */
+	err = fmcadc_get_param(dev, "cset0/trigger/post-samples", NULL, &val);
+	if (err) {
+		fprintf(stderr, "get_param(post-samples): %s\n",
+			fmcadc_strerror(errno));
+		return err;
+	}
+	if (val != postsamples) {
+		fprintf(stderr, "post-samples is %i, expected %i\n",
+			val, postsamples);
+		return -1;
+	}
+	printf("post-samples %i applied again after an error\n", val);
+	return 0;
+}
+/*
+ * Single shot with the internal trigger (channel 1, rising edge through 0):
+ * the data must start "presamples" before the trigger, so the signal
+ * crosses 0 at the first post-sample. It needs a signal on channel 1
+ * crossing 0, like a sine from a generator.
+ */
+int check_trigger_position(struct fmcadc_dev *dev)
+{
+	struct fmcadc_conf acq, trg;
+	struct fmcadc_buffer *buf;
+	struct zio_control *ctrl;
+	int16_t *data;
+	int err, i, cross = -1;
+
+	if (presamples < 2) {
+		fprintf(stderr, "at least 2 pre-samples are needed\n");
+		return -1;
+	}
+	memset(&acq, 0, sizeof(acq));
+	acq.type = FMCADC_CONF_TYPE_ACQ;
+	fmcadc_set_conf(&acq, FMCADC_CONF_ACQ_N_SHOTS, 1);
+	fmcadc_set_conf(&acq, FMCADC_CONF_ACQ_PRE_SAMP, presamples);
+	fmcadc_set_conf(&acq, FMCADC_CONF_ACQ_POST_SAMP, postsamples);
+	memset(&trg, 0, sizeof(trg));
+	trg.type = FMCADC_CONF_TYPE_TRG;
+	fmcadc_set_conf(&trg, FMCADC_CONF_TRG_SOURCE, 0); /* internal */
+	fmcadc_set_conf(&trg, FMCADC_CONF_TRG_SOURCE_CHAN, 0);
+	fmcadc_set_conf(&trg, FMCADC_CONF_TRG_THRESHOLD, 0);
+	fmcadc_set_conf(&trg, FMCADC_CONF_TRG_POLARITY, 0); /* rising */
+	err = fmcadc_apply_config(dev, 0, &acq);
+	if (!err)
+		err = fmcadc_apply_config(dev, 0, &trg);
+	if (err) {
+		fprintf(stderr, "apply_config: %s\n", fmcadc_strerror(errno));
+		return err;
+	}
+
+	buf = fmcadc_request_buffer(dev, presamples + postsamples, NULL, 0);
+	if (!buf)
+		return -1;
+	err = fmcadc_acq_start(dev, 0, NULL);
+	if (!err)
+		err = fmcadc_fill_buffer(dev, buf, 0, NULL);
+	if (err) {
+		fprintf(stderr, "acquisition: %s\n", fmcadc_strerror(errno));
+		fmcadc_release_buffer(dev, buf, NULL);
+		return err;
+	}
+
+	ctrl = buf->metadata;
+	data = buf->data;
+	if (ctrl->attr_trigger.std_val[ZIO_ATTR_TRIG_PRE_SAMP] != presamples)
+		fprintf(stderr, "metadata: pre-samples %i, expected %i\n",
+			ctrl->attr_trigger.std_val[ZIO_ATTR_TRIG_PRE_SAMP],
+			presamples);
+	/* The first rising crossing near the trigger sample */
+	for (i = presamples - 1; i <= presamples + 1 && i < buf->nsamples;
+	     ++i) {
+		if (data[(i - 1) * N_CHAN] < 0 && data[i * N_CHAN] >= 0) {
+			cross = i;
+			break;
+		}
+	}
+	fmcadc_release_buffer(dev, buf, NULL);
+	if (cross < 0) {
+		fprintf(stderr, "no trigger crossing at sample %i\n",
+			presamples);
+		return -1;
+	}
+	printf("trigger crossing at sample %i (pre-samples %i)\n",
+	       cross, presamples);
+	return 0;
+}
+
+/*
+ * Change pre and post samples twice through apply_config, then acquire
+ * one shot (external trigger): its metadata must report the last values
+ */
+int check_metadata(struct fmcadc_dev *dev)
+{
+	struct fmcadc_conf acq;
+	struct fmcadc_buffer *buf;
+	struct zio_control *ctrl;
+	int err, pre, post;
+
+	memset(&acq, 0, sizeof(acq));
+	acq.type = FMCADC_CONF_TYPE_ACQ;
+	fmcadc_set_conf(&acq, FMCADC_CONF_ACQ_N_SHOTS, 1);
+	fmcadc_set_conf(&acq, FMCADC_CONF_ACQ_PRE_SAMP, presamples + 1);
+	fmcadc_set_conf(&acq, FMCADC_CONF_ACQ_POST_SAMP, postsamples + 1);
+	err = fmcadc_apply_config(dev, 0, &acq);
+	if (!err) {
+		fmcadc_set_conf(&acq, FMCADC_CONF_ACQ_PRE_SAMP, presamples);
+		fmcadc_set_conf(&acq, FMCADC_CONF_ACQ_POST_SAMP, postsamples);
+		err = fmcadc_apply_config(dev, 0, &acq);
+	}
+	if (err) {
+		fprintf(stderr, "apply_config: %s\n", fmcadc_strerror(errno));
+		return err;
+	}
+
+	buf = fmcadc_request_buffer(dev, presamples + postsamples, NULL, 0);
+	if (!buf)
+		return -1;
+	err = fmcadc_acq_start(dev, 0, NULL);
+	if (!err)
+		err = fmcadc_fill_buffer(dev, buf, 0, NULL);
+	if (err) {
+		fprintf(stderr, "acquisition: %s\n", fmcadc_strerror(errno));
+		fmcadc_release_buffer(dev, buf, NULL);
+		return err;
+	}
+
+	ctrl = buf->metadata;
+	pre = ctrl->attr_trigger.std_val[ZIO_ATTR_TRIG_PRE_SAMP];
+	post = ctrl->attr_trigger.std_val[ZIO_ATTR_TRIG_POST_SAMP];
+	fmcadc_release_buffer(dev, buf, NULL);
+	if (pre != presamples || post != postsamples) {
+		fprintf(stderr, "metadata: pre/post-samples %i/%i, "
+			"expected %i/%i\n", pre, post, presamples, postsamples);
+		return -1;
+	}
+	printf("metadata: pre/post-samples %i/%i\n", pre, post);
+	return 0;
+}
 
 void print_buffer_content(struct fmcadc_buffer *buf)
 {